@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "constants.h"
+#include "kitchen.h"
+#include "courier.h"
+
+//Courier pool benchmark: arms a burst of pickups spread over a time window
+//and measures delivery latency (callback time - due time) for pools of
+//1, 2, 4 and 8 couriers. Each pickup spins for a while to model the work a
+//courier does per delivery.
+//
+//Usage: courier_bench [pickups] [window msecs] [work usecs]
+
+#define BENCH_MAX_POOL 8
+
+typedef struct bench_pickup_t {
+    uint64_t due_ns;
+} BENCH_PICKUP;
+
+static int g_work_usec;
+static int64_t *g_latency_ns;
+static unsigned int g_done;
+
+//Not a 'public' function; only internal to this file.
+static uint64_t bench_now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//Not a 'public' function; only internal to this file.
+//Stand-in for courier_timer_handler with a fixed amount of busy work
+static void bench_timer_handler(size_t timer_id, void *user_data)
+{
+    BENCH_PICKUP *pickup = (BENCH_PICKUP *)user_data;
+    uint64_t now = bench_now_ns();
+    uint64_t until = now + (uint64_t)g_work_usec * 1000;
+    unsigned int slot;
+
+    (void)timer_id;
+    slot = __sync_fetch_and_add(&g_done, 1);
+    g_latency_ns[slot] = (int64_t)(now - pickup->due_ns);
+
+    while(bench_now_ns() < until)
+        ;
+}
+
+//Not a 'public' function; only internal to this file.
+static int bench_cmp_latency(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+//Not a 'public' function; only internal to this file.
+static void bench_run(int couriers, int pickups, int window_msec)
+{
+    BENCH_PICKUP *pickup = calloc(pickups, sizeof(BENCH_PICKUP));
+    unsigned int interval;
+    int i, armed = 0;
+
+    g_done = 0;
+    COURIER_THREADS = couriers;
+    if(!courier_init()) {
+        printf("couriers %d: courier_init failed\n", couriers);
+        free(pickup);
+        return;
+    }
+    courier_start_threads();
+
+    for(i = 0; i < pickups; i++) {
+        interval = 100 + (rand() % window_msec);
+        pickup[i].due_ns = bench_now_ns() + (uint64_t)interval * 1000000ULL;
+        if(courier_start_timer(interval, bench_timer_handler, &pickup[i])) armed++;
+    }
+
+    //only the pickups that were armed ever call back
+    while(__sync_fetch_and_add(&g_done, 0) < (unsigned int)armed) {
+        usleep(10000);
+    }
+    courier_finalize();
+
+    if(armed == 0) {
+        printf("couriers %d: no pickup could be armed (%d failed)\n", couriers, pickups);
+        free(pickup);
+        return;
+    }
+    qsort(g_latency_ns, armed, sizeof(int64_t), bench_cmp_latency);
+    printf("couriers %d: p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms  (%d of %d armed)\n", couriers,
+                g_latency_ns[armed / 2] / 1e6,
+                g_latency_ns[(int)(armed * 0.99)] / 1e6,
+                g_latency_ns[armed - 1] / 1e6, armed, pickups);
+    free(pickup);
+}
+
+int main(int argc, char **argv)
+{
+    int pickups = (argc > 1) ? atoi(argv[1]) : 20000;
+    int window_msec = (argc > 2) ? atoi(argv[2]) : 2000;
+    int couriers;
+
+    g_work_usec = (argc > 3) ? atoi(argv[3]) : 200;
+
+    if(!init()) {
+        printf("!!! SYSTEM INIT FAILED !! ABORTING\n");
+        return 1;
+    }
+    courier_finalize(); //bench sets up its own pools
+    SYSTEM_DEBUG_LEVEL = NONE;
+
+    printf("%d pickups over %d msecs, %d usecs of work each\n", pickups, window_msec, g_work_usec);
+    g_latency_ns = malloc(pickups * sizeof(int64_t));
+    srand(1);
+    for(couriers = 1; couriers <= BENCH_MAX_POOL; couriers *= 2) {
+        bench_run(couriers, pickups, window_msec);
+    }
+    free(g_latency_ns);
+
+    finalize();
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "constants.h"
+#include "input.h"
+#include "json_index.h"
+#include "ingest.h"
+#include "pool.h"
+
+//Ingestion benchmark: writes a synthetic orders file in the layout of
+//"orders.json" and reports parse throughput of the stdio reader
+//(file_read_orders), of the mmap reader with each structural indexer the
+//CPU can run, and of parallel ingestion (kitchen.threads) with 2, 4 and 8
+//parser threads. Orders are released after every batch, so the figures
+//are for parsing only.
+//
+//Usage: ingest_bench [orders] [file]
+
+#define BENCH_BATCH 64
+
+static const char *g_names[] = { "Banana Split", "McFlury", "Acai Bowl", "Cheese Pizza",
+                                 "Pad Thai", "Kale Salad", "Cobb Salad", "Ice Cream Sandwich" };
+static const char *g_temps[] = { "hot", "cold", "frozen" };
+
+//Not a 'public' function; only internal to this file.
+static uint64_t bench_now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//Not a 'public' function; only internal to this file.
+static bool bench_write_orders(const char *file_name, long orders)
+{
+    FILE *f = fopen(file_name, "w");
+    long i;
+
+    if(f == NULL) return false;
+    fprintf(f, "[\n");
+    for(i = 0; i < orders; i++) {
+        fprintf(f, "  {\n"
+                   "    \"id\": \"%08lx-%04x-4%03x-a%03x-%012lx\",\n"
+                   "    \"name\": \"%s\",\n"
+                   "    \"temp\": \"%s\",\n"
+                   "    \"shelfLife\": %d,\n"
+                   "    \"decayRate\": 0.%02d\n"
+                   "  }%s\n",
+                   (unsigned long)rand(), rand() & 0xffff, rand() & 0xfff, rand() & 0xfff, (unsigned long)i,
+                   g_names[rand() % 8], g_temps[rand() % 3], 20 + rand() % 400, 10 + rand() % 90,
+                   (i + 1 < orders) ? "," : "");
+    }
+    fprintf(f, "]\n");
+    return fclose(f) == 0;
+}
+
+//Not a 'public' function; only internal to this file.
+//Frees whatever the last batch appended to the order LL; returns the count
+static long bench_release_orders()
+{
+    ORDER_LL_NODE *node = g_data->g_order_ll_head, *next;
+    long count = 0;
+
+    while(node) {
+        next = node->next;
+        order_release(node->data);
+        pool_free(&g_order_node_pool, node);
+        node = next;
+        count++;
+    }
+    g_data->g_order_ll_head = g_data->g_order_ll_tail = NULL;
+    return count;
+}
+
+//Not a 'public' function; only internal to this file.
+static void bench_run(const char *label, const char *file_name, ORDER_READER_TYPE type, 
+                      int threads, long bytes)
+{
+    ORDER_READER *reader;
+    uint64_t start, elapsed;
+    long orders = 0;
+    bool eof = false;
+
+    start = bench_now_ns();
+    if((reader = order_reader_open(file_name, type)) == NULL) {
+        printf("%-12s: cannot open %s\n", label, file_name);
+        return;
+    }
+    if(threads > 1 && !ingest_start(reader, threads, BENCH_BATCH)) {
+        printf("%-12s: cannot partition %s\n", label, file_name);
+        order_reader_close(reader);
+        return;
+    }
+    while(!eof) {
+        eof = (threads > 1) ? ingest_read_orders(BENCH_BATCH) : order_reader_read(reader, BENCH_BATCH);
+        orders += bench_release_orders();
+    }
+    if(threads > 1) ingest_finalize();
+    order_reader_close(reader);
+    elapsed = bench_now_ns() - start;
+
+    printf("%-12s: %ld orders in %8.3f s  %6.3f GB/s  %6.2f M orders/s\n", label, orders,
+                elapsed / 1e9, bytes / (double)elapsed, orders * 1e3 / elapsed);
+}
+
+int main(int argc, char **argv)
+{
+    long orders = (argc > 1) ? atol(argv[1]) : 10000000;
+    const char *file_name = (argc > 2) ? argv[2] : "ingest_bench.json";
+    char label[32];
+    FILE *f;
+    long bytes;
+    int impl, threads;
+
+    SYSTEM_DEBUG_LEVEL = NONE;
+    g_data = calloc(1, sizeof(DATA));
+
+    srand(1);
+    if(!bench_write_orders(file_name, orders) || (f = fopen(file_name, "r")) == NULL) {
+        printf("cannot write %s\n", file_name);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    bytes = ftell(f);
+    fclose(f);
+    printf("%ld orders, %.1f MB (%s)\n", orders, bytes / 1e6, file_name);
+
+    bench_run("stdio", file_name, ORDER_READER_STDIO, 1, bytes);
+    for(impl = JSON_INDEX_SCALAR; impl < MAX_JSON_INDEX_IMPL; impl++) {
+        if(!json_index_set_impl(impl)) continue;
+        snprintf(label, sizeof(label), "mmap/%s", json_index_impl_to_str(impl));
+        bench_run(label, file_name, ORDER_READER_MMAP, 1, bytes);
+    }
+    json_index_set_impl(json_index_best_impl());
+    for(threads = 2; threads <= 8; threads *= 2) {
+        snprintf(label, sizeof(label), "mmap x%d", threads);
+        bench_run(label, file_name, ORDER_READER_MMAP, threads, bytes);
+    }
+
+    unlink(file_name);
+    pool_destroy_all();
+    free(g_data);
+    return 0;
+}
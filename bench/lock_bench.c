@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "constants.h"
+#include "clock.h"
+#include "kitchen.h"
+#include "input.h"
+#include "order_index.h"
+#include "shelf_lockfree.h"
+
+//Shelf lock contention benchmark: kitchen threads shelve orders as fast
+//as the couriers keep up with (shelf_store_order), a monitor thread sweeps
+//every shelf over and over, valuing each order and discarding the stale
+//ones, and courier threads pick the shelved orders up (shelf_take_order) as
+//soon as they are shelved. Reports the latency of a pickup with the shelves
+//locked one at a time as the system does, with every operation also
+//wrapped in one bench-wide mutex (as with the single lock the shelves used
+//to have) and with the lock-free shelves (shelf.concurrency = lockfree).
+//The shelf sizes come from css.properties (run it from the directory that
+//has it).
+//
+//Usage: lock_bench [orders] [couriers] [kitchens]
+
+#define BENCH_MAX_THREADS   16
+#define BENCH_BACKLOG       24  //shelved orders not yet picked up
+
+typedef struct bench_courier_t {
+    pthread_t thread;
+    int64_t *latency_ns;
+    int samples;
+    int delivered;
+} BENCH_COURIER;
+
+//Order i of a run is made by whichever kitchen reserves i and picked up by
+//whichever courier claims i, once g_state[i] says it has been shelved
+#define BENCH_PENDING   0
+#define BENCH_SHELVED   1
+#define BENCH_DROPPED   2
+static ORDER_KEY *g_keys;
+static int *g_state;
+static int g_orders;
+static int g_reserved;          //orders [0, g_reserved) taken by kitchens
+static int g_claimed;           //orders [0, g_claimed) taken by couriers
+static int g_stop;              //the couriers are done
+static bool g_global;           //wrap every operation in g_global_mutex
+static pthread_mutex_t g_global_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//Not a 'public' function; only internal to this file.
+static uint64_t bench_now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//Not a 'public' function; only internal to this file.
+static void bench_lock()
+{
+    if(g_global) pthread_mutex_lock(&g_global_mutex);
+}
+
+//Not a 'public' function; only internal to this file.
+static void bench_unlock()
+{
+    if(g_global) pthread_mutex_unlock(&g_global_mutex);
+}
+
+//Not a 'public' function; only internal to this file.
+//Makes and shelves orders until the run has all g_orders of them
+static void *bench_kitchen_cb(void *arg)
+{
+    ORDER *order;
+    ORDER_KEY key;
+    bool shelved;
+    unsigned int mix;
+    int i;
+
+    (void)arg;
+    while((i = __sync_fetch_and_add(&g_reserved, 1)) < g_orders) {
+        //stay just ahead of the couriers rather than overflow the shelves
+        while(i - __sync_fetch_and_add(&g_claimed, 0) >= BENCH_BACKLOG) {
+            sched_yield();
+        }
+
+        order = order_alloc();
+        memset(order, 0, sizeof(ORDER));
+        order->id_len = order->name_len = snprintf(order->id_buf, sizeof(order->id_buf), "bench-%d", i);
+        order->id = order->name = order->id_buf;
+        order_key_from_id(order->id, order->id_len, &order->key);
+        mix = (unsigned int)i * 2654435761u; //same orders in every run
+        order->temp = (TEMP)((mix >> 8) % MAX_TEMP);
+        order->shelfLife = 1 + (mix >> 12) % 10;
+        order->decayRate = (50 + (mix >> 16) % 50) / 100.0;
+        order->created = clock_now_msec();
+        key = order->key; //once shelved the order is not ours to look at
+
+        bench_lock();
+        shelved = shelf_store_order(order);
+        bench_unlock();
+
+        g_keys[i] = key;
+        __atomic_store_n(&g_state[i], shelved ? BENCH_SHELVED : BENCH_DROPPED, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+//Not a 'public' function; only internal to this file.
+//Stand-in for a monitor that never sleeps: values every order on each
+//shelf, under that shelf's lock, and discards the stale ones (lock-free:
+//goes over the deadline columns the way the monitor does)
+static void *bench_monitor_cb(void *arg)
+{
+    SHELF shelf;
+    SHELF_ARRAY *array;
+    ORDER *order;
+    int64_t now, next;
+    int i, elapsed_time, modifier;
+    double value;
+
+    (void)arg;
+    while(!__sync_fetch_and_add(&g_stop, 0)) {
+        bench_lock();
+        for(shelf = HOT_SHELF; shelf < MAX_SHELF; shelf++) {
+            now = clock_now_msec();
+            if(SHELF_CONCURRENCY_TYPE == SHELF_CONCURRENCY_LOCKFREE) {
+                next = INT64_MAX;
+                shelf_lf_discard_stale(shelf, now, &next);
+                continue;
+            }
+            array = &g_data->g_shelves[shelf];
+            modifier = (shelf == OVERFLOW_SHELF) ?
+                                SHELF_LIFE_MODIFIER_OVERFLOW_SHELF : SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF;
+            shelf_lock(shelf);
+            for(i = array->count - 1; i >= 0; i--) {
+                order = array->orders[i];
+                elapsed_time = (int)(now - order->created);
+                value = order->shelfLife - (order->decayRate * (elapsed_time/1000) * modifier);
+                if(value < 0) shelf_release_order(shelf, order);
+            }
+            shelf_unlock(shelf);
+        }
+        bench_unlock();
+    }
+    return NULL;
+}
+
+//Not a 'public' function; only internal to this file.
+//Picks up the shelved orders in order, timing each shelf_take_order
+static void *bench_courier_cb(void *arg)
+{
+    BENCH_COURIER *courier = (BENCH_COURIER *)arg;
+    ORDER *order;
+    uint64_t start;
+    int i, state;
+
+    while((i = __sync_fetch_and_add(&g_claimed, 0)) < g_orders) {
+        if(i >= __sync_fetch_and_add(&g_reserved, 0) ||
+                    !__sync_bool_compare_and_swap(&g_claimed, i, i + 1)) {
+            sched_yield();
+            continue;
+        }
+        while((state = __atomic_load_n(&g_state[i], __ATOMIC_ACQUIRE)) == BENCH_PENDING) {
+            sched_yield();
+        }
+        if(state == BENCH_DROPPED) continue;
+
+        start = bench_now_ns();
+        bench_lock();
+        order = shelf_take_order(&g_keys[i]);
+        bench_unlock();
+        courier->latency_ns[courier->samples++] = (int64_t)(bench_now_ns() - start);
+        if(order) {
+            order_release(order);
+            courier->delivered++;
+        }
+    }
+    return NULL;
+}
+
+//Not a 'public' function; only internal to this file.
+static int bench_cmp_latency(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+//Not a 'public' function; only internal to this file.
+static void bench_run(const char *label, SHELF_CONCURRENCY concurrency, bool global, int couriers, int kitchens)
+{
+    BENCH_COURIER courier[BENCH_MAX_THREADS];
+    pthread_t kitchen[BENCH_MAX_THREADS], monitor;
+    int64_t *latency;
+    int i, samples = 0, delivered = 0;
+    uint64_t start, elapsed;
+    SHELF s;
+
+    //the shelves are empty between runs
+    for(s = HOT_SHELF; s < MAX_SHELF; s++) {
+        if(concurrency == SHELF_CONCURRENCY_LOCKFREE && g_data->g_shelves[s].occupied == NULL &&
+                    !shelf_lf_init(&g_data->g_shelves[s])) {
+            printf("%-10s: cannot allocate the shelves\n", label);
+            return;
+        }
+    }
+    SHELF_CONCURRENCY_TYPE = concurrency;
+    g_global = global;
+    g_reserved = g_claimed = 0;
+    g_stop = 0;
+    memset(g_state, 0, g_orders * sizeof(int));
+    for(i = 0; i < couriers; i++) {
+        memset(&courier[i], 0, sizeof(BENCH_COURIER));
+        courier[i].latency_ns = malloc(g_orders * sizeof(int64_t));
+    }
+
+    start = bench_now_ns();
+    pthread_create(&monitor, NULL, bench_monitor_cb, NULL);
+    for(i = 0; i < couriers; i++) pthread_create(&courier[i].thread, NULL, bench_courier_cb, &courier[i]);
+    for(i = 0; i < kitchens; i++) pthread_create(&kitchen[i], NULL, bench_kitchen_cb, NULL);
+
+    for(i = 0; i < kitchens; i++) pthread_join(kitchen[i], NULL);
+    for(i = 0; i < couriers; i++) pthread_join(courier[i].thread, NULL);
+    __sync_fetch_and_add(&g_stop, 1);
+    pthread_join(monitor, NULL);
+    elapsed = bench_now_ns() - start;
+
+    latency = malloc(g_orders * sizeof(int64_t));
+    for(i = 0; i < couriers; i++) {
+        memcpy(latency + samples, courier[i].latency_ns, courier[i].samples * sizeof(int64_t));
+        samples += courier[i].samples;
+        delivered += courier[i].delivered;
+        free(courier[i].latency_ns);
+    }
+    if(samples > 0) {
+        qsort(latency, samples, sizeof(int64_t), bench_cmp_latency);
+        printf("%-10s: %d pickups (%d delivered)  p50 %7.2f us  p99 %7.2f us  max %8.2f us  run %7.1f ms\n",
+                    label, samples, delivered, latency[samples / 2] / 1e3,
+                    latency[(int)(samples * 0.99)] / 1e3, latency[samples - 1] / 1e3, elapsed / 1e6);
+    }
+    free(latency);
+}
+
+int main(int argc, char **argv)
+{
+    int couriers, kitchens;
+
+    g_orders = (argc > 1) ? atoi(argv[1]) : 100000;
+    couriers = (argc > 2) ? atoi(argv[2]) : 4;
+    kitchens = (argc > 3) ? atoi(argv[3]) : 2;
+    if(couriers < 1) couriers = 1;
+    if(couriers > BENCH_MAX_THREADS) couriers = BENCH_MAX_THREADS;
+    if(kitchens < 1) kitchens = 1;
+    if(kitchens > BENCH_MAX_THREADS) kitchens = BENCH_MAX_THREADS;
+
+    if(!init()) {
+        printf("!!! SYSTEM INIT FAILED !! ABORTING\n");
+        return 1;
+    }
+    SYSTEM_DEBUG_LEVEL = NONE;
+    SYSTEM_PRINT_SHELF_CONTENTS = false;
+    g_keys = malloc(g_orders * sizeof(ORDER_KEY));
+    g_state = malloc(g_orders * sizeof(int));
+
+    printf("%d orders, %d kitchens, %d couriers, shelves %d/%d/%d/%d\n", g_orders, kitchens, couriers,
+                HOT_SHELF_MAX_SIZE, COLD_SHELF_MAX_SIZE, FROZEN_SHELF_MAX_SIZE, OVERFLOW_SHELF_MAX_SIZE);
+    bench_run("per-shelf", SHELF_CONCURRENCY_LOCKED, false, couriers, kitchens);
+    bench_run("global", SHELF_CONCURRENCY_LOCKED, true, couriers, kitchens);
+    bench_run("lock-free", SHELF_CONCURRENCY_LOCKFREE, false, couriers, kitchens);
+
+    free(g_keys);
+    free(g_state);
+    finalize();
+    return 0;
+}
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "constants.h"
+#include "clock.h"
+#include "kitchen.h"
+#include "input.h"
+#include "order_index.h"
+#include "placement.h"
+
+//Placement policy benchmark: how many orders each placement policy
+//(shelf.placement) wastes - discards for want of shelf space, or lets go
+//stale - and how much value it delivers, at a given order arrival rate.
+//The orders of the configured orders file (temperature, shelfLife and
+//decayRate) are replayed over and over, arriving evenly spaced, each with a
+//courier delay drawn from the configured dispatch interval; every policy
+//sees the very same orders and delays. Time is simulated (shelf_set_clock),
+//so a run of minutes takes milliseconds: the shelves' own code places and
+//picks up the orders, and stale orders are swept off before every event as
+//the monitor would. The shelf sizes also come from css.properties (run it
+//from the directory that has it).
+//
+//Usage: policy_bench [orders] [rate ...]
+
+#define BENCH_MAX_TEMPLATES 100000
+
+typedef struct bench_template_t {
+    TEMP temp;
+    int shelfLife;
+    float decayRate;
+} BENCH_TEMPLATE;
+
+//A courier due at a time, for order i of the run
+typedef struct bench_pickup_t {
+    int64_t at;
+    int i;
+} BENCH_PICKUP;
+
+static BENCH_TEMPLATE *g_templates;
+static int g_template_count;
+static int64_t g_now;               //the simulated clock, msecs
+static BENCH_PICKUP *g_pickups;     //min-heap on at
+static int g_pickup_count;
+static ORDER_KEY *g_keys;
+
+//Not a 'public' function; only internal to this file.
+static int64_t bench_clock()
+{
+    return g_now;
+}
+
+//Not a 'public' function; only internal to this file.
+//Keeps the temperature, shelfLife and decayRate of every order in the file
+static bool bench_load_templates()
+{
+    ORDER_READER *reader;
+    ORDER *order;
+
+    reader = order_reader_open(SYSTEM_ORDERS_INPUT_FILE, SYSTEM_ORDERS_READER);
+    if(reader == NULL) return false;
+
+    g_templates = malloc(BENCH_MAX_TEMPLATES * sizeof(BENCH_TEMPLATE));
+    while(g_template_count < BENCH_MAX_TEMPLATES && order_reader_next(reader, &order)) {
+        if(order == NULL) continue;
+        g_templates[g_template_count].temp = order->temp;
+        g_templates[g_template_count].shelfLife = order->shelfLife;
+        g_templates[g_template_count].decayRate = order->decayRate;
+        g_template_count++;
+        order_release(order);
+    }
+    order_reader_close(reader);
+    return g_template_count > 0;
+}
+
+//Not a 'public' function; only internal to this file.
+static void bench_pickup_push(int64_t at, int i)
+{
+    int child = g_pickup_count++, parent;
+
+    while(child > 0 && g_pickups[(parent = (child - 1) / 2)].at > at) {
+        g_pickups[child] = g_pickups[parent];
+        child = parent;
+    }
+    g_pickups[child].at = at;
+    g_pickups[child].i = i;
+}
+
+//Not a 'public' function; only internal to this file.
+static BENCH_PICKUP bench_pickup_pop()
+{
+    BENCH_PICKUP top = g_pickups[0], last = g_pickups[--g_pickup_count];
+    int parent = 0, child;
+
+    while((child = 2 * parent + 1) < g_pickup_count) {
+        if(child + 1 < g_pickup_count && g_pickups[child + 1].at < g_pickups[child].at) child++;
+        if(last.at <= g_pickups[child].at) break;
+        g_pickups[parent] = g_pickups[child];
+        parent = child;
+    }
+    g_pickups[parent] = last;
+    return top;
+}
+
+//Not a 'public' function; only internal to this file.
+//What the monitor does at g_now: every order past its deadline goes, the
+//overflow shelf's first, and freed temperature shelf slots are refilled
+//from the overflow shelf
+static int bench_sweep_stale()
+{
+    static const SHELF order[MAX_SHELF] = { OVERFLOW_SHELF, HOT_SHELF, COLD_SHELF, FROZEN_SHELF };
+    SHELF shelf;
+    SHELF_ARRAY *array;
+    int i, s, discarded, stale = 0;
+
+    for(s = 0; s < MAX_SHELF; s++) {
+        shelf = order[s];
+        array = &g_data->g_shelves[shelf];
+        discarded = 0;
+        shelf_lock(shelf);
+        for(i = array->count - 1; i >= 0; i--) {
+            if(array->orders[i]->expiry <= g_now) {
+                shelf_release_order(shelf, array->orders[i]);
+                discarded++;
+            }
+        }
+        if(discarded > 0) shelf_rebalance(shelf);
+        shelf_unlock(shelf);
+        stale += discarded;
+    }
+    return stale;
+}
+
+//Not a 'public' function; only internal to this file.
+//Runs the couriers due up to the given time, in time order
+static void bench_advance(int64_t until, int *delivered, int *stale, double *value)
+{
+    ORDER_INDEX_ENTRY *entry;
+    BENCH_PICKUP pickup;
+    ORDER *order;
+    SHELF shelf = HOT_SHELF;
+
+    while(g_pickup_count > 0 && g_pickups[0].at <= until) {
+        pickup = bench_pickup_pop();
+        g_now = pickup.at;
+        *stale += bench_sweep_stale();
+
+        order_index_lock(&g_data->g_order_index, &g_keys[pickup.i]);
+        entry = order_index_lookup(&g_data->g_order_index, &g_keys[pickup.i]);
+        if(entry) shelf = entry->shelf;
+        order_index_unlock(&g_data->g_order_index, &g_keys[pickup.i]);
+        if(entry && (order = shelf_take_order(&g_keys[pickup.i])) != NULL) {
+            *value += shelf_value_at(order, shelf, g_now);
+            (*delivered)++;
+            order_release(order);
+        }
+    }
+    if(until > g_now) g_now = until;
+    *stale += bench_sweep_stale();
+}
+
+//Not a 'public' function; only internal to this file.
+static void bench_run(PLACEMENT_POLICY_TYPE policy, int orders, double rate, int64_t start)
+{
+    const int range = KITCHEN_COURIER_DISPATCH_INTERVAL_MAX - KITCHEN_COURIER_DISPATCH_INTERVAL_MIN + 1;
+    BENCH_TEMPLATE *template;
+    ORDER *order;
+    unsigned int mix;
+    int i, delivered = 0, stale = 0, discarded;
+    double value = 0;
+    int64_t arrive, pickup;
+
+    SHELF_PLACEMENT_POLICY = policy;
+    g_data->g_discarded_count = 0;
+    g_data->g_discarded_value = 0;
+    g_pickup_count = 0;
+    g_now = start;
+
+    for(i = 0; i < orders; i++) {
+        arrive = start + (int64_t)(i * 1000.0 / rate);
+        bench_advance(arrive, &delivered, &stale, &value);
+
+        template = &g_templates[i % g_template_count];
+        order = order_alloc();
+        order->id_len = order->name_len = snprintf(order->id_buf, sizeof(order->id_buf), "bench-%d", i);
+        order->id = order->name = order->id_buf;
+        order_key_from_id(order->id, order->id_len, &order->key);
+        order->temp = template->temp;
+        order->shelfLife = template->shelfLife;
+        order->decayRate = template->decayRate;
+        order->created = arrive;
+        mix = (unsigned int)i * 2654435761u; //same delays for every policy
+        order->pickup = pickup = arrive + KITCHEN_COURIER_DISPATCH_INTERVAL_MIN + (int)((mix >> 8) % range);
+        g_keys[i] = order->key; //once shelved the order is not ours to look at
+
+        if(shelf_store_order(order)) bench_pickup_push(pickup, i);
+    }
+    bench_advance(INT64_MAX, &delivered, &stale, &value);
+
+    discarded = g_data->g_discarded_count;
+    printf("%6.1f  %-12s  %9d  %9d  %7d  %6.2f%%  %12.1f\n", rate, placement_policy_to_str(policy),
+                delivered, discarded, stale, 100.0 * (orders - delivered) / orders, value);
+}
+
+int main(int argc, char **argv)
+{
+    static const double default_rates[] = { 2, 5, 10, 15, 20 };
+    double rates[64];
+    int orders, rate_count = 0, i;
+    PLACEMENT_POLICY_TYPE policy;
+    int64_t start;
+
+    orders = (argc > 1) ? atoi(argv[1]) : 20000;
+    if(orders < 1) orders = 1;
+    for(i = 2; i < argc && rate_count < 64; i++) {
+        if(atof(argv[i]) > 0) rates[rate_count++] = atof(argv[i]);
+    }
+    if(rate_count == 0) {
+        rate_count = sizeof(default_rates) / sizeof(default_rates[0]);
+        memcpy(rates, default_rates, sizeof(default_rates));
+    }
+
+    if(!init()) {
+        printf("!!! SYSTEM INIT FAILED !! ABORTING\n");
+        return 1;
+    }
+    SYSTEM_DEBUG_LEVEL = NONE;
+    SYSTEM_PRINT_SHELF_CONTENTS = false;
+    SHELF_CONCURRENCY_TYPE = SHELF_CONCURRENCY_LOCKED; //same choices either way
+    if(!bench_load_templates()) {
+        printf("cannot read the orders file %s\n", SYSTEM_ORDERS_INPUT_FILE);
+        return 1;
+    }
+    g_keys = malloc(orders * sizeof(ORDER_KEY));
+    g_pickups = malloc(orders * sizeof(BENCH_PICKUP));
+    shelf_set_clock(bench_clock);
+    start = clock_now_msec();
+
+    printf("%d orders per run (%d distinct), shelves %d/%d/%d/%d, courier delay %d-%d msecs, %s eviction for greedy\n",
+                orders, g_template_count, HOT_SHELF_MAX_SIZE, COLD_SHELF_MAX_SIZE, FROZEN_SHELF_MAX_SIZE,
+                OVERFLOW_SHELF_MAX_SIZE, KITCHEN_COURIER_DISPATCH_INTERVAL_MIN,
+                KITCHEN_COURIER_DISPATCH_INTERVAL_MAX, overflow_eviction_to_str(SHELF_OVERFLOW_EVICTION));
+    printf("rate/s  policy        delivered  discarded    stale   wasted  value delivered\n");
+    for(i = 0; i < rate_count; i++) {
+        for(policy = PLACEMENT_GREEDY; policy < MAX_PLACEMENT_POLICY; policy++) {
+            bench_run(policy, orders, rates[i], start);
+        }
+    }
+
+    shelf_set_clock(NULL);
+    free(g_templates);
+    free(g_keys);
+    free(g_pickups);
+    finalize();
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "constants.h"
+#include "clock.h"
+#include "input.h"
+#include "pool.h"
+#include "shelf_soa.h"
+
+//Shelf sweep benchmark: fills one shelf of the given number of slots with
+//orders of random age, shelfLife and decayRate, and reports how fast a
+//whole shelf is valued (and its stale orders found) the way the AoS layout
+//does it, one ORDER* at a time, and with the SoA kernel (shelf_soa.c) in
+//each implementation the CPU can run. The orders array is shuffled so that
+//the AoS sweep sees them in no particular memory order, as on a shelf that
+//has been through a lot of swap removals.
+//
+//Usage: shelf_bench [slots] [sweeps]
+
+//Not a 'public' function; only internal to this file.
+static uint64_t bench_now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//Not a 'public' function; only internal to this file.
+//The per-order sweep of print_event_shelf_contents (aos layout)
+static int bench_sweep_aos(SHELF_ARRAY *array, int64_t now, int modifier)
+{
+    int i, elapsed_time, stale = 0;
+    double value;
+    ORDER *order;
+
+    for(i = 0; i < array->count; i++) {
+        order = array->orders[i];
+        elapsed_time = (int)(now - order->created);
+        value = order->shelfLife - (order->decayRate * (elapsed_time/1000) * modifier);
+        array->values[i] = value;
+        if(value < 0) stale++;
+    }
+    return stale;
+}
+
+//Not a 'public' function; only internal to this file.
+static void bench_report(const char *label, int slots, int sweeps, int stale, uint64_t elapsed)
+{
+    printf("%-12s: %d stale  %8.3f ms/sweep  %7.2f ns/slot  %8.1f M slots/s\n", label, stale,
+                elapsed / 1e6 / sweeps, elapsed / (double)slots / sweeps,
+                (double)slots * sweeps * 1e3 / elapsed);
+}
+
+int main(int argc, char **argv)
+{
+    int slots = (argc > 1) ? atoi(argv[1]) : 50000;
+    int sweeps = (argc > 2) ? atoi(argv[2]) : 1000;
+    int modifier = DEFAULT_SHELF_LIFE_MODIFIER_OVERFLOW_SHELF;
+    SHELF_ARRAY array;
+    int64_t now_ms;
+    uint64_t start;
+    ORDER *order, *tmp;
+    int i, j, stale = 0, aos_stale = 0;
+    int impl, run;
+
+    SYSTEM_DEBUG_LEVEL = NONE;
+    memset(&array, 0, sizeof(array));
+    array.capacity = slots;
+    array.orders = calloc(slots + 1, sizeof(ORDER *));
+    if(array.orders == NULL || !shelf_soa_init(&array, modifier)) {
+        printf("cannot allocate %d slots\n", slots);
+        return 1;
+    }
+
+    srand(1);
+    now_ms = clock_now_msec();
+    for(i = 0; i < slots; i++) {
+        order = order_alloc();
+        order->created = now_ms - (int64_t)(rand() % 300) * 1000;
+        order->shelfLife = 20 + rand() % 400;
+        order->decayRate = (10 + rand() % 90) / 100.0;
+        array.orders[array.count++] = order;
+    }
+    for(i = slots - 1; i > 0; i--) {
+        j = rand() % (i + 1);
+        tmp = array.orders[i];
+        array.orders[i] = array.orders[j];
+        array.orders[j] = tmp;
+    }
+    for(i = 0; i < slots; i++) shelf_soa_set(&array, i, array.orders[i]);
+    printf("%d slots, %d sweeps\n", slots, sweeps);
+
+    start = bench_now_ns();
+    for(run = 0; run < sweeps; run++) aos_stale = bench_sweep_aos(&array, now_ms, modifier);
+    bench_report("aos", slots, sweeps, aos_stale, bench_now_ns() - start);
+
+    for(impl = SHELF_SOA_SCALAR; impl < MAX_SHELF_SOA_IMPL; impl++) {
+        char label[32];
+
+        if(!shelf_soa_set_impl(impl)) continue;
+        snprintf(label, sizeof(label), "soa/%s", shelf_soa_impl_to_str(impl));
+        start = bench_now_ns();
+        for(run = 0; run < sweeps; run++) stale = shelf_soa_evaluate(&array, now_ms);
+        bench_report(label, slots, sweeps, stale, bench_now_ns() - start);
+        if(stale != aos_stale) printf("%-12s: MISMATCH with aos (%d vs %d stale)\n", label, stale, aos_stale);
+    }
+
+    shelf_soa_destroy(&array);
+    free(array.orders);
+    pool_destroy_all();
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "clock.h"
+
+//wall clock minus monotonic clock, msecs; taken once by clock_init()
+static int64_t g_clock_wall_offset;
+
+//The date string ("%Y-%m-%d %H:%M:%S") of the wall clock second a thread
+//last printed a time in; redone (localtime_r, strftime) once that second
+//is over
+static __thread int64_t t_clock_sec = -1;
+static __thread char t_clock_date[32];
+static __thread size_t t_clock_date_len;
+
+/**PROC+**********************************************************************/
+/* Name:      clock_init                                                     */
+/*                                                                           */
+/* Purpose:   Ties the monotonic clock to the wall clock for printing        */
+/*                                                                           */
+/* Returns:   bool - for success/failure.                                    */
+/*                                                                           */
+/*                                                                           */
+/* Operation: The offset between the two is taken once; the wall times       */
+/*            printed after a step of the wall clock keep to the old one, as */
+/*            do the ages of the orders.                                     */
+/*                                                                           */
+/**PROC-**********************************************************************/
+bool clock_init() {
+    struct timespec wall, mono;
+
+    tzset();
+    if(clock_gettime(CLOCK_REALTIME, &wall) != 0 || clock_gettime(CLOCK_MONOTONIC, &mono) != 0) {
+        return false;
+    }
+    g_clock_wall_offset = ((int64_t)wall.tv_sec * 1000 + wall.tv_nsec / 1000000) -
+                                ((int64_t)mono.tv_sec * 1000 + mono.tv_nsec / 1000000);
+    return true;
+}
+
+//Time by the monotonic clock, nsecs
+int64_t clock_now_nsec() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//Time by the monotonic clock, msecs; what order ages, deadlines (expiry,
+//pickup) and the timerfds go by
+int64_t clock_now_msec() {
+    return clock_now_nsec() / 1000000;
+}
+
+//Wall clock time (msecs since the epoch) of a clock_now_msec() time
+int64_t clock_to_wall_msec(int64_t msec) {
+    return msec + g_clock_wall_offset;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      clock_format_wall                                              */
+/*                                                                           */
+/* Purpose:   Formats a wall clock time the way css prints times             */
+/*                                                                           */
+/* Params:    IN     wall_msec       - msecs since the epoch                 */
+/*            IN/OUT buf             - CLOCK_STR_SIZE bytes, filled in with  */
+/*                                     "YYYY-MM-DD hh:mm:ss.mmm"             */
+/*                                                                           */
+/* Returns:   buf                                                            */
+/*                                                                           */
+/* Operation: Only the msecs are formatted while the time stays within the   */
+/*            second this thread formatted last.                             */
+/*                                                                           */
+/**PROC-**********************************************************************/
+char *clock_format_wall(int64_t wall_msec, char *buf) {
+    int64_t sec = wall_msec / 1000;
+    int msec = (int)(wall_msec % 1000);
+    time_t nowtime;
+    struct tm nowtm;
+
+    if(sec != t_clock_sec) {
+        nowtime = (time_t)sec;
+        localtime_r(&nowtime, &nowtm);
+        t_clock_date_len = strftime(t_clock_date, sizeof t_clock_date, "%Y-%m-%d %H:%M:%S", &nowtm);
+        t_clock_sec = sec;
+    }
+    memcpy(buf, t_clock_date, t_clock_date_len);
+    buf[t_clock_date_len] = '.';
+    buf[t_clock_date_len + 1] = '0' + msec / 100;
+    buf[t_clock_date_len + 2] = '0' + msec / 10 % 10;
+    buf[t_clock_date_len + 3] = '0' + msec % 10;
+    buf[t_clock_date_len + 4] = '\0';
+    return buf;
+}
+
+//Fills buf (CLOCK_STR_SIZE bytes) with the time now, for a debug line
+//that is being printed; returns buf
+char *clock_log_time(char *buf) {
+    return clock_format_wall(clock_to_wall_msec(clock_now_msec()), buf);
+}
@@ -0,0 +1,25 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//Time for the rest of css: ages, deadlines and timers go by the monotonic
+//clock (CLOCK_MONOTONIC, as are the timerfds), so a step of the wall clock
+//(NTP, by hand) neither fires nor holds back pickups and stale checks. The
+//wall clock is only for what is printed: a monotonic time is turned into
+//one by the offset taken at clock_init(). Log timestamps are formatted
+//only when a line is printed, from a date string each thread keeps for
+//the current second.
+
+//size of the buffer clock_log_time()/clock_format_wall() fill in
+#define CLOCK_STR_SIZE 64
+
+bool clock_init();
+int64_t clock_now_nsec();
+int64_t clock_now_msec();
+int64_t clock_to_wall_msec(int64_t msec);
+char *clock_format_wall(int64_t wall_msec, char *buf);
+char *clock_log_time(char *buf);
+
+#endif //CLOCK_H
@@ -28,6 +28,69 @@ typedef enum order_event_t {
     MAX_EVENT = 4
 } ORDER_EVENT;
 
+//What happened to one order, for system.print.mode = delta
+typedef enum order_delta_t {
+    ORDER_DELTA_READ = 0,               //came in from the kitchen
+    ORDER_DELTA_PLACED = 1,             //went on a shelf
+    ORDER_DELTA_MOVED = 2,              //went from the overflow shelf to its own
+    ORDER_DELTA_DELIVERED = 3,          //picked up
+    ORDER_DELTA_DISCARDED_SHELF_FULL = 4,   //evicted, or dropped on arrival
+    ORDER_DELTA_DISCARDED_STALE = 5,    //gone stale on its shelf
+    MAX_ORDER_DELTA = 6
+} ORDER_DELTA;
+
+//How shelf contents are printed (system.print.mode)
+typedef enum print_mode_t {
+    PRINT_MODE_FULL = 0,        //every shelf on every event
+    PRINT_MODE_DELTA = 1,       //an NDJSON line per change, shelves now and then
+    MAX_PRINT_MODE = 2
+} PRINT_MODE;
+
+//Orders file ingestion backend
+typedef enum order_reader_type_t {
+    ORDER_READER_STDIO = 0,     //line oriented fgets() of the sample layout
+    ORDER_READER_MMAP = 1,      //mmap'd file, single pass JSON tokenizer
+    ORDER_READER_PACKED = 2,    //mmap'd binary columns written by css-pack
+    MAX_ORDER_READER = 3
+} ORDER_READER_TYPE;
+
+//What a full overflow shelf does with an order that fits nowhere
+typedef enum overflow_eviction_t {
+    OVERFLOW_EVICT_DROP_NEW = 0,        //discard the order being shelved
+    OVERFLOW_EVICT_NEAREST_EXPIRY = 1,  //discard whichever goes stale first
+    MAX_OVERFLOW_EVICT = 2
+} OVERFLOW_EVICTION;
+
+typedef enum shelf_layout_t {
+    SHELF_LAYOUT_AOS = 0,       //values computed from each ORDER
+    SHELF_LAYOUT_SOA = 1,       //plus per-shelf columns for the SIMD kernel
+    MAX_SHELF_LAYOUT = 2
+} SHELF_LAYOUT;
+
+//How threads share the shelves
+typedef enum shelf_concurrency_t {
+    SHELF_CONCURRENCY_LOCKED = 0,   //a mutex per shelf (see the lock order below)
+    SHELF_CONCURRENCY_LOCKFREE = 1, //slots claimed with CAS (shelf_lockfree.c)
+    MAX_SHELF_CONCURRENCY = 2
+} SHELF_CONCURRENCY;
+
+//What the shelves do with an order that fits on neither its temperature
+//shelf nor the overflow shelf (placement.c)
+typedef enum placement_policy_type_t {
+    PLACEMENT_GREEDY = 0,       //move the nearest expiry back, else shelf.overflow.eviction
+    PLACEMENT_LOWEST_VALUE = 1, //move back, else evict the lowest value now
+    PLACEMENT_LOOKAHEAD = 2,    //most value delivered, by the known pickup times
+    MAX_PLACEMENT_POLICY = 3
+} PLACEMENT_POLICY_TYPE;
+
+//Min-heaps an order can be in, ordered on ORDER.expiry; an order keeps its
+//position in each
+typedef enum order_heap_kind_t {
+    ORDER_HEAP_OVERFLOW = 0,    //overflow orders of one temperature
+    ORDER_HEAP_DEADLINE = 1,    //every shelved order; drives the monitor
+    MAX_ORDER_HEAP = 2
+} ORDER_HEAP_KIND;
+
 typedef enum debug_level_t {
     NONE = 0,
     L1 = 1,
@@ -37,13 +100,28 @@ typedef enum debug_level_t {
 } DEBUG_LEVEL;
 
 //STRUCTs
+//128-bit binary order id (the UUID's bytes); key of the order index
+typedef struct order_key_t {
+    uint64_t hi;
+    uint64_t lo;
+} ORDER_KEY;
+
 typedef struct order_t {
-    char *id;
-    char *name;
+    char *id;            //id_len chars; a view into the orders file is not NUL terminated
+    char *name;          //name_len chars; likewise
+    uint32_t id_len;
+    uint32_t name_len;
+    bool id_copied;      //id is an arena copy (stdio reader, escaped JSON); freed by order_release
+    bool name_copied;    //likewise for name
+    char id_buf[37];     //text of a packed (binary) UUID; id points here
+    ORDER_KEY key;       //binary id, set by the reader along with id
     TEMP temp;
     int shelfLife;
     float decayRate;
-    struct timeb creationTime;
+    int64_t created;                //msecs (clock_now_msec) it was read at
+    int64_t expiry;                 //msecs (clock_now_msec) it goes stale at on its shelf
+    int64_t pickup;                 //msecs (clock_now_msec) its courier is due at; 0 if not known
+    int heapPos[MAX_ORDER_HEAP];    //position in each ORDER_HEAP it is in
 } ORDER;
 
 typedef struct order_ll_node_t {
@@ -51,40 +129,126 @@ typedef struct order_ll_node_t {
     struct order_ll_node_t *next;
 } ORDER_LL_NODE;
 
+typedef struct order_heap_t {
+    ORDER **orders;
+    int count;
+    ORDER_HEAP_KIND kind;
+} ORDER_HEAP;
+
+//One entry of the order index; an empty entry has no order
+typedef struct order_index_entry_t {
+    ORDER_KEY key;
+    ORDER *order;
+    int slot;       //position of the order in g_shelves[shelf]
+    SHELF shelf;
+} ORDER_INDEX_ENTRY;
+
+//Open addressing (linear probing) table of the shelved orders of one
+//stripe; grows so that it is never more than half full
+typedef struct order_index_stripe_t {
+    ORDER_INDEX_ENTRY *entries;
+    uint64_t mask;
+    int shift;      //64 - log2(capacity); see order_index.c
+    int count;
+    pthread_mutex_t mutex;
+} ORDER_INDEX_STRIPE;
+
+//The order index: a key's hash picks one of the stripes, each a table of
+//its own under its own lock, so pickups of different orders rarely wait
+//on each other
+#define ORDER_INDEX_STRIPES     16
+typedef struct order_index_t {
+    ORDER_INDEX_STRIPE stripes[ORDER_INDEX_STRIPES];
+    int count;      //orders in all stripes (atomic)
+} ORDER_INDEX;
+
+//Orders on one shelf; removal swaps the last order into the gap
+typedef struct shelf_array_t {
+    ORDER **orders;
+    int count;
+    int capacity;
+    
+    //shelf.concurrency = lockfree only (NULL otherwise): orders[] is then a
+    //fixed array of slots, not dense, and count is updated atomically
+    uint64_t *occupied;     //bit i of word i/64 set: slot i is claimed
+    int64_t *deadline;      //expiry of the order in each slot
+    
+    //shelf.layout = soa only (NULL otherwise): what the value of an order
+    //depends on, in columns kept slot for slot with orders (shelf_soa.c)
+    double *created;        //creation time, msecs (clock_now_msec)
+    float *shelfLife;
+    float *decayRate;
+    float modifier;         //shelfDecayModifier of the shelf
+    float *values;          //kernel output (value, stale bit) of each slot
+    uint64_t *stale;
+} SHELF_ARRAY;
+
 typedef struct data_t {
     ORDER_LL_NODE *g_order_ll_head;
     ORDER_LL_NODE *g_order_ll_tail;
 
-    //<order_id> - <SHELF>
-    GHashTable *g_order_id_shelf_hash;
-    //HOT_SHELF <order_id> - <Order>
-    GHashTable *g_order_id_hot_shelf_hash;
-    //COLD_SHELF <order_id> - <Order>
-    GHashTable *g_order_id_cold_shelf_hash;
-    //OVERFLOW_SHELF <order_id> - <Order>
-    GHashTable *g_order_id_frozen_shelf_hash;
-    //FROZEN_SHELF <order_id> - <Order>
-    GHashTable *g_order_id_overflow_shelf_hash;
+    //<order key> - <Order, SHELF, slot> of every order on a shelf
+    ORDER_INDEX g_order_index;
+    //Contents of each shelf; dense, the index entry's slot points here
+    SHELF_ARRAY g_shelves[MAX_SHELF];
+    
+    //OVERFLOW_SHELF contents...grouped by temperature; each a min-heap on
+    //expiry, so its first order is the one to promote when a slot on its
+    //temperature shelf frees up (shelf_rebalance)
+    ORDER_HEAP g_overflow_by_temp[MAX_TEMP];
+    //Orders of each shelf, on expiry; the monitor wakes for the first one
+    ORDER_HEAP g_deadlines[MAX_SHELF];
     
-    //OVERFLOW_SHELF contents...grouped by temperature...2-d array of ORDER*
-    //..{TEMP][OVERFLOW_SHELF_MAX_SIZE]
-    ORDER ***g_overflow_by_temp_array;
-    int *g_overflow_by_temp_array_sz;
+    //Orders discarded for want of shelf space, and their value when discarded
+    int g_discarded_count;
+    double g_discarded_value;
 } DATA;
 
 //GLOBALs
 pthread_t kitchen_thread_id;
-pthread_t courier_thread_id;
 pthread_t monitor_thread_id;
 
-pthread_mutex_t data_access_mutex;
+//Locks, in the order they are taken; a thread holding one never waits on
+//one above it:
+//  1. shelf_mutex[HOT_SHELF] .. [COLD_SHELF] .. [FROZEN_SHELF] ..
+//     [OVERFLOW_SHELF] - a shelf's array, SoA columns and deadline heap (the
+//     overflow one also the overflow-by-temperature heaps). Most operations
+//     take one; a pickup or stale discard off a temperature shelf then also
+//     takes the overflow one (shelf_rebalance), and placement that has to
+//     move orders between the shelves takes all of them, in this order
+//     (shelf_lock_all).
+//  2. an order index stripe (order_index_lock); one at a time.
+//  3. leaf locks, taken with nothing else waited on under them: the
+//     monitor's timer, pools and arena, orders_empty_mutex, the printout's
+//     ring list and writer wake-up (event_log.c) and stdout.
+//The shelf contents printout locks one shelf at a time while it copies it
+//and hands the copy to the writer thread once it holds none.
+//With shelf.concurrency = lockfree the shelves take no locks at all; only
+//the index stripes and the leaf locks are left.
+pthread_mutex_t shelf_mutex[MAX_SHELF];
+pthread_mutex_t orders_empty_mutex;
 pthread_cond_t orders_empty_cond;
 
 DATA *g_data;
 
 //Common functions
-GHashTable *shelf_to_hash(SHELF shelf);
+void shelf_lock(SHELF shelf);
+void shelf_unlock(SHELF shelf);
+void shelf_release_order(SHELF shelf, ORDER *order);
+int shelf_rebalance(SHELF shelf);
+ORDER *shelf_take_order(const ORDER_KEY *key);
+bool shelf_store_order(ORDER *order);
+void shelf_store_orders();
+int64_t shelf_expiry(ORDER *order, SHELF shelf);
+double shelf_value_at(ORDER *order, SHELF shelf, int64_t at);
+int64_t shelf_now_msec();
+void shelf_set_clock(int64_t (*clock)());
+void shelf_report_discards();
 void *monitor_thread_cb();
-void current_time_msec(char *buf);
+bool monitor_init();
+void monitor_arm(int64_t deadline);
+void monitor_finalize();
+void print_event_shelf_contents(ORDER_EVENT evt);
+void print_order_delta(ORDER_DELTA delta, ORDER *order, SHELF shelf);
 
 #endif
\ No newline at end of file
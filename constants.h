@@ -10,13 +10,25 @@
 #define DEFAULT_KITCHEN_INGESTION_RATE                  2
 #define DEFAULT_KITCHEN_COURIER_DISPATCH_INTERVAL_MIN   2000
 #define DEFAULT_KITCHEN_COURIER_DISPATCH_INTERVAL_MAX   4000
+#define DEFAULT_KITCHEN_THREADS                         1
+
+#define DEFAULT_COURIER_THREADS                         1
 
 #define DEFAULT_SHELF_MONITOR_INTERVAL                  1500
 #define DEFAULT_SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF   1
 #define DEFAULT_SHELF_LIFE_MODIFIER_OVERFLOW_SHELF      2
+#define DEFAULT_SHELF_OVERFLOW_EVICTION                 OVERFLOW_EVICT_NEAREST_EXPIRY
+#define DEFAULT_SHELF_LAYOUT                            SHELF_LAYOUT_AOS
+#define DEFAULT_SHELF_CONCURRENCY                       SHELF_CONCURRENCY_LOCKED
+#define DEFAULT_SHELF_PLACEMENT                         PLACEMENT_GREEDY
 #define DEFAULT_DEBUG_LEVEL                             (L4)
 #define DEFAULT_SYSTEM_ORDERS_INPUT_FILE                "orders.json"
+#define DEFAULT_SYSTEM_ORDERS_READER                    ORDER_READER_MMAP
 #define DEFAULT_SYSTEM_PRINT_SHELF_CONTENTS             true
+#define DEFAULT_SYSTEM_PRINT_RING_SIZE                  1024
+#define DEFAULT_SYSTEM_PRINT_MODE                       PRINT_MODE_FULL
+#define DEFAULT_SYSTEM_PRINT_SNAPSHOT_INTERVAL          5000
+#define DEFAULT_SYSTEM_STATS_INTERVAL                   10000
 
 int HOT_SHELF_MAX_SIZE;
 int COLD_SHELF_MAX_SIZE;
@@ -27,13 +39,25 @@ int KITCHEN_INGESTION_INTERVAL;//msecs
 int KITCHEN_INGESTION_RATE;//no. of records to process in each ingestion tick
 int KITCHEN_COURIER_DISPATCH_INTERVAL_MIN; //msecs
 int KITCHEN_COURIER_DISPATCH_INTERVAL_MAX; //msecs
+int KITCHEN_THREADS; //order parser threads (partitions of the orders file)
+
+int COURIER_THREADS; //size of the courier thread pool
 
 int SHELF_MONITOR_INTERVAL;
 int SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF;
 int SHELF_LIFE_MODIFIER_OVERFLOW_SHELF;
+OVERFLOW_EVICTION SHELF_OVERFLOW_EVICTION; //drop_new | nearest_expiry
+SHELF_LAYOUT SHELF_LAYOUT_TYPE; //aos | soa
+SHELF_CONCURRENCY SHELF_CONCURRENCY_TYPE; //locked | lockfree
+PLACEMENT_POLICY_TYPE SHELF_PLACEMENT_POLICY; //greedy | lowest_value | lookahead
 
-int SYSTEM_DEBUG_LEVEL; //L1 | L2 | L3 | L4 | NONE
+int SYSTEM_DEBUG_LEVEL; //L1 | L2 | L3 | L4 | NONE of each TRACE_SUBSYSTEM (trace.h)
 char *SYSTEM_ORDERS_INPUT_FILE; //"orders.json"
+ORDER_READER_TYPE SYSTEM_ORDERS_READER; //stdio | mmap | packed
 bool SYSTEM_PRINT_SHELF_CONTENTS;
+int SYSTEM_PRINT_RING_SIZE; //KB of printout buffered per thread
+PRINT_MODE SYSTEM_PRINT_MODE; //full | delta
+int SYSTEM_PRINT_SNAPSHOT_INTERVAL; //msecs between shelf snapshots (delta)
+int SYSTEM_STATS_INTERVAL; //msecs between statistics reports; 0: end of run only
 
 #endif //CONSTANTS_H
\ No newline at end of file
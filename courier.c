@@ -1,21 +1,163 @@
 #include <stdio.h>
+#include <unistd.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <sys/timerfd.h>
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <stdint.h>
 #include <pthread.h>
 #include <string.h>
-#include <glib.h>
-#include <sys/timeb.h>
+#include <time.h>
 
 #include "common.h"
 #include "constants.h"
+#include "clock.h"
+#include "trace.h"
 #include "courier.h"
+#include "input.h"
+#include "pool.h"
+#include "order_index.h"
+
+//Courier timers live in a hierarchical timing wheel driven by one timerfd.
+//Level 0 has 256 one-tick slots, levels 1..3 have 64 slots each, so the
+//wheel spans 2^26 ticks (~7.7 days at 10 msec ticks).
+#define COURIER_WHEEL_TICK_MSEC 10
+#define WHEEL_LEVELS            4
+#define WHEEL_TVR_BITS          8
+#define WHEEL_TVN_BITS          6
+#define WHEEL_TVR_SIZE          (1 << WHEEL_TVR_BITS)
+#define WHEEL_TVN_SIZE          (1 << WHEEL_TVN_BITS)
+#define WHEEL_TVR_MASK          (WHEEL_TVR_SIZE - 1)
+#define WHEEL_TVN_MASK          (WHEEL_TVN_SIZE - 1)
+#define WHEEL_MAX_TICKS         (1ULL << (WHEEL_TVR_BITS + (WHEEL_LEVELS - 1) * WHEEL_TVN_BITS))
+#define WHEEL_INDEX(tick, n)    ((int)(((tick) >> (WHEEL_TVR_BITS + (n) * WHEEL_TVN_BITS)) & WHEEL_TVN_MASK))
+
+//Max events taken from epoll in one go
+#define COURIER_MAX_EVENTS      16
+//Max ready pickups delivered under one lock acquisition
+#define COURIER_MAX_BATCH       256
+//Slots of each shard's kitchen->courier handoff queue (power of 2)
+#define COURIER_SUBMIT_QUEUE_SIZE 4096
+#define COURIER_CACHE_LINE      64
+
+//An fd registered with a courier's epoll reactor along with its handler
+typedef struct courier_source_t {
+    int fd;
+    void (*on_readable)(struct courier_source_t *src);
+    struct courier_shard_t *shard;
+} COURIER_SOURCE;
+
+typedef struct timer_wheel_t {
+    COURIER_SOURCE source;   //the one timerfd ticking every COURIER_WHEEL_TICK_MSEC
+    uint64_t current_tick;   //next tick to be processed
+    size_t count;            //pending timers
+    COURIER_TIMER_NODE *tv1[WHEEL_TVR_SIZE];
+    COURIER_TIMER_NODE *tvn[WHEEL_LEVELS - 1][WHEEL_TVN_SIZE];
+} TIMER_WHEEL;
+
+//Bounded lock-free MPSC queue (Vyukov style) through which kitchen threads
+//hand new timers to a courier. Every cell carries a sequence number telling
+//producers/consumer whether it is free or filled for the current lap.
+typedef struct submit_cell_t {
+    size_t seq;
+    COURIER_TIMER_NODE *node;
+} SUBMIT_CELL;
+
+typedef struct submit_queue_t {
+    SUBMIT_CELL *cells;
+    size_t mask;
+    char pad0[COURIER_CACHE_LINE];
+    size_t enqueue_pos;     //claimed by producers with CAS
+    char pad1[COURIER_CACHE_LINE];
+    size_t dequeue_pos;     //owned by the courier thread
+} SUBMIT_QUEUE;
+
+//One courier thread and the slice of pending pickups it owns.
+//Expired pickups are moved from the wheel to the "ready" queue; the owner
+//delivers from it and idle siblings steal from it.
+typedef struct courier_shard_t {
+    int index;
+    pthread_t thread_id;
+    int epoll_fd;
+    TIMER_WHEEL wheel;              //touched by the owning thread only
+    bool ticking;                   //wheel timerfd armed; only while timers are pending
+    SUBMIT_QUEUE submit;            //new timers from the kitchen
+    COURIER_TIMER_NODE *spill;      //new timers that found the submit queue full; pushed with
+                                    //CAS, taken all at once by the owning thread
+    COURIER_SOURCE wake;            //eventfd; poked on submit and by siblings with surplus pickups
+    pthread_mutex_t ready_mutex;
+    COURIER_TIMER_NODE *ready_head;
+    COURIER_TIMER_NODE *ready_tail;
+    size_t ready_count;
+} COURIER_SHARD;
+
+static COURIER_SHARD *g_shards = NULL;
+static int g_shard_count = 0;
+static unsigned int g_next_shard = 0; //round robin for new timers
+static bool g_threads_started = false;
 
-//TODO: hardcoded timer limit; revisit
-#define MAX_TIMER_COUNT 1000
-static COURIER_TIMER_NODE *g_head = NULL;
+//Not a 'public' function; only internal to this file.
+//Pulls one order out of the system on pickup; caller holds no locks and
+//emits the ORDER_DELIVERED event. Returns true if the order was still
+//on a shelf (i.e. it was not discarded by the monitor meanwhile).
+static bool courier_deliver_order(char *order_id)
+{
+    bool delivered = false;
+    ORDER_KEY key;
+    ORDER *order;
+    
+    //one probe of the order index finds both the order and its shelf
+    order_key_from_id(order_id, strlen(order_id), &key);
+    order = shelf_take_order(&key);
+    if(order) {
+        TRACE(COURIER, L3, "order_name %.*s \n", (int)order->name_len, order->name);
+        TRACE(COURIER, L1, "order_id %p order %p...\n", order_id, order);
+        TRACE(COURIER, L4, "order_id %s successfully delivered\n", order_id);
+        order_release(order);
+        delivered = true;
+    } else {
+        TRACE(COURIER, L4, "order_id %s shelf not found (possibly removed by monitor as stale)\n", order_id);
+    }
+    arena_free(order_id);
+    
+    return delivered;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      courier_deliver_batch                                          */
+/*                                                                           */
+/* Purpose:   Models couriers picking up a batch of orders whose pickup      */
+/*            time has come together                                         */
+/*                                                                           */
+/* Returns:   Nothing.                                                       */
+/*                                                                           */
+/* Params:    IN     order_ids  - IDs of the orders to be delivered          */
+/*            IN     count      - Number of IDs                              */
+/*                                                                           */
+/* Operation: Every order is taken off its shelf (locking just that shelf),  */
+/*            one ORDER_DELIVERED event is emitted for the batch and, if all */
+/*            orders have been delivered, a signal is sent to Kitchen thread */
+/*            who is waiting to quit                                         */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void courier_deliver_batch(void **order_ids, int count)
+{
+    int i, delivered = 0;
+    
+    TRACE(COURIER, L3, "delivering batch of %d\n", count);
+    
+    for(i = 0; i < count; i++) {
+        if(courier_deliver_order((char*)order_ids[i])) delivered++;
+    }
+    if(delivered > 0) print_event_shelf_contents(ORDER_DELIVERED);
+    
+    if(__sync_fetch_and_add(&g_data->g_order_index.count, 0) == 0) { 
+        pthread_mutex_lock(&orders_empty_mutex);
+        pthread_cond_signal(&orders_empty_cond);                
+        pthread_mutex_unlock(&orders_empty_mutex);
+    }
+}
 
 /**PROC+**********************************************************************/
 /* Name:      courier_timer_handler                                          */
@@ -29,99 +171,198 @@ static COURIER_TIMER_NODE *g_head = NULL;
 /*                                instance of the courier                    */
 /*            IN     user_data  - ID for the order to be delivered.          */
 /*                                                                           */
-/* Operation: Looks up the high level hash first that gives the shelf.       */
-/*            Then it goes pulls the order out of the specific shelf         */
-/*            Finally it does house cleaning (removing the oeder from system)*/
+/* Operation: A batch of one; see courier_deliver_batch(). The courier       */
+/*            threads recognize this handler and batch expired pickups.      */
 /*                                                                           */
 /**PROC-**********************************************************************/
 void courier_timer_handler(size_t timer_id, void *user_data)
 {
-    char time_str_buf[64];
-    current_time_msec(time_str_buf);
-    
-    char *order_id = (char*)user_data;
-    if(SYSTEM_DEBUG_LEVEL & L3) printf("%s: courier : L3: timer (%d); order_id %s \n",  
-                time_str_buf, timer_id, order_id);
     
-    pthread_mutex_lock(&data_access_mutex);
+    TRACE(COURIER, L3, "timer (%zu); order_id %s \n", timer_id, (char*)user_data);
     
-    int *ptr_shelf = g_hash_table_lookup(g_data->g_order_id_shelf_hash, order_id);
-    if(ptr_shelf) {
-        SHELF shelf = (SHELF)(*ptr_shelf);
-        GHashTable *shelf_hash = shelf_to_hash(shelf);
-        ORDER *order = g_hash_table_lookup(shelf_hash, order_id);
-        
-        if(order) {
-            if(SYSTEM_DEBUG_LEVEL & L3) printf("%s: courier : L3: timer (%d); order_name %s \n", 
-                            time_str_buf, timer_id, order->name);
-            
-            g_hash_table_remove(shelf_hash, order_id);
-            g_hash_table_remove(g_data->g_order_id_shelf_hash, order_id);
-            
-            if(shelf==OVERFLOW_SHELF) {
-                if(SYSTEM_DEBUG_LEVEL & L3) printf("%s: courier : L3: removing from overflow shelf order id %s \n",  
-                            time_str_buf, order->id);
-                ORDER** overflow_by_temp = g_data->g_overflow_by_temp_array[order->temp];
-                int i = OVERFLOW_SHELF_MAX_SIZE-1, order_idx = -1;
-                ORDER *swap = NULL;
-                for(; i >=0 ; i--) {
-                    if(overflow_by_temp[i] == order) {
-                        if(swap) {
-                            order_idx = i;
-                        }
-                        break;
-                    } else {                        
-                        if(order_idx == -1 && !swap && overflow_by_temp[i]) {
-                            //printf("$$$$ %p..\n", overflow_by_temp[i]);
-                            swap = (ORDER*)(overflow_by_temp[i]);                           
-                        }                           
-                    }
-                }
-                if(SYSTEM_DEBUG_LEVEL & L3) printf("%s: courier : L3: swap id is %s order_idx %d\n",  
-                            time_str_buf, (swap==NULL) ? "NONE" : swap->id, order_idx);
-                
-                if(swap && order_idx > -1) {
-                    overflow_by_temp[order_idx] = swap; 
-                    //printf("$$$$ order_idx %d swap->id %s swap->name %s..\n", 
-                    //           order_idx, swap->id, swap->name);
-                }                   
-                //Either the removed order is the last one(so set to NULL); or it has 
-                //been swapped with last one - see above if case(so swap to NULL
-                overflow_by_temp[g_data->g_overflow_by_temp_array_sz[order->temp]-1] = NULL;                
-                g_data->g_overflow_by_temp_array_sz[order->temp]--;
-                if(SYSTEM_DEBUG_LEVEL & L3) printf("%s: courier : L3: order->id is %s overflow by temp array sz %d\n",  
-                            time_str_buf, order->id, 
-                            g_data->g_overflow_by_temp_array_sz[order->temp]);
-            }
-            
-            if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: courier : L1: order_id %p order %p shelf %s...\n", 
-                        time_str_buf, order_id, order, ordershelf_to_str(shelf));
-            if(SYSTEM_DEBUG_LEVEL & L4) printf("%s: courier : L4: order_id %s successfully delivered\n", 
-                        time_str_buf, order_id);
-            print_event_shelf_contents(ORDER_DELIVERED);
-            free(order_id);
-            
-            //TODO- do all order free related tasks in one place  
-            if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: courier : L1: FREE order->id %p order->name %p order %p\n", 
-                        time_str_buf, order->id, order->name, order);
-            free(ptr_shelf);
-            free(order->id);
-            free(order->name);
-            free(order);            
+    courier_deliver_batch(&user_data, 1);
+}
+
+/**PROC+**********************************************************************/
+/* Name:      courier_wheel_add                                              */
+/*                                                                           */
+/* Purpose:   Files a timer node into the slot of the wheel level that       */
+/*            covers its expiry tick                                         */
+/*                                                                           */
+/* Returns:   Nothing.                                                       */
+/*                                                                           */
+/* Params:    IN     wheel      - Wheel of the owning shard                  */
+/*            IN     node       - Timer node with "expires" already set      */
+/*                                                                           */
+/* Operation: Level 0 holds the next 256 ticks one slot per tick; each       */
+/*            higher level covers 64x the range of the one below it. Nodes   */
+/*            on higher levels are cascaded down as the wheel turns.         */
+/*            Only the shard's own thread touches its wheel.                 */
+/*                                                                           */
+/**PROC-**********************************************************************/
+static void courier_wheel_add(TIMER_WHEEL *wheel, COURIER_TIMER_NODE *node)
+{
+    uint64_t expires = node->expires;
+    uint64_t idx = expires - wheel->current_tick;
+    COURIER_TIMER_NODE **slot;
+
+    if((int64_t)idx < 0) {
+        //Already due (e.g. zero interval); fire on the very next tick
+        expires = wheel->current_tick;
+        slot = &wheel->tv1[expires & WHEEL_TVR_MASK];
+    } else if(idx < WHEEL_TVR_SIZE) {
+        slot = &wheel->tv1[expires & WHEEL_TVR_MASK];
+    } else if(idx < (1ULL << (WHEEL_TVR_BITS + WHEEL_TVN_BITS))) {
+        slot = &wheel->tvn[0][WHEEL_INDEX(expires, 0)];
+    } else if(idx < (1ULL << (WHEEL_TVR_BITS + 2 * WHEEL_TVN_BITS))) {
+        slot = &wheel->tvn[1][WHEEL_INDEX(expires, 1)];
+    } else {
+        //Anything beyond the wheel span is clamped to the farthest slot
+        if(idx >= WHEEL_MAX_TICKS) {
+            expires = wheel->current_tick + WHEEL_MAX_TICKS - 1;
+            node->expires = expires;
+        }
+        slot = &wheel->tvn[2][WHEEL_INDEX(expires, 2)];
+    }
+
+    node->next = *slot;
+    if(node->next) node->next->pprev = &node->next;
+    node->pprev = slot;
+    *slot = node;
+}
+
+//Not a 'public' function; only internal to this file.
+//O(1) unlink of a node from whatever wheel slot it sits in
+static void courier_wheel_del(COURIER_TIMER_NODE *node)
+{
+    if(node->pprev == NULL) return;
+
+    *node->pprev = node->next;
+    if(node->next) node->next->pprev = node->pprev;
+    node->next = NULL;
+    node->pprev = NULL;
+}
+
+//Not a 'public' function; only internal to this file.
+//Re-files every node of a higher level slot; returns the slot index so the
+//caller knows whether the next level up has to cascade as well
+static int courier_wheel_cascade(TIMER_WHEEL *wheel, int level, int index)
+{
+    COURIER_TIMER_NODE *node = wheel->tvn[level][index], *next;
+
+    wheel->tvn[level][index] = NULL;
+    while(node) {
+        next = node->next;
+        node->pprev = NULL;
+        courier_wheel_add(wheel, node);
+        node = next;
+    }
+    return index;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      courier_wheel_advance                                          */
+/*                                                                           */
+/* Purpose:   Turns the wheel by the number of ticks reported by the timerfd */
+/*                                                                           */
+/* Returns:   List of expired timer nodes (linked via "next"); the nodes are */
+/*            no longer in the wheel.                                        */
+/*                                                                           */
+/* Params:    IN     wheel      - Wheel of the owning shard                  */
+/*            IN     ticks      - Number of elapsed ticks                    */
+/*            OUT    tail       - Last node of the returned list             */
+/*                                                                           */
+/* Operation: For each tick, cascades higher levels when level 0 wraps and   */
+/*            then detaches the level 0 slot of that tick.                   */
+/*            Only the shard's own thread touches its wheel.                 */
+/*                                                                           */
+/**PROC-**********************************************************************/
+static COURIER_TIMER_NODE *courier_wheel_advance(TIMER_WHEEL *wheel, uint64_t ticks,
+                                                    COURIER_TIMER_NODE **tail)
+{
+    COURIER_TIMER_NODE *expired = NULL, *node, *next;
+    int index;
+
+    *tail = NULL;
+    while(ticks--) {
+        index = wheel->current_tick & WHEEL_TVR_MASK;
+        if(index == 0 &&
+            courier_wheel_cascade(wheel, 0, WHEEL_INDEX(wheel->current_tick, 0)) == 0 &&
+            courier_wheel_cascade(wheel, 1, WHEEL_INDEX(wheel->current_tick, 1)) == 0) {
+            courier_wheel_cascade(wheel, 2, WHEEL_INDEX(wheel->current_tick, 2));
+        }
+        wheel->current_tick++;
+
+        node = wheel->tv1[index];
+        wheel->tv1[index] = NULL;
+        while(node) {
+            next = node->next;
+            node->pprev = NULL;
+            node->next = expired;
+            if(expired == NULL) *tail = node;
+            expired = node;
+            wheel->count--;
+            node = next;
+        }
+    }
+    return expired;
+}
+
+//Not a 'public' function; only internal to this file.
+//Multi-producer enqueue; false if the queue is full
+static bool courier_submit_enqueue(SUBMIT_QUEUE *q, COURIER_TIMER_NODE *node)
+{
+    SUBMIT_CELL *cell;
+    size_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED), seq;
+    intptr_t dif;
+
+    while(1) {
+        cell = &q->cells[pos & q->mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        dif = (intptr_t)seq - (intptr_t)pos;
+        if(dif == 0) {
+            //cell free for this lap; try to claim it
+            if(__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if(dif < 0) {
+            return false; //consumer has not freed this cell yet: full
         } else {
-            if(SYSTEM_DEBUG_LEVEL & L3) printf("%s: courier : L3: order_id %s shelf %s is not in any hash\n",  
-                        time_str_buf, order_id, ordershelf_to_str(shelf));
-            free(order_id);
-            free(ptr_shelf);
+            pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
         }
-    } else {
-        if(SYSTEM_DEBUG_LEVEL & L4) 
-             printf("%s: courier : L4: order_id %s shelf not found (possibly removed by monitor as stale)\n",  
-                    time_str_buf, order_id);
-        free(order_id);
     }
-    
-    pthread_mutex_unlock(&data_access_mutex);
+    cell->node = node;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+//Not a 'public' function; only internal to this file.
+//Single-consumer dequeue (courier thread); NULL if the queue is empty
+static COURIER_TIMER_NODE *courier_submit_dequeue(SUBMIT_QUEUE *q)
+{
+    SUBMIT_CELL *cell = &q->cells[q->dequeue_pos & q->mask];
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    COURIER_TIMER_NODE *node;
+
+    if(seq != q->dequeue_pos + 1) return NULL;
+
+    node = cell->node;
+    //free the cell for the producers' next lap
+    __atomic_store_n(&cell->seq, q->dequeue_pos + q->mask + 1, __ATOMIC_RELEASE);
+    q->dequeue_pos++;
+    return node;
+}
+
+//Not a 'public' function; only internal to this file.
+//Multi-producer push onto a shard's spill list (submit queue full); the
+//node's "next" is free until the courier files it into its wheel
+static void courier_spill_push(COURIER_SHARD *shard, COURIER_TIMER_NODE *node)
+{
+    node->next = __atomic_load_n(&shard->spill, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&shard->spill, &node->next, node, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        ;
+    }
 }
 
 /**PROC+**********************************************************************/
@@ -129,85 +370,387 @@ void courier_timer_handler(size_t timer_id, void *user_data)
 /*                                                                           */
 /* Purpose:   Creates a timer node to track one order's delivery             */
 /*                                                                           */
-/* Returns:   Nothing.                                                       */
+/* Returns:   Timer id (the node address); 0 if no node can be allocated.   */
 /*                                                                           */
 /* Params:    IN     interval   - Random interval to schedule delivery       */
 /*            IN     handler    - Represents the callback function for the   */
 /*                                timer                                      */
 /*            IN     user_data  - ID for the order to be delivered.          */
 /*                                                                           */
-/* Operation: Inserts a timer node for the courier delivery                  */
+/* Operation: Picks a courier shard round robin and hands the timer node to */
+/*            it through the shard's lock-free submit queue, then pokes the  */
+/*            shard's eventfd. The courier files it into its timing wheel.   */
+/*            A full queue (the courier is behind) is not a failure: the     */
+/*            node goes on the shard's spill list, which the courier drains  */
+/*            along with the queue, so pending pickups are only bounded by   */
+/*            the timer node pool. Safe to call from any number of threads.  */
 /*                                                                           */
 /**PROC-**********************************************************************/
 size_t courier_start_timer(unsigned int interval, time_handler handler, 
                             void * user_data)
 {
     COURIER_TIMER_NODE * new_node = NULL;
-    struct itimerspec new_value;
+    COURIER_SHARD *shard;
+    uint64_t one = 1;
 
-    new_node = (COURIER_TIMER_NODE *)malloc(sizeof(COURIER_TIMER_NODE));
-    //printf("%s: kitchen : L1: new_node ptr %p\n", "courier_start_timer", new_node);
+    if(g_shard_count == 0)
+        return 0;
 
+    new_node = pool_alloc(&g_timer_node_pool);
     if(new_node == NULL) 
         return 0;
 
     new_node->callback  = handler;
     new_node->user_data = user_data;
     new_node->interval  = interval;
+    new_node->next      = NULL;
+    new_node->pprev     = NULL;
+    new_node->submitted = (uint64_t)clock_now_msec();
 
-    new_node->fd = timerfd_create(CLOCK_REALTIME, 0);
+    shard = &g_shards[__sync_fetch_and_add(&g_next_shard, 1) % g_shard_count];
+    if(!courier_submit_enqueue(&shard->submit, new_node)) courier_spill_push(shard, new_node);
+    write(shard->wake.fd, &one, sizeof(one));
 
-    if (new_node->fd == -1) {
-        free(new_node);
-        return 0;
+    return (size_t)new_node;
+}
+
+//Not a 'public' function; only internal to this file.
+//Frees every timer still held by a shard (submit queue, wheel and ready
+//queue); only called once the shard's thread is gone
+static void courier_shard_drop_timers(COURIER_SHARD *shard)
+{
+    COURIER_TIMER_NODE *node;
+    int level, i;
+
+    while((node = courier_submit_dequeue(&shard->submit))) {
+        pool_free(&g_timer_node_pool, node);
+    }
+    while((node = shard->spill)) {
+        shard->spill = node->next;
+        pool_free(&g_timer_node_pool, node);
     }
-   
-    new_value.it_value.tv_sec = interval / 1000;
-    new_value.it_value.tv_nsec = (interval % 1000)* 1000000;
-    new_value.it_interval.tv_sec= 0;  //always our courier timers are one-shot; not periodic
-    new_value.it_interval.tv_nsec = 0; //always our courier timers are one-shot; not periodic
 
-    timerfd_settime(new_node->fd, 0, &new_value, NULL);
+    for(i = 0; i < WHEEL_TVR_SIZE; i++) {
+        while((node = shard->wheel.tv1[i])) {
+            courier_wheel_del(node);
+            pool_free(&g_timer_node_pool, node);
+        }
+    }
+    for(level = 0; level < WHEEL_LEVELS - 1; level++) {
+        for(i = 0; i < WHEEL_TVN_SIZE; i++) {
+            while((node = shard->wheel.tvn[level][i])) {
+                courier_wheel_del(node);
+                pool_free(&g_timer_node_pool, node);
+            }
+        }
+    }
+    shard->wheel.count = 0;
 
-    /*Inserting the timer node into the list*/
-    new_node->next = g_head;
-    g_head = new_node;
+    while((node = shard->ready_head)) {
+        shard->ready_head = node->next;
+        pool_free(&g_timer_node_pool, node);
+    }
+    shard->ready_tail = NULL;
+    shard->ready_count = 0;
+}
 
-    return (size_t)new_node;
+//Not a 'public' function; only internal to this file.
+//Starts/stops the periodic timerfd that drives a shard's wheel; it only
+//ticks while the wheel holds timers so an idle courier never wakes up
+static void courier_set_ticking(COURIER_SHARD *shard, bool on) {
+    struct itimerspec new_value;
+    int tick_interval = on ? COURIER_WHEEL_TICK_MSEC : 0;
+    
+    if(shard->ticking == on) return;
+
+    new_value.it_value.tv_sec = tick_interval / 1000;
+    new_value.it_value.tv_nsec = (tick_interval % 1000)* 1000000;
+    new_value.it_interval.tv_sec = tick_interval / 1000;
+    new_value.it_interval.tv_nsec = (tick_interval %1000) * 1000000;
+    timerfd_settime(shard->wheel.source.fd, 0, &new_value, NULL);
+    shard->ticking = on;
 }
 
 //Not a 'public' function; only internal to this file.
-static void courier_stop_timer(size_t timer_id)
+//Files one submitted timer into the shard's wheel
+static void courier_file_submission(COURIER_SHARD *shard, COURIER_TIMER_NODE *node, uint64_t now)
 {
-    COURIER_TIMER_NODE * tmp = NULL;
-    COURIER_TIMER_NODE * node = (COURIER_TIMER_NODE *)timer_id;
+    uint64_t waited;
+    unsigned int remaining;
+
+    //time spent in the queue counts against the interval; round up
+    //so that a pickup never happens before its interval. A node
+    //submitted after "now" was read has not waited at all.
+    waited = (now > node->submitted) ? now - node->submitted : 0;
+    remaining = (waited < node->interval) ? node->interval - waited : 0;
+    node->next = NULL;
+    node->expires = shard->wheel.current_tick + 
+                    (remaining + COURIER_WHEEL_TICK_MSEC - 1) / COURIER_WHEEL_TICK_MSEC;
+    courier_wheel_add(&shard->wheel, node);
+    shard->wheel.count++;
+}
 
-    if (node == NULL) return;
+//Not a 'public' function; only internal to this file.
+//Files every timer handed over by the kitchen (submit queue, then the
+//spill list) into the shard's wheel. The spill list is a stack, newest
+//first; it is reversed so spilled timers are filed in arrival order too.
+static void courier_drain_submissions(COURIER_SHARD *shard)
+{
+    COURIER_TIMER_NODE *node, *next, *spill = NULL;
+    uint64_t now = (uint64_t)clock_now_msec();
 
-    close(node->fd);
+    while((node = courier_submit_dequeue(&shard->submit))) {
+        courier_file_submission(shard, node, now);
+    }
+    node = __atomic_exchange_n(&shard->spill, NULL, __ATOMIC_ACQUIRE);
+    for(; node; node = next) {
+        next = node->next;
+        node->next = spill;
+        spill = node;
+    }
+    while((node = spill)) {
+        spill = node->next;
+        courier_file_submission(shard, node, now);
+    }
+    if(shard->wheel.count > 0) courier_set_ticking(shard, true);
+}
+
+//Not a 'public' function; only internal to this file.
+//Registers an event source once; epoll hands the source back via data.ptr
+//so no fd-to-object lookup is ever needed
+static bool courier_reactor_add(int epoll_fd, COURIER_SOURCE *src)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = src;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, src->fd, &ev) == 0;
+}
+
+//Not a 'public' function; only internal to this file.
+//Detaches up to "max" of the oldest ready pickups of a shard in one go;
+//returns how many were taken (0 if there is none)
+static int courier_ready_pop_batch(COURIER_SHARD *shard, COURIER_TIMER_NODE **batch, int max)
+{
+    COURIER_TIMER_NODE *node;
+    int count = 0, share;
+
+    pthread_mutex_lock(&shard->ready_mutex);
+    //leave a fair share for siblings that may be stealing
+    share = (shard->ready_count + g_shard_count - 1) / g_shard_count;
+    if(share < max) max = share;
+    while(count < max && (node = shard->ready_head)) {
+        shard->ready_head = node->next;
+        shard->ready_count--;
+        node->next = NULL;
+        batch[count++] = node;
+    }
+    if(shard->ready_head == NULL) shard->ready_tail = NULL;
+    pthread_mutex_unlock(&shard->ready_mutex);
+
+    return count;
+}
+
+//Not a 'public' function; only internal to this file.
+//Idle shard takes a batch of ready pickups from the first busy sibling it finds
+static int courier_steal_batch(COURIER_SHARD *thief, COURIER_TIMER_NODE **batch, int max)
+{
+    COURIER_SHARD *victim;
+    int i, count = 0;
+
+    for(i = 1; i < g_shard_count && count == 0; i++) {
+        victim = &g_shards[(thief->index + i) % g_shard_count];
+        //racy peek is fine; courier_ready_pop_batch re-checks under the lock
+        if(victim->ready_count > 0) count = courier_ready_pop_batch(victim, batch, max);
+    }
+    return count;
+}
+
+//Not a 'public' function; only internal to this file.
+//Lets up to "count" siblings know there is surplus work to steal
+static void courier_wake_siblings(COURIER_SHARD *shard, size_t count)
+{
+    uint64_t one = 1;
+    int i;
+
+    for(i = 1; i < g_shard_count && count > 0; i++, count--) {
+        write(g_shards[(shard->index + i) % g_shard_count].wake.fd, &one, sizeof(one));
+    }
+}
 
-    if(node == g_head)
+/**PROC+**********************************************************************/
+/* Name:      courier_deliver_ready                                          */
+/*                                                                           */
+/* Purpose:   Runs the courier callback for every ready pickup this thread   */
+/*            can get hold of                                                */
+/*                                                                           */
+/* Returns:   Nothing.                                                       */
+/*                                                                           */
+/* Params:    IN     shard      - Shard owned by the calling thread          */
+/*                                                                           */
+/* Operation: Drains the own ready queue first and then steals from busy     */
+/*            siblings until no ready pickup is left anywhere. Pickups are   */
+/*            taken in batches and delivered by courier_deliver_batch()      */
+/*                                                                           */
+/**PROC-**********************************************************************/
+static void courier_deliver_ready(COURIER_SHARD *shard)
+{
+    COURIER_TIMER_NODE *batch[COURIER_MAX_BATCH];
+    void *order_ids[COURIER_MAX_BATCH];
+    int count, order_count, i;
+
+    while((count = courier_ready_pop_batch(shard, batch, COURIER_MAX_BATCH)) ||
+            (count = courier_steal_batch(shard, batch, COURIER_MAX_BATCH)))
     {
-        g_head = g_head->next;
-    } else {
+        //courier pickups are delivered together; any other timer on its own
+        order_count = 0;
+        for(i = 0; i < count; i++) {
+            if(batch[i]->callback == courier_timer_handler) {
+                order_ids[order_count++] = batch[i]->user_data;
+            } else if(batch[i]->callback) {
+                batch[i]->callback((size_t)batch[i], batch[i]->user_data);
+            }
+        }
+        if(order_count > 0) courier_deliver_batch(order_ids, order_count);
 
-        tmp = g_head;
+        //Since the job of courier is done, release the timer nodes
+        //(already out of the wheel)
+        for(i = 0; i < count; i++) {
+            pool_free(&g_timer_node_pool, batch[i]);
+        }
+    }
+}
 
-        while(tmp && tmp->next != node) tmp = tmp->next;
+//Not a 'public' function; only internal to this file.
+//Event handler of a shard's wheel timerfd: read() tells how many ticks
+//have elapsed; the wheel is turned by that many ticks and the expired
+//pickups are queued as ready for delivery
+static void courier_wheel_on_tick(COURIER_SOURCE *src)
+{
+    COURIER_SHARD *shard = src->shard;
+    COURIER_TIMER_NODE *expired, *tail;
+    size_t ready_count;
+    int s;
+    uint64_t exp;
 
-        if(tmp)
-        {
-            /*tmp->next can not be NULL here.*/
-            tmp->next = tmp->next->next;
+    s = read(src->fd, &exp, sizeof(uint64_t));
+    if (s != sizeof(uint64_t)) return;
+
+    expired = courier_wheel_advance(&shard->wheel, exp, &tail);
+    if(shard->wheel.count == 0) courier_set_ticking(shard, false);
+
+    if(expired == NULL) return;
+
+    pthread_mutex_lock(&shard->ready_mutex);
+    if(shard->ready_tail) shard->ready_tail->next = expired;
+    else shard->ready_head = expired;
+    shard->ready_tail = tail;
+    while(expired) {
+        shard->ready_count++;
+        expired = expired->next;
+    }
+    ready_count = shard->ready_count;
+    pthread_mutex_unlock(&shard->ready_mutex);
+
+    //more than this thread can deliver at once; get help
+    if(ready_count > 1) courier_wake_siblings(shard, ready_count - 1);
+
+    courier_deliver_ready(shard);
+}
+
+//Not a 'public' function; only internal to this file.
+//Event handler of a shard's eventfd: the kitchen submitted new timers
+//and/or a sibling has surplus ready pickups
+static void courier_wake_on_poke(COURIER_SOURCE *src)
+{
+    uint64_t count;
+
+    if(read(src->fd, &count, sizeof(count)) != sizeof(count)) return;
+
+    courier_drain_submissions(src->shard);
+    courier_deliver_ready(src->shard);
+}
+
+/**PROC+**********************************************************************/
+/* Name:      courier_init                                                   */
+/*                                                                           */
+/* Purpose:   Sets up COURIER_THREADS shards (wheel, timerfd, eventfd and    */
+/*            epoll instance each)                                           */
+/*                                                                           */
+/* Returns:   bool - for success/failure.                                    */
+/*                                                                           */
+/* Operation: Must be called before any timer is started; the threads are    */
+/*            spawned separately by courier_start_threads(). On a failure    */
+/*            whatever was set up is released again (courier_finalize).      */
+/*                                                                           */
+/**PROC-**********************************************************************/
+bool courier_init()
+{
+    COURIER_SHARD *shard;
+    int i;
+    size_t j;
+
+    g_shard_count = (COURIER_THREADS > 0) ? COURIER_THREADS : 1;
+    g_shards = calloc(g_shard_count, sizeof(COURIER_SHARD));
+    if(g_shards == NULL) {
+        g_shard_count = 0;
+        return false;
+    }
+
+    //every shard can be released by courier_finalize before any is set up
+    for(i = 0; i < g_shard_count; i++) {
+        shard = &g_shards[i];
+        shard->index = i;
+        shard->epoll_fd = shard->wheel.source.fd = shard->wake.fd = -1;
+        pthread_mutex_init(&shard->ready_mutex, NULL);
+    }
+
+    for(i = 0; i < g_shard_count; i++) {
+        shard = &g_shards[i];
+        shard->submit.cells = malloc(COURIER_SUBMIT_QUEUE_SIZE * sizeof(SUBMIT_CELL));
+        if(shard->submit.cells == NULL) break;
+        shard->submit.mask = COURIER_SUBMIT_QUEUE_SIZE - 1;
+        for(j = 0; j < COURIER_SUBMIT_QUEUE_SIZE; j++) {
+            shard->submit.cells[j].seq = j;
         }
+
+        shard->epoll_fd = epoll_create1(0);
+        shard->wheel.source.fd = timerfd_create(CLOCK_MONOTONIC, 0); //armed on demand
+        shard->wheel.source.on_readable = courier_wheel_on_tick;
+        shard->wheel.source.shard = shard;
+        shard->wake.fd = eventfd(0, 0);
+        shard->wake.on_readable = courier_wake_on_poke;
+        shard->wake.shard = shard;
+
+        if(shard->epoll_fd == -1 || shard->wheel.source.fd == -1 || shard->wake.fd == -1 ||
+            !courier_reactor_add(shard->epoll_fd, &shard->wheel.source) ||
+            !courier_reactor_add(shard->epoll_fd, &shard->wake)) {
+            break;
+        }
+    }
+    if(i < g_shard_count) {
+        courier_finalize();
+        return false;
+    }
+    return true;
+}
+
+//Spawns one courier thread per shard
+void courier_start_threads()
+{
+    int i;
+
+    for(i = 0; i < g_shard_count; i++) {
+        pthread_create(&g_shards[i].thread_id, NULL, courier_timer_thread_cb, &g_shards[i]);
     }
-    if(node) free(node);
+    g_threads_started = true;
 }
 
 /**PROC+**********************************************************************/
 /* Name:      courier_finalize                                               */
 /*                                                                           */
-/* Purpose:   This is used to cancel the courier thread when orders have     */
+/* Purpose:   This is used to cancel the courier threads when orders have    */
 /*            read and delivered                                             */
 /*                                                                           */
 /* Returns:   Nothing.                                                       */
@@ -218,103 +761,75 @@ static void courier_stop_timer(size_t timer_id)
 /**PROC-**********************************************************************/
 void courier_finalize()
 {
-    while(g_head) courier_stop_timer((size_t)g_head);
-
-    pthread_cancel(courier_thread_id);
-    pthread_join(courier_thread_id, NULL);
-}
+    COURIER_SHARD *shard;
+    int i;
 
-//Not a 'public' function; only internal to this file.
-static COURIER_TIMER_NODE *courier_get_timer_from_fd(int fd)
-{
-    COURIER_TIMER_NODE * tmp = g_head;
-    
-    while(tmp)
-    {
-        if(tmp->fd == fd) return tmp;
+    if(g_threads_started) {
+        for(i = 0; i < g_shard_count; i++) {
+            pthread_cancel(g_shards[i].thread_id);
+        }
+        for(i = 0; i < g_shard_count; i++) {
+            pthread_join(g_shards[i].thread_id, NULL);
+        }
+        g_threads_started = false;
+    }
 
-        tmp = tmp->next;
+    //timers still pending (e.g. orders already discarded as stale)
+    for(i = 0; i < g_shard_count; i++) {
+        shard = &g_shards[i];
+        if(shard->submit.cells) courier_shard_drop_timers(shard);
+        if(shard->wheel.source.fd != -1) close(shard->wheel.source.fd);
+        if(shard->wake.fd != -1) close(shard->wake.fd);
+        if(shard->epoll_fd != -1) close(shard->epoll_fd);
+        pthread_mutex_destroy(&shard->ready_mutex);
+        free(shard->submit.cells);
     }
-    return NULL;
+    free(g_shards);
+    g_shards = NULL;
+    g_shard_count = 0;
 }
 
 /**PROC+**********************************************************************/
 /* Name:      courier_timer_thread_cb                                        */
 /*                                                                           */
-/* Purpose:   This is callback function for the courier thread               */
+/* Purpose:   This is callback function for each courier thread              */
 /*                                                                           */
 /* Returns:   Nothing, void* is for future purposes.                         */
 /*                                                                           */
+/* Params:    IN     data       - The COURIER_SHARD owned by this thread     */
 /*                                                                           */
-/* Operation: It continuously checks if any timer file descriptor (fd) is    */
-/* set using poll() system call. If any timer file descriptor is set and     */
-/* readable using read() system call, then it calls the callback function of */
-/* the timer with timer id and user_data.                                    */
+/* Operation: An epoll based reactor. Event sources (the shard's wheel       */
+/* timerfd and its wake-up eventfd) are registered once; epoll_wait()        */
+/* returns the ready sources themselves in epoll_event.data.ptr and their    */
+/* handler is called directly.                                               */
 /*                                                                           */
-/* Here the callback is nothing but the courier delivery function            */
-/* When all orders are delivered, it send a signal to Kitchen thread who     */
-/* is waiting to quit                                                        */
+/* Here the timer callback is nothing but the courier delivery function      */
 /*                                                                           */
 /**PROC-**********************************************************************/
 void *courier_timer_thread_cb(void * data)
 {
-    struct pollfd ufds[MAX_TIMER_COUNT] = {{0}};
-    int iMaxCount = 0;
-    COURIER_TIMER_NODE * tmp = NULL;
-    int read_fds = 0, i, s;
-    uint64_t exp;
-    time_t t;
+    COURIER_SHARD *shard = (COURIER_SHARD *)data;
+    struct epoll_event events[COURIER_MAX_EVENTS];
+    COURIER_SOURCE *src;
+    int ready, i;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    TRACE(COURIER, L1, "courier %d started\n", shard->index);
 
     while(1)
     {
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-        pthread_testcancel();
+        ready = epoll_wait(shard->epoll_fd, events, COURIER_MAX_EVENTS, -1);
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-        iMaxCount = 0;
-        tmp = g_head;
-
-        memset(ufds, 0, sizeof(struct pollfd)*MAX_TIMER_COUNT);
-        while(tmp && iMaxCount < MAX_TIMER_COUNT)
-        {
-            ufds[iMaxCount].fd = tmp->fd;
-            ufds[iMaxCount].events = POLLIN;
-            iMaxCount++;
-
-            tmp = tmp->next;
-        }
-        read_fds = poll(ufds, iMaxCount, 100);
-
-        if (read_fds <= 0) continue;
-
-        for (i = 0; i < iMaxCount; i++)
+        for (i = 0; i < ready; i++)
         {
-            if (ufds[i].revents & POLLIN)
-            {
-                s = read(ufds[i].fd, &exp, sizeof(uint64_t));
-
-                if (s != sizeof(uint64_t)) continue;
-
-                tmp = courier_get_timer_from_fd(ufds[i].fd);
-
-                if(tmp && tmp->callback) tmp->callback((size_t)tmp, tmp->user_data);
-
-                //Since the job of courier is done, remove the timer node
-                courier_stop_timer((size_t)tmp);
-            }
-            
-            //If all orders have been delivered send a signal to kitchen thread
-            pthread_mutex_lock(&data_access_mutex);
-            if(g_hash_table_size(g_data->g_order_id_shelf_hash) == 0) { 
-                pthread_cond_signal(&orders_empty_cond);                
-            }
-            pthread_mutex_unlock(&data_access_mutex);
+            src = (COURIER_SOURCE *)events[i].data.ptr;
+            if(src->on_readable) src->on_readable(src);
         }
     }
     
-    char time_str_buf[64];
-    current_time_msec(time_str_buf);        
-    if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: courier : L1: exiting\n", time_str_buf);
+    TRACE(COURIER, L1, "exiting\n");
 
     return NULL;
 }
@@ -1,20 +1,28 @@
 #ifndef COURIER_H
 #define COURIER_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 typedef void (*time_handler)(size_t timer_id, void * user_data);
 
 typedef struct timer_node
 {
-    int                 fd;
     time_handler        callback;
     void *              user_data;
     unsigned int        interval;
+    uint64_t            submitted;//msecs (monotonic) when handed to the courier
+    uint64_t            expires;  //wheel tick at which the timer fires
     struct timer_node * next;
+    struct timer_node **pprev;    //for O(1) unlink from the wheel slot
 } COURIER_TIMER_NODE;
 
 void courier_timer_handler(size_t timer_id, void * user_data);
+void courier_deliver_batch(void **order_ids, int count);
 size_t courier_start_timer(unsigned int interval, time_handler handler, 
 							void * user_data);
+bool courier_init();
+void courier_start_threads();
 void courier_finalize();
 void * courier_timer_thread_cb(void * data);
 
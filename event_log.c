@@ -0,0 +1,913 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "common.h"
+#include "constants.h"
+#include "clock.h"
+#include "kitchen.h"
+#include "shelf_soa.h"
+#include "shelf_lockfree.h"
+#include "event_log.h"
+
+//Asynchronous printout. A thread with something to print copies just the
+//facts of it (the time, the event, and for every shelved order its id,
+//name, temperature, shelfLife, decayRate and value) into a binary record,
+//each shelf's part under that shelf's lock only, and appends the record to
+//a ring buffer of its own once no lock is held. Each ring has exactly one
+//producer (its thread) and one consumer (the writer thread), so head and
+//tail are plain atomic counters and nobody waits on anybody unless a ring
+//fills up. Records take a sequence number from one global counter as they
+//are appended; the writer formats them strictly in that order, exactly as
+//they used to be printed, and writes a batch of them out with one writev.
+//
+//With system.print.mode = delta a record is what happened to one order
+//(ORDER_DELTA), appended where it happens: with the shelf it happened on
+//still locked, or on the lock-free shelves while the order is the
+//thread's own. Every system.print.snapshot.interval msecs the next event
+//also appends a snapshot of each shelf, taken and appended under that
+//shelf's lock, so a change on a shelf is either in its snapshot or comes
+//after it in the stream and css-replay can rebuild the shelves at any
+//time. (The lock-free shelves are copied order by order as they are
+//borrowed, so an order on the move just then can be left out.)
+//
+//A record that would take more than a quarter of a ring stays on the heap
+//and the ring carries a pointer to it. Threads beyond EVENT_LOG_MAX_RINGS,
+//and any printing while the writer is not running, format and print on the
+//spot as before.
+
+#define EVENT_LOG_MAX_RINGS     64      //threads with a ring of their own
+#define EVENT_LOG_ALIGN         16      //records start on this boundary
+#define EVENT_LOG_MAX_IOV       64      //records per writev
+#define EVENT_LOG_IDLE_WAIT     100     //msecs the writer naps when idle
+
+typedef enum {
+    EVENT_LOG_RECORD_PAD = 0,   //filler up to the end of the ring
+    EVENT_LOG_RECORD_SHELVES,   //shelf contents printout
+    EVENT_LOG_RECORD_DISCARD,   //DISCARDED line
+    EVENT_LOG_RECORD_INDIRECT,  //pointer to a record kept on the heap
+    EVENT_LOG_RECORD_DELTA,     //what happened to one order
+    EVENT_LOG_RECORD_SNAPSHOT   //one shelf, for system.print.mode = delta
+} EVENT_LOG_RECORD_TYPE;
+
+typedef struct event_log_record_t {
+    uint64_t seq;               //records are written out in this order
+    uint32_t len;               //bytes, this header included
+    uint32_t type;              //EVENT_LOG_RECORD_TYPE
+} EVENT_LOG_RECORD;
+
+//EVENT_LOG_RECORD_SHELVES; followed by the orders of every shelf, HOT_SHELF's
+//first, each an EVENT_LOG_ORDER and then its id and name (NUL terminated)
+typedef struct event_log_shelves_t {
+    int64_t at;                 //TIMESTAMP, msecs (clock_now_msec)
+    int32_t event;              //ORDER_EVENT
+    int32_t count[MAX_SHELF];
+} EVENT_LOG_SHELVES;
+
+typedef struct event_log_order_t {
+    double value;
+    float decayRate;
+    int32_t shelfLife;
+    int32_t temp;
+    uint32_t id_len;            //NUL included
+    uint32_t name_len;          //NUL included
+} EVENT_LOG_ORDER;
+
+//EVENT_LOG_RECORD_DISCARD; followed by the id (NUL terminated)
+typedef struct event_log_discard_t {
+    double value;
+    const char *policy;         //a static string
+    uint32_t id_len;            //NUL included
+} EVENT_LOG_DISCARD;
+
+//EVENT_LOG_RECORD_DELTA, and each order of an EVENT_LOG_RECORD_SNAPSHOT;
+//followed by the id and (read and snapshot only) the name, NUL terminated
+typedef struct event_log_delta_t {
+    int64_t at;                 //msecs (clock_now_msec); printed as wall clock
+    int64_t created;            //msecs (clock_now_msec); printed as wall clock
+    double value;
+    float decayRate;
+    int32_t shelfLife;
+    int32_t temp;
+    int32_t delta;              //ORDER_DELTA
+    int32_t shelf;
+    uint32_t id_len;            //NUL included
+    uint32_t name_len;          //NUL included; 0 if not there
+} EVENT_LOG_DELTA;
+
+//EVENT_LOG_RECORD_SNAPSHOT; followed by count orders
+typedef struct event_log_snapshot_t {
+    int64_t at;                 //msecs (clock_now_msec); printed as wall clock
+    int32_t shelf;
+    int32_t modifier;           //shelfDecayModifier of the shelf
+    int32_t count;
+} EVENT_LOG_SNAPSHOT;
+
+typedef struct event_log_ring_t {
+    uint64_t head __attribute__((aligned(64)));  //bytes taken by the writer
+    uint64_t tail __attribute__((aligned(64)));  //bytes appended by the owner
+    char *buf;
+    uint64_t size;              //bytes, a power of two
+    char *scratch;              //the record being put together
+    size_t scratch_len;
+    size_t scratch_size;
+    bool scratch_failed;        //out of memory; the record is dropped
+} EVENT_LOG_RING;
+
+static EVENT_LOG_RING *g_log_rings[EVENT_LOG_MAX_RINGS];
+static int g_log_ring_count;
+static pthread_mutex_t g_log_rings_mutex = PTHREAD_MUTEX_INITIALIZER; //leaf lock
+static unsigned int g_log_generation;      //rings of an earlier init are gone
+static uint64_t g_log_seq;                  //sequence number of the next record
+static uint64_t g_log_ring_size;
+
+static int64_t g_log_next_snapshot;          //msecs (clock_now_msec)
+
+static pthread_t g_log_writer;
+static bool g_log_running;
+static int g_log_stop;
+static int g_log_writer_idle;
+static pthread_mutex_t g_log_wake_mutex = PTHREAD_MUTEX_INITIALIZER; //leaf lock
+static pthread_cond_t g_log_wake_cond = PTHREAD_COND_INITIALIZER;
+
+static __thread EVENT_LOG_RING *t_log_ring;
+static __thread unsigned int t_log_generation;
+static __thread EVENT_LOG_RING t_log_local;  //scratch only; printed on the spot
+
+//Not a 'public' function; only internal to this file.
+static void event_log_wake() {
+    pthread_mutex_lock(&g_log_wake_mutex);
+    pthread_cond_signal(&g_log_wake_cond);
+    pthread_mutex_unlock(&g_log_wake_mutex);
+}
+
+//Not a 'public' function; only internal to this file.
+//This thread's ring, registered on first use; the local, unregistered one
+//if the writer is not running or there are no rings left
+static EVENT_LOG_RING *event_log_ring() {
+    EVENT_LOG_RING *ring;
+
+    if(!__atomic_load_n(&g_log_running, __ATOMIC_ACQUIRE)) return &t_log_local;
+    if(t_log_ring && t_log_generation == g_log_generation) return t_log_ring;
+
+    t_log_ring = NULL;
+    ring = calloc(1, sizeof(EVENT_LOG_RING));
+    if(ring) ring->buf = malloc(g_log_ring_size);
+    if(ring == NULL || ring->buf == NULL) {
+        free(ring);
+        return &t_log_local;
+    }
+    ring->size = g_log_ring_size;
+
+    pthread_mutex_lock(&g_log_rings_mutex);
+    if(g_log_ring_count < EVENT_LOG_MAX_RINGS) {
+        g_log_rings[g_log_ring_count] = ring;
+        __atomic_store_n(&g_log_ring_count, g_log_ring_count + 1, __ATOMIC_RELEASE);
+        t_log_ring = ring;
+        t_log_generation = g_log_generation;
+    }
+    pthread_mutex_unlock(&g_log_rings_mutex);
+
+    if(t_log_ring == NULL) {
+        free(ring->buf);
+        free(ring);
+        return &t_log_local;
+    }
+    return t_log_ring;
+}
+
+//Not a 'public' function; only internal to this file.
+//Appends to the record being put together; returns its offset in it
+static size_t event_log_put(EVENT_LOG_RING *ring, const void *data, size_t len) {
+    size_t offset = ring->scratch_len, size;
+    char *grown;
+
+    if(ring->scratch_failed) return offset;
+    if(ring->scratch_len + len > ring->scratch_size) {
+        size = ring->scratch_size ? ring->scratch_size : 4096;
+        while(size < ring->scratch_len + len) size *= 2;
+        grown = realloc(ring->scratch, size);
+        if(grown == NULL) {
+            ring->scratch_failed = true;
+            return offset;
+        }
+        ring->scratch = grown;
+        ring->scratch_size = size;
+    }
+    if(data) memcpy(ring->scratch + offset, data, len);
+    ring->scratch_len += len;
+    return offset;
+}
+
+//Not a 'public' function; only internal to this file.
+//Appends an order's id or name, which need not be NUL terminated where it
+//lives (see ORDER), and a NUL
+static void event_log_put_string(EVENT_LOG_RING *ring, const char *str, uint32_t len) {
+    event_log_put(ring, str, len);
+    event_log_put(ring, "", 1);
+}
+
+//Not a 'public' function; only internal to this file.
+//Starts a record; its header is filled in by event_log_publish
+static void event_log_begin(EVENT_LOG_RING *ring) {
+    ring->scratch_len = 0;
+    ring->scratch_failed = false;
+    event_log_put(ring, NULL, sizeof(EVENT_LOG_RECORD));
+}
+
+//Not a 'public' function; only internal to this file.
+//Print formatted detailed output as per problem statement
+//Also prints "value" of the order calculated using age of the order
+static void event_log_print_order(FILE *out, const EVENT_LOG_ORDER *order, const char *id, const char *name) {
+    char buffer[20];
+
+    fprintf(out, "\t{\n");
+    fprintf(out, "\t\t\"id\": \"%s\",\n", id);
+    fprintf(out, "\t\t\"name\": \"%s\",\n", name);
+    fprintf(out, "\t\t\"temp\": \"%s\",\n", ordertemp_to_str((TEMP)order->temp));
+    sprintf(buffer,"%d",order->shelfLife);
+    fprintf(out, "\t\t\"shelfLife\": \"%s\",\n", buffer);
+    sprintf(buffer,"%f",order->decayRate);
+    fprintf(out, "\t\t\"decayRate\": \"%s\",\n", buffer);
+    sprintf(buffer,"%f",order->value);
+    fprintf(out, "\t\t\"value\": \"%s\",\n", buffer);
+    fprintf(out, "\t}");
+}
+
+//Not a 'public' function; only internal to this file.
+static void event_log_print_shelves(FILE *out, const char *payload) {
+    EVENT_LOG_SHELVES shelves;
+    EVENT_LOG_ORDER order;
+    const char *p = payload + sizeof(EVENT_LOG_SHELVES), *id, *name;
+    char time_str_buf[64];
+    SHELF shelf_iter;
+    int i;
+
+    memcpy(&shelves, payload, sizeof(EVENT_LOG_SHELVES));
+    fprintf(out, "-------------------------------\n");
+    fprintf(out, "TIMESTAMP: %s\n", clock_format_wall(clock_to_wall_msec(shelves.at), time_str_buf));
+    fprintf(out, "EVENT: %s\n", order_event_to_str((ORDER_EVENT)shelves.event));
+
+    for(shelf_iter = HOT_SHELF; shelf_iter < MAX_SHELF; shelf_iter++) {
+        fprintf(out, "SHELF: [%s]\n", ordershelf_to_str(shelf_iter));
+        fprintf(out, "CONTENTS:[");
+        for(i = 0; i < shelves.count[shelf_iter]; i++) {
+            //entries follow their strings, so they are not aligned
+            memcpy(&order, p, sizeof(EVENT_LOG_ORDER));
+            id = p + sizeof(EVENT_LOG_ORDER);
+            name = id + order.id_len;
+            p = name + order.name_len;
+            fprintf(out, "%s", (i == 0) ? "\n" : ",\n");
+            event_log_print_order(out, &order, id, name);
+        }
+        fprintf(out, "%s]\n", (shelves.count[shelf_iter] == 0) ? "": "\n");
+    }
+    fprintf(out, "-------------------------------\n");
+}
+
+//Not a 'public' function; only internal to this file.
+//NDJSON names of the deltas and of the reasons for a discard
+static const char *event_log_delta_to_str(ORDER_DELTA delta) {
+    switch(delta) {
+        case ORDER_DELTA_READ:
+            return "read";
+        case ORDER_DELTA_PLACED:
+            return "placed";
+        case ORDER_DELTA_MOVED:
+            return "moved";
+        case ORDER_DELTA_DELIVERED:
+            return "delivered";
+        case ORDER_DELTA_DISCARDED_SHELF_FULL:
+        case ORDER_DELTA_DISCARDED_STALE:
+            return "discarded";
+        default:
+            return "unknown";
+    }
+}
+
+//Not a 'public' function; only internal to this file.
+//Writes "key":"str" with str escaped as a JSON string (quote, backslash and
+//control characters; other bytes, UTF-8 included, go as they are)
+static void event_log_print_json_string(FILE *out, const char *key, const char *str) {
+    const unsigned char *c;
+
+    fprintf(out, "\"%s\":\"", key);
+    for(c = (const unsigned char *)str; *c; c++) {
+        switch(*c) {
+            case '"': fputs("\\\"", out); break;
+            case '\\': fputs("\\\\", out); break;
+            case '\b': fputs("\\b", out); break;
+            case '\f': fputs("\\f", out); break;
+            case '\n': fputs("\\n", out); break;
+            case '\r': fputs("\\r", out); break;
+            case '\t': fputs("\\t", out); break;
+            default:
+                if(*c < 0x20) fprintf(out, "\\u%04x", *c);
+                else fputc(*c, out);
+                break;
+        }
+    }
+    fputc('"', out);
+}
+
+//Not a 'public' function; only internal to this file.
+//One NDJSON line of what happened to an order; see README (CAVEATS / ISSUES 4)
+static void event_log_print_delta(FILE *out, const char *payload) {
+    EVENT_LOG_DELTA delta;
+    const char *id = payload + sizeof(EVENT_LOG_DELTA), *name;
+
+    memcpy(&delta, payload, sizeof(EVENT_LOG_DELTA));
+    name = id + delta.id_len;
+    fprintf(out, "{\"ts\":%lld,\"event\":\"%s\",", (long long)clock_to_wall_msec(delta.at),
+                event_log_delta_to_str((ORDER_DELTA)delta.delta));
+    event_log_print_json_string(out, "id", id);
+    switch(delta.delta) {
+    case ORDER_DELTA_READ:
+        fputc(',', out);
+        event_log_print_json_string(out, "name", name);
+        fprintf(out, ",\"temp\":\"%s\",\"shelfLife\":%d,\"decayRate\":%f,\"created\":%lld",
+                    ordertemp_to_str((TEMP)delta.temp), delta.shelfLife, delta.decayRate,
+                    (long long)clock_to_wall_msec(delta.created));
+        break;
+    case ORDER_DELTA_PLACED:
+        fprintf(out, ",\"shelf\":\"%s\"", ordershelf_to_str((SHELF)delta.shelf));
+        break;
+    case ORDER_DELTA_MOVED:
+        fprintf(out, ",\"from\":\"%s\",\"shelf\":\"%s\"", ordershelf_to_str(OVERFLOW_SHELF),
+                    ordershelf_to_str((SHELF)delta.shelf));
+        break;
+    case ORDER_DELTA_DELIVERED:
+        fprintf(out, ",\"shelf\":\"%s\",\"value\":%f", ordershelf_to_str((SHELF)delta.shelf), delta.value);
+        break;
+    default:
+        if(delta.shelf >= MAX_SHELF) {
+            //turned away on arrival for its temperature; never on a shelf
+            fprintf(out, ",\"reason\":\"unknown_temp\",\"value\":%f", delta.value);
+            break;
+        }
+        fprintf(out, ",\"shelf\":\"%s\",\"reason\":\"%s\",\"value\":%f", 
+                    ordershelf_to_str((SHELF)delta.shelf),
+                    (delta.delta == ORDER_DELTA_DISCARDED_STALE) ? "stale" : "shelf_full", delta.value);
+        break;
+    }
+    fprintf(out, "}\n");
+}
+
+//Not a 'public' function; only internal to this file.
+static void event_log_print_snapshot(FILE *out, const char *payload) {
+    EVENT_LOG_SNAPSHOT snapshot;
+    EVENT_LOG_DELTA order;
+    const char *p = payload + sizeof(EVENT_LOG_SNAPSHOT), *id, *name;
+    int i;
+
+    memcpy(&snapshot, payload, sizeof(EVENT_LOG_SNAPSHOT));
+    fprintf(out, "{\"ts\":%lld,\"event\":\"snapshot\",\"shelf\":\"%s\",\"modifier\":%d,\"orders\":[",
+                (long long)clock_to_wall_msec(snapshot.at), ordershelf_to_str((SHELF)snapshot.shelf), snapshot.modifier);
+    for(i = 0; i < snapshot.count; i++) {
+        memcpy(&order, p, sizeof(EVENT_LOG_DELTA));
+        id = p + sizeof(EVENT_LOG_DELTA);
+        name = id + order.id_len;
+        p = name + order.name_len;
+        fputs((i == 0) ? "{" : ",{", out);
+        event_log_print_json_string(out, "id", id);
+        fputc(',', out);
+        event_log_print_json_string(out, "name", name);
+        fprintf(out, ",\"temp\":\"%s\",\"shelfLife\":%d,\"decayRate\":%f,\"created\":%lld}",
+                    ordertemp_to_str((TEMP)order.temp), order.shelfLife,
+                    order.decayRate, (long long)clock_to_wall_msec(order.created));
+    }
+    fprintf(out, "]}\n");
+}
+
+//Not a 'public' function; only internal to this file.
+//Formats a record the way it used to be printed
+static void event_log_print(FILE *out, const EVENT_LOG_RECORD *record) {
+    const char *payload = (const char *)record + sizeof(EVENT_LOG_RECORD);
+    EVENT_LOG_DISCARD discard;
+    char *indirect;
+
+    switch(record->type) {
+    case EVENT_LOG_RECORD_SHELVES:
+        event_log_print_shelves(out, payload);
+        break;
+    case EVENT_LOG_RECORD_DISCARD:
+        memcpy(&discard, payload, sizeof(EVENT_LOG_DISCARD));
+        fprintf(out, "DISCARDED: %s value %f (%s)\n", payload + sizeof(EVENT_LOG_DISCARD),
+                                discard.value, discard.policy);
+        break;
+    case EVENT_LOG_RECORD_DELTA:
+        event_log_print_delta(out, payload);
+        break;
+    case EVENT_LOG_RECORD_SNAPSHOT:
+        event_log_print_snapshot(out, payload);
+        break;
+    case EVENT_LOG_RECORD_INDIRECT:
+        memcpy(&indirect, payload, sizeof(char *));
+        event_log_print(out, (const EVENT_LOG_RECORD *)indirect);
+        free(indirect);
+        break;
+    default:
+        break;
+    }
+}
+
+//Not a 'public' function; only internal to this file.
+//Hands the record put together to the writer (or prints it now if this
+//thread has no ring). Caller may hold shelf locks: this waits only for
+//the writer, when the ring is full.
+static void event_log_publish(EVENT_LOG_RING *ring, EVENT_LOG_RECORD_TYPE type) {
+    EVENT_LOG_RECORD *record;
+    uint64_t tail, pos, room, total, need;
+    char *indirect;
+    char *text = NULL;
+    size_t text_sz = 0;
+    FILE *out;
+
+    if(ring->scratch_failed) return;
+    record = (EVENT_LOG_RECORD *)ring->scratch;
+    record->seq = 0;
+    record->len = (ring->scratch_len + EVENT_LOG_ALIGN - 1) & ~(uint64_t)(EVENT_LOG_ALIGN - 1);
+    record->type = type;
+
+    if(ring == &t_log_local) {
+        if((out = open_memstream(&text, &text_sz)) == NULL) return;
+        event_log_print(out, record);
+        fclose(out);
+        fputs(text, stdout);
+        free(text);
+        free(ring->scratch);
+        ring->scratch = NULL;
+        ring->scratch_size = 0;
+        return;
+    }
+
+    if(record->len > ring->size / 4) {
+        //too big for the ring: the ring carries a pointer to it instead
+        indirect = ring->scratch;
+        ring->scratch = NULL;
+        ring->scratch_size = 0;
+        event_log_begin(ring);
+        event_log_put(ring, &indirect, sizeof(char *));
+        if(ring->scratch_failed) {
+            free(indirect);
+            return;
+        }
+        record = (EVENT_LOG_RECORD *)ring->scratch;
+        record->len = (ring->scratch_len + EVENT_LOG_ALIGN - 1) & ~(uint64_t)(EVENT_LOG_ALIGN - 1);
+        record->type = EVENT_LOG_RECORD_INDIRECT;
+    }
+
+    total = record->len;
+    tail = ring->tail;
+    pos = tail & (ring->size - 1);
+    room = ring->size - pos;
+    need = (room < total) ? total + room : total; //a record does not wrap around
+    while(ring->size - (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) < need) {
+        event_log_wake();
+        sched_yield();
+    }
+    if(room < total) {
+        record = (EVENT_LOG_RECORD *)(ring->buf + pos);
+        record->seq = 0;
+        record->len = room;
+        record->type = EVENT_LOG_RECORD_PAD;
+        tail += room;
+        pos = 0;
+    }
+
+    //numbered only now that it can go straight in, so the writer never
+    //waits long for a number that has been handed out
+    record = (EVENT_LOG_RECORD *)ring->scratch;
+    record->seq = __atomic_fetch_add(&g_log_seq, 1, __ATOMIC_SEQ_CST);
+    memcpy(ring->buf + pos, ring->scratch, ring->scratch_len);
+    __atomic_store_n(&ring->tail, tail + total, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&g_log_writer_idle, __ATOMIC_SEQ_CST)) event_log_wake();
+}
+
+//Not a 'public' function; only internal to this file.
+//The record at the head of a ring, skipping filler; NULL if it is empty
+static EVENT_LOG_RECORD *event_log_peek(EVENT_LOG_RING *ring) {
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    EVENT_LOG_RECORD *record;
+
+    while(ring->head < tail) {
+        record = (EVENT_LOG_RECORD *)(ring->buf + (ring->head & (ring->size - 1)));
+        if(record->type != EVENT_LOG_RECORD_PAD) return record;
+        __atomic_store_n(&ring->head, ring->head + record->len, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+//Not a 'public' function; only internal to this file.
+//Writes out the formatted records; whatever was printed to stdout
+//directly before goes first
+static void event_log_flush(char **texts, size_t *lens, int *count) {
+    struct iovec iov[EVENT_LOG_MAX_IOV];
+    ssize_t written;
+    int i, first = 0;
+
+    if(*count == 0) return;
+    for(i = 0; i < *count; i++) {
+        iov[i].iov_base = texts[i];
+        iov[i].iov_len = lens[i];
+    }
+    fflush(stdout);
+    while(first < *count) {
+        written = writev(STDOUT_FILENO, iov + first, *count - first);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+        while(first < *count && (size_t)written >= iov[first].iov_len) {
+            written -= iov[first].iov_len;
+            first++;
+        }
+        if(first < *count) {
+            iov[first].iov_base = (char *)iov[first].iov_base + written;
+            iov[first].iov_len -= written;
+        }
+    }
+    for(i = 0; i < *count; i++) free(texts[i]);
+    *count = 0;
+}
+
+//Not a 'public' function; only internal to this file.
+//Naps until a record is due or the writer is told to stop
+static void event_log_idle_wait(uint64_t next_seq) {
+    struct timespec until;
+    int64_t wake = clock_now_nsec() + (int64_t)EVENT_LOG_IDLE_WAIT * 1000000;
+
+    pthread_mutex_lock(&g_log_wake_mutex);
+    __atomic_store_n(&g_log_writer_idle, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&g_log_seq, __ATOMIC_SEQ_CST) == next_seq &&
+                !__atomic_load_n(&g_log_stop, __ATOMIC_SEQ_CST)) {
+        until.tv_sec = wake / 1000000000;
+        until.tv_nsec = wake % 1000000000;
+        pthread_cond_timedwait(&g_log_wake_cond, &g_log_wake_mutex, &until);
+    }
+    __atomic_store_n(&g_log_writer_idle, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&g_log_wake_mutex);
+}
+
+//Not a 'public' function; only internal to this file.
+//The writer thread: formats the records in sequence order, a batch at a
+//time, and writes each batch with one writev
+static void *event_log_writer_cb(void *arg) {
+    char *texts[EVENT_LOG_MAX_IOV];
+    size_t lens[EVENT_LOG_MAX_IOV];
+    int count = 0, rings, i;
+    uint64_t next_seq = 0;
+    EVENT_LOG_RECORD *record;
+    EVENT_LOG_RING *ring;
+    bool stop;
+    FILE *out;
+
+    (void)arg;
+    while(1) {
+        //anything appended before the stop is seen below
+        stop = __atomic_load_n(&g_log_stop, __ATOMIC_SEQ_CST);
+        rings = __atomic_load_n(&g_log_ring_count, __ATOMIC_ACQUIRE);
+        record = NULL;
+        for(i = 0; i < rings; i++) {
+            ring = g_log_rings[i];
+            record = event_log_peek(ring);
+            if(record && record->seq == next_seq) break;
+            record = NULL;
+        }
+
+        if(record) {
+            texts[count] = NULL;
+            lens[count] = 0;
+            if((out = open_memstream(&texts[count], &lens[count])) != NULL) {
+                event_log_print(out, record);
+                fclose(out);
+                count++;
+            }
+            __atomic_store_n(&ring->head, ring->head + record->len, __ATOMIC_RELEASE);
+            next_seq++;
+            if(count == EVENT_LOG_MAX_IOV) event_log_flush(texts, lens, &count);
+            continue;
+        }
+
+        event_log_flush(texts, lens, &count);
+        if(__atomic_load_n(&g_log_seq, __ATOMIC_SEQ_CST) > next_seq) {
+            //numbered but not in its ring yet
+            sched_yield();
+            continue;
+        }
+        if(stop) break;
+        event_log_idle_wait(next_seq);
+    }
+    return NULL;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      event_log_init                                                 */
+/*                                                                           */
+/* Purpose:   Starts the writer thread of the shelf contents printout        */
+/*                                                                           */
+/* Returns:   bool - for success/failure.                                    */
+/*                                                                           */
+/*                                                                           */
+/* Operation: Each thread that prints gets a ring of system.print.ring.size  */
+/*            KB the first time it does.                                     */
+/*                                                                           */
+/**PROC-**********************************************************************/
+bool event_log_init() {
+    pthread_condattr_t attr;
+    uint64_t size = 64 * 1024;
+
+    while(size < (uint64_t)SYSTEM_PRINT_RING_SIZE * 1024) size *= 2;
+    g_log_ring_size = size;
+    g_log_ring_count = 0;
+    g_log_seq = 0;
+    g_log_stop = 0;
+    g_log_writer_idle = 0;
+    g_log_next_snapshot = 0;
+    g_log_generation++;
+
+    //the writer's naps go by the monotonic clock, as the timers do
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_destroy(&g_log_wake_cond);
+    pthread_cond_init(&g_log_wake_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if(pthread_create(&g_log_writer, NULL, event_log_writer_cb, NULL) != 0) return false;
+    __atomic_store_n(&g_log_running, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      event_log_finalize                                             */
+/*                                                                           */
+/* Purpose:   Writes out what is left of the printout and stops the writer   */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/*                                                                           */
+/* Operation: Caller makes sure no other thread prints any more (they are    */
+/*            stopped); whatever is printed after this is printed on the     */
+/*            spot.                                                          */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void event_log_finalize() {
+    int i;
+
+    if(!__atomic_load_n(&g_log_running, __ATOMIC_ACQUIRE)) return;
+    __atomic_store_n(&g_log_stop, 1, __ATOMIC_SEQ_CST);
+    event_log_wake();
+    pthread_join(g_log_writer, NULL);
+    __atomic_store_n(&g_log_running, false, __ATOMIC_RELEASE);
+
+    for(i = 0; i < g_log_ring_count; i++) {
+        free(g_log_rings[i]->buf);
+        free(g_log_rings[i]->scratch);
+        free(g_log_rings[i]);
+        g_log_rings[i] = NULL;
+    }
+    g_log_ring_count = 0;
+    free(t_log_local.scratch);
+    memset(&t_log_local, 0, sizeof(EVENT_LOG_RING));
+    fflush(stdout);
+}
+
+/**PROC+**********************************************************************/
+/* Name:      event_log_shelf_contents                                       */
+/*                                                                           */
+/* Purpose:   Prints the contents of every shelf for an event                */
+/*                                                                           */
+/* Params:    IN     evt             - Event the printout is for             */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/*                                                                           */
+/* Operation: Each shelf is copied (value, shelfLife, decayRate, temperature,*/
+/*            id and name of its orders) under its own lock only, lock-free  */
+/*            shelves order by order as each is borrowed; the record is      */
+/*            handed to the writer once no shelf is locked. The caller must  */
+/*            not hold a shelf lock.                                         */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void event_log_shelf_contents(ORDER_EVENT evt) {
+    EVENT_LOG_RING *ring = event_log_ring();
+    EVENT_LOG_SHELVES shelves;
+    EVENT_LOG_ORDER entry;
+    SHELF_ARRAY *shelf_array;
+    SHELF shelf_iter;
+    ORDER *order;
+    size_t shelves_offset;
+    int64_t now;
+    int i, elapsed_time, shelfDecayModifier;//elapsed_time in msecs
+
+    event_log_begin(ring);
+    memset(&shelves, 0, sizeof(EVENT_LOG_SHELVES));
+    shelves.at = now = clock_now_msec();
+    shelves.event = evt;
+    shelves_offset = event_log_put(ring, &shelves, sizeof(EVENT_LOG_SHELVES));
+
+    for(shelf_iter = HOT_SHELF; shelf_iter < MAX_SHELF; shelf_iter++) {
+        shelf_array = &g_data->g_shelves[shelf_iter];
+        shelfDecayModifier = (shelf_iter == OVERFLOW_SHELF) ?
+                        SHELF_LIFE_MODIFIER_OVERFLOW_SHELF : SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF;
+
+        if(shelf_array->occupied == NULL) {
+            shelf_lock(shelf_iter);
+            //soa: the whole shelf is valued up front, from its columns
+            if(shelf_array->created) shelf_soa_evaluate(shelf_array, now);
+        }
+        for(i = 0; i < (shelf_array->occupied ? shelf_array->capacity : shelf_array->count); i++) {
+            if(shelf_array->occupied) {
+                //lock-free: each order is borrowed from its slot while copied
+                if((order = shelf_lf_borrow(shelf_array, i)) == NULL) continue;
+            } else {
+                order = shelf_array->orders[i];
+            }
+            if(shelf_array->created) {
+                entry.value = shelf_array->values[i];
+            } else {
+                elapsed_time = (int)(now - order->created);
+                entry.value = order->shelfLife - (order->decayRate * (elapsed_time/1000) * shelfDecayModifier);
+            }
+            entry.decayRate = order->decayRate;
+            entry.shelfLife = order->shelfLife;
+            entry.temp = order->temp;
+            entry.id_len = order->id_len + 1;
+            entry.name_len = order->name_len + 1;
+            event_log_put(ring, &entry, sizeof(EVENT_LOG_ORDER));
+            event_log_put_string(ring, order->id, order->id_len);
+            event_log_put_string(ring, order->name, order->name_len);
+            shelves.count[shelf_iter]++;
+            if(shelf_array->occupied) shelf_lf_return(shelf_array, i, order);
+        }
+        if(shelf_array->occupied == NULL) shelf_unlock(shelf_iter);
+    }
+
+    if(!ring->scratch_failed) {
+        memcpy(ring->scratch + shelves_offset, &shelves, sizeof(EVENT_LOG_SHELVES));
+    }
+    event_log_publish(ring, EVENT_LOG_RECORD_SHELVES);
+}
+
+/**PROC+**********************************************************************/
+/* Name:      event_log_discard                                              */
+/*                                                                           */
+/* Purpose:   Prints the DISCARDED line of an order discarded for want of    */
+/*            shelf space                                                    */
+/*                                                                           */
+/* Params:    IN     id              - Id of the order                       */
+/*            IN     id_len          - Its length; id need not end in a NUL  */
+/*            IN     value           - Its value when discarded              */
+/*            IN     policy          - Placement policy name, or why none   */
+/*                                     was asked (static string)             */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/*                                                                           */
+/* Operation: Goes through the ring like the shelf contents do, so the line  */
+/*            keeps its place among them; may be called with shelf locks     */
+/*            held.                                                          */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void event_log_discard(const char *id, uint32_t id_len, double value, const char *policy) {
+    EVENT_LOG_RING *ring = event_log_ring();
+    EVENT_LOG_DISCARD discard;
+
+    event_log_begin(ring);
+    memset(&discard, 0, sizeof(EVENT_LOG_DISCARD));
+    discard.value = value;
+    discard.policy = policy;
+    discard.id_len = id_len + 1;
+    event_log_put(ring, &discard, sizeof(EVENT_LOG_DISCARD));
+    event_log_put_string(ring, id, id_len);
+    event_log_publish(ring, EVENT_LOG_RECORD_DISCARD);
+}
+
+//Not a 'public' function; only internal to this file.
+//Appends an order to the record being put together (name too if asked)
+static void event_log_put_order(EVENT_LOG_RING *ring, EVENT_LOG_DELTA *entry, ORDER *order, bool name) {
+    entry->created = order->created;
+    entry->decayRate = order->decayRate;
+    entry->shelfLife = order->shelfLife;
+    entry->temp = order->temp;
+    entry->id_len = order->id_len + 1;
+    entry->name_len = name ? order->name_len + 1 : 0;
+    event_log_put(ring, entry, sizeof(EVENT_LOG_DELTA));
+    event_log_put_string(ring, order->id, order->id_len);
+    if(name) event_log_put_string(ring, order->name, order->name_len);
+}
+
+/**PROC+**********************************************************************/
+/* Name:      event_log_delta                                                */
+/*                                                                           */
+/* Purpose:   Prints what happened to one order (system.print.mode = delta)  */
+/*                                                                           */
+/* Params:    IN     delta           - What happened                         */
+/*            IN     order           - The order                             */
+/*            IN     shelf           - Shelf it was placed on, moved to,     */
+/*                                     delivered or discarded from;          */
+/*                                     MAX_SHELF if it never got on one      */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/*                                                                           */
+/* Operation: Caller holds the lock of every shelf the change touches (or,   */
+/*            lock-free, owns the order), so the record comes after the last */
+/*            snapshot of those shelves that does not have the change in it. */
+/*            A delivered or discarded order is printed with its value on    */
+/*            that shelf (a discarded one at least 0; one never shelved, 0). */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void event_log_delta(ORDER_DELTA delta, ORDER *order, SHELF shelf) {
+    EVENT_LOG_RING *ring = event_log_ring();
+    EVENT_LOG_DELTA entry;
+
+    event_log_begin(ring);
+    memset(&entry, 0, sizeof(EVENT_LOG_DELTA));
+    entry.at = shelf_now_msec();
+    if(delta >= ORDER_DELTA_DELIVERED && shelf < MAX_SHELF) {
+        entry.value = shelf_value_at(order, shelf, entry.at);
+        if(delta != ORDER_DELTA_DELIVERED && entry.value < 0) entry.value = 0;
+    }
+    entry.delta = delta;
+    entry.shelf = shelf;
+    event_log_put_order(ring, &entry, order, delta == ORDER_DELTA_READ);
+    event_log_publish(ring, EVENT_LOG_RECORD_DELTA);
+}
+
+/**PROC+**********************************************************************/
+/* Name:      event_log_snapshot_due                                         */
+/*                                                                           */
+/* Purpose:   Prints a snapshot of every shelf if one is due                 */
+/*            (system.print.mode = delta)                                    */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/*                                                                           */
+/* Operation: Called on every event in place of the shelf contents printout; */
+/*            the first event and then one every                             */
+/*            system.print.snapshot.interval msecs (whichever thread gets    */
+/*            there first) takes it. Each shelf is copied and its record     */
+/*            appended under its own lock. The caller must not hold a shelf  */
+/*            lock.                                                          */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void event_log_snapshot_due() {
+    EVENT_LOG_RING *ring;
+    EVENT_LOG_SNAPSHOT snapshot;
+    EVENT_LOG_DELTA entry;
+    SHELF_ARRAY *shelf_array;
+    SHELF shelf_iter;
+    ORDER *order;
+    int64_t due = __atomic_load_n(&g_log_next_snapshot, __ATOMIC_ACQUIRE);
+    size_t snapshot_offset;
+    int i;
+
+    memset(&snapshot, 0, sizeof(EVENT_LOG_SNAPSHOT));
+    snapshot.at = shelf_now_msec();
+    if(snapshot.at < due || !__atomic_compare_exchange_n(&g_log_next_snapshot, &due, 
+                snapshot.at + SYSTEM_PRINT_SNAPSHOT_INTERVAL, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    ring = event_log_ring();
+    memset(&entry, 0, sizeof(EVENT_LOG_DELTA));
+    for(shelf_iter = HOT_SHELF; shelf_iter < MAX_SHELF; shelf_iter++) {
+        shelf_array = &g_data->g_shelves[shelf_iter];
+        snapshot.shelf = shelf_iter;
+        snapshot.modifier = (shelf_iter == OVERFLOW_SHELF) ? 
+                        SHELF_LIFE_MODIFIER_OVERFLOW_SHELF : SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF;
+        snapshot.count = 0;
+        event_log_begin(ring);
+        snapshot_offset = event_log_put(ring, &snapshot, sizeof(EVENT_LOG_SNAPSHOT));
+        
+        if(shelf_array->occupied) {
+            //lock-free: each order is borrowed from its slot while copied
+            for(i = 0; i < shelf_array->capacity; i++) {
+                if((order = shelf_lf_borrow(shelf_array, i)) == NULL) continue;
+                event_log_put_order(ring, &entry, order, true);
+                snapshot.count++;
+                shelf_lf_return(shelf_array, i, order);
+            }
+        } else {
+            shelf_lock(shelf_iter);
+            for(i = 0; i < shelf_array->count; i++) {
+                event_log_put_order(ring, &entry, shelf_array->orders[i], true);
+                snapshot.count++;
+            }
+        }
+        if(!ring->scratch_failed) {
+            memcpy(ring->scratch + snapshot_offset, &snapshot, sizeof(EVENT_LOG_SNAPSHOT));
+        }
+        event_log_publish(ring, EVENT_LOG_RECORD_SNAPSHOT);
+        if(shelf_array->occupied == NULL) shelf_unlock(shelf_iter);
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//The shelf contents printout (system.print.shelf.contents) and the
+//DISCARDED lines go through here: the thread an event happens on copies
+//what is to be printed into its own ring of records and a writer thread
+//formats and writes them, in the order they happened. With
+//system.print.mode = delta the records are one per change to an order and
+//a snapshot of each shelf now and then, printed as NDJSON lines
+
+bool event_log_init();
+void event_log_finalize();
+void event_log_shelf_contents(ORDER_EVENT evt);
+void event_log_discard(const char *id, uint32_t id_len, double value, const char *policy);
+void event_log_delta(ORDER_DELTA delta, ORDER *order, SHELF shelf);
+void event_log_snapshot_due();
+
+#endif //EVENT_LOG_H
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "constants.h"
+#include "trace.h"
+#include "input.h"
+#include "ingest.h"
+
+//Parsed orders a partition may hold before its parser thread waits, when
+//the file is partitioned; a single reader stage holds two ingestion
+//batches (double buffer)
+#define INGEST_QUEUE_SIZE 4096
+//Max orders a parser thread hands over per lock
+#define INGEST_BATCH 64
+
+//One partition of the orders file (or the whole file, for the single
+//reader stage): its parser thread fills a bounded queue that the kitchen
+//(the merge step) drains in partition order
+typedef struct ingest_partition_t {
+    int index;
+    ORDER_READER *reader;
+    pthread_t thread_id;
+    bool threaded;          //false: no parser thread; the merge step parses
+    bool owns_reader;       //a partition of the caller's reader
+    
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    ORDER **queue;          //ring of "capacity" orders
+    int capacity;
+    int batch;              //orders handed over per lock
+    int head;
+    int count;
+    bool done;              //reader exhausted; nothing more will be queued
+    bool stopping;
+} INGEST_PARTITION;
+
+static INGEST_PARTITION *g_partitions = NULL;
+static int g_partition_count = 0;
+static int g_partition_current = 0; //partition the merge step drains
+
+//Not a 'public' function; only internal to this file.
+//Parser thread: parses its partition ahead of the kitchen
+static void *ingest_thread_cb(void *arg) {
+    INGEST_PARTITION *part = (INGEST_PARTITION *)arg;
+    ORDER *batch[INGEST_BATCH];
+    bool more = true;
+    int count, i;
+    
+    TRACE(KITCHEN, L2, "partition %d parser started\n", part->index);
+    
+    while(more) {
+        for(count = 0; count < part->batch && (more = order_reader_next(part->reader, &batch[count])); count++)
+            ;
+        
+        pthread_mutex_lock(&part->mutex);
+        while(part->count + count > part->capacity && !part->stopping) {
+            pthread_cond_wait(&part->not_full, &part->mutex);
+        }
+        if(part->stopping) {
+            pthread_mutex_unlock(&part->mutex);
+            for(i = 0; i < count; i++) order_release(batch[i]);
+            break;
+        }
+        for(i = 0; i < count; i++) {
+            part->queue[(part->head + part->count) % part->capacity] = batch[i];
+            part->count++;
+        }
+        if(!more) part->done = true;
+        pthread_cond_signal(&part->not_empty);
+        pthread_mutex_unlock(&part->mutex);
+    }
+    
+    TRACE(KITCHEN, L2, "partition %d parser done\n", part->index);
+    return NULL;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      ingest_start                                                   */
+/*                                                                           */
+/* Purpose:   Starts the reader stage: orders are parsed ahead of the        */
+/*            kitchen, without holding any shelf lock                        */
+/*                                                                           */
+/* Params:    IN     reader          - Orders reader; must stay open until   */
+/*                                     ingest_finalize()                     */
+/*            IN     threads         - Count of parser threads; above 1 the  */
+/*                                     file is partitioned (mmap and packed  */
+/*                                     readers, see order_reader_split)      */
+/*            IN     ingestion_rate  - Orders the kitchen takes per tick     */
+/*                                                                           */
+/* Returns:   bool - success; on failure the reader is left untouched, so    */
+/*            the caller can go on with order_reader_read().                 */
+/*                                                                           */
+/* Operation: With one thread the queue holds two ingestion batches: the     */
+/*            one the kitchen takes next and the one being parsed behind it. */
+/*            A partition whose thread cannot be created is parsed by the    */
+/*            merge step itself when its turn comes.                         */
+/*                                                                           */
+/**PROC-**********************************************************************/
+bool ingest_start(ORDER_READER *reader, int threads, int ingestion_rate) {
+    ORDER_READER **parts = NULL;
+    int i, capacity;
+    
+    if(threads < 1 || ingestion_rate < 1) return false;
+    capacity = (threads > 1) ? INGEST_QUEUE_SIZE : 2 * ingestion_rate;
+    
+    g_partitions = calloc(threads, sizeof(INGEST_PARTITION));
+    if(g_partitions == NULL) return false;
+    for(i = 0; i < threads; i++) {
+        g_partitions[i].queue = malloc(capacity * sizeof(ORDER *));
+        if(g_partitions[i].queue == NULL) break;
+    }
+    if(i < threads || (threads > 1 && (parts = order_reader_split(reader, threads)) == NULL)) {
+        for(i = 0; i < threads; i++) free(g_partitions[i].queue);
+        free(g_partitions);
+        g_partitions = NULL;
+        return false;
+    }
+    
+    g_partition_count = threads;
+    g_partition_current = 0;
+    for(i = 0; i < threads; i++) {
+        INGEST_PARTITION *part = &g_partitions[i];
+        part->index = i;
+        part->reader = parts ? parts[i] : reader;
+        part->owns_reader = (parts != NULL);
+        part->capacity = capacity;
+        part->batch = (threads > 1 || ingestion_rate > INGEST_BATCH) ? INGEST_BATCH : ingestion_rate;
+        pthread_mutex_init(&part->mutex, NULL);
+        pthread_cond_init(&part->not_empty, NULL);
+        pthread_cond_init(&part->not_full, NULL);
+        part->threaded = (pthread_create(&part->thread_id, NULL, ingest_thread_cb, part) == 0);
+    }
+    free(parts);
+    
+    TRACE(KITCHEN, L4, "parsing orders ahead with %d threads\n", threads);
+    return true;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      ingest_read_orders                                             */
+/*                                                                           */
+/* Purpose:   Merge step of parallel ingestion; the counterpart of           */
+/*            order_reader_read()                                            */
+/*                                                                           */
+/* Params:    IN     ingestion_rate  - Count of orders to be ingested        */
+/*                                                                           */
+/* Returns:   bool - for EOF (true) or otherwise (false).                    */
+/*                                                                           */
+/*                                                                           */
+/* Operation: Orders are taken from the partitions strictly in partition     */
+/* order, so they arrive in file order whatever the thread timing. The       */
+/* orders are appended to the global LL like file_read_orders() does. A      */
+/* malformed order ends ingestion after the orders before it, as it does     */
+/* for a single reader.                                                      */
+/*                                                                           */
+/**PROC-**********************************************************************/
+bool ingest_read_orders(int ingestion_rate) {
+    INGEST_PARTITION *part;
+    int read_count = 0;
+    ORDER *order;
+    bool exhausted;
+    
+    while(read_count < ingestion_rate && g_partition_current < g_partition_count) {
+        part = &g_partitions[g_partition_current];
+        
+        if(!part->threaded) {
+            exhausted = !order_reader_next(part->reader, &order);
+            if(!exhausted) {
+                read_count++;
+                input_append_order(order);
+            }
+        } else {
+            //take all that is ready (up to the rate) under one lock
+            pthread_mutex_lock(&part->mutex);
+            while(part->count == 0 && !part->done) {
+                pthread_cond_wait(&part->not_empty, &part->mutex);
+            }
+            exhausted = (part->count == 0);
+            for(; part->count > 0 && read_count < ingestion_rate; read_count++) {
+                input_append_order(part->queue[part->head]);
+                part->head = (part->head + 1) % part->capacity;
+                part->count--;
+            }
+            pthread_cond_signal(&part->not_full);
+            pthread_mutex_unlock(&part->mutex);
+        }
+        
+        if(exhausted) {
+            //nothing after a malformed order is ingested
+            g_partition_current = part->reader->malformed ? g_partition_count : g_partition_current + 1;
+        }
+    }
+    
+    return g_partition_current >= g_partition_count;
+}
+
+//Stops the parser threads and frees whatever they parsed that was not
+//ingested; partition readers are closed (the caller's reader is not)
+void ingest_finalize() {
+    INGEST_PARTITION *part;
+    int i;
+    
+    for(i = 0; i < g_partition_count; i++) {
+        part = &g_partitions[i];
+        if(part->threaded) {
+            pthread_mutex_lock(&part->mutex);
+            part->stopping = true;
+            pthread_cond_signal(&part->not_full);
+            pthread_mutex_unlock(&part->mutex);
+            pthread_join(part->thread_id, NULL);
+        }
+        while(part->count > 0) {
+            order_release(part->queue[part->head]);
+            part->head = (part->head + 1) % part->capacity;
+            part->count--;
+        }
+        pthread_mutex_destroy(&part->mutex);
+        pthread_cond_destroy(&part->not_empty);
+        pthread_cond_destroy(&part->not_full);
+        if(part->owns_reader) order_reader_close(part->reader);
+        free(part->queue);
+    }
+    free(g_partitions);
+    g_partitions = NULL;
+    g_partition_count = 0;
+}
@@ -0,0 +1,8 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+bool ingest_start(ORDER_READER *reader, int threads, int ingestion_rate);
+bool ingest_read_orders(int ingestion_rate);
+void ingest_finalize();
+
+#endif //INGEST_H
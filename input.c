@@ -5,12 +5,22 @@
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
-#include <glib.h>
-#include <sys/timeb.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <pthread.h>
 
 #include "common.h"
 #include "constants.h"
+#include "clock.h"
+#include "trace.h"
 #include "kitchen.h"
+#include "input.h"
+#include "json_index.h"
+#include "pool.h"
+#include "order_index.h"
 
 //Not a 'public' function; only internal to this file.
 static char* ltrim(char* str) {
@@ -40,6 +50,17 @@ static char* rtrim(char* str) {
     return str;
 }
 
+//Not a 'public' function; only internal to this file.
+//Debug levels on for a "system.debug.level" value: the one named and
+//those above it
+static int debug_levels_from_str(const char *value) {
+    return (strcmp(value,"NONE")==0) ? NONE : 
+                ((strcmp(value,"L4")==0) ? L4 :
+                    ((strcmp(value,"L3")==0) ? (L4 | L3) :
+                        ((strcmp(value,"L2")==0) ? (L4 | L3 | L2) :
+                            ((strcmp(value,"L1")==0) ? (L4 | L3 | L2 | L1) : NONE))));
+}
+
 /**PROC+**********************************************************************/
 /* Name:      read_properties                                                */
 /*                                                                           */
@@ -57,15 +78,14 @@ static char* rtrim(char* str) {
 bool read_properties() {
     bool success = true;
     char time_str_buf[64]; 
+    int debug_levels = NONE, subsystem_levels[MAX_TRACE_SUBSYSTEM];
+    TRACE_SUBSYSTEM sub;
     char str[80]; //assumes rows in css.properties file are 80 column length
     char *trimmed_str, *key, *value;  
     
     FILE *f = fopen("css.properties" , "r");
     if(f == NULL) {
-        current_time_msec(time_str_buf);        
-        if(SYSTEM_DEBUG_LEVEL & L4) 
-            printf("%s: input : L4: Cannot open css.properties file. Assuming defaults..\n", 
-                        time_str_buf);
+        TRACE(KITCHEN, L4, "Cannot open css.properties file. Assuming defaults..\n");
         HOT_SHELF_MAX_SIZE = DEFAULT_HOT_SHELF_MAX_SIZE;
         COLD_SHELF_MAX_SIZE = DEFAULT_COLD_SHELF_MAX_SIZE;
         FROZEN_SHELF_MAX_SIZE = DEFAULT_FROZEN_SHELF_MAX_SIZE;
@@ -75,19 +95,31 @@ bool read_properties() {
         KITCHEN_INGESTION_RATE = DEFAULT_KITCHEN_INGESTION_RATE;
         KITCHEN_COURIER_DISPATCH_INTERVAL_MIN = DEFAULT_KITCHEN_COURIER_DISPATCH_INTERVAL_MIN; 
         KITCHEN_COURIER_DISPATCH_INTERVAL_MAX = DEFAULT_KITCHEN_COURIER_DISPATCH_INTERVAL_MAX;
+        KITCHEN_THREADS = DEFAULT_KITCHEN_THREADS;
+
+        COURIER_THREADS = DEFAULT_COURIER_THREADS;
 
         SHELF_MONITOR_INTERVAL = DEFAULT_SHELF_MONITOR_INTERVAL;
         SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF = DEFAULT_SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF;
         SHELF_LIFE_MODIFIER_OVERFLOW_SHELF = DEFAULT_SHELF_LIFE_MODIFIER_OVERFLOW_SHELF;
+        SHELF_OVERFLOW_EVICTION = DEFAULT_SHELF_OVERFLOW_EVICTION;
+        SHELF_LAYOUT_TYPE = DEFAULT_SHELF_LAYOUT;
+        SHELF_CONCURRENCY_TYPE = DEFAULT_SHELF_CONCURRENCY;
+        SHELF_PLACEMENT_POLICY = DEFAULT_SHELF_PLACEMENT;
         
-        SYSTEM_DEBUG_LEVEL = DEFAULT_DEBUG_LEVEL;
+        SYSTEM_DEBUG_LEVEL = TRACE_ALL(DEFAULT_DEBUG_LEVEL);
         SYSTEM_ORDERS_INPUT_FILE = malloc(strlen(DEFAULT_SYSTEM_ORDERS_INPUT_FILE)+1);
         strcpy(SYSTEM_ORDERS_INPUT_FILE, DEFAULT_SYSTEM_ORDERS_INPUT_FILE);
+        SYSTEM_ORDERS_READER = DEFAULT_SYSTEM_ORDERS_READER;
         
         SYSTEM_PRINT_SHELF_CONTENTS = DEFAULT_SYSTEM_PRINT_SHELF_CONTENTS;
+        SYSTEM_PRINT_RING_SIZE = DEFAULT_SYSTEM_PRINT_RING_SIZE;
+        SYSTEM_PRINT_MODE = DEFAULT_SYSTEM_PRINT_MODE;
+        SYSTEM_PRINT_SNAPSHOT_INTERVAL = DEFAULT_SYSTEM_PRINT_SNAPSHOT_INTERVAL;
+        SYSTEM_STATS_INTERVAL = DEFAULT_SYSTEM_STATS_INTERVAL;
     } else {
         bool is_eof = false;
-        current_time_msec(time_str_buf);        
+        for(sub = TRACE_KITCHEN; sub < MAX_TRACE_SUBSYSTEM; sub++) subsystem_levels[sub] = -1;
         while(!is_eof) {
             char *s = fgets(str, 80, f);
             if(!s) {
@@ -95,7 +127,7 @@ bool read_properties() {
                 break;
             }
             trimmed_str = rtrim(ltrim(str));
-            //printf("%s: input :L1: line %s\n", time_str_buf, trimmed_str);
+            //TRACE(KITCHEN, L1, "line %s\n", trimmed_str);
             if(strlen(trimmed_str)==0 || trimmed_str[0] == '#' || trimmed_str[0] == '!')
                 continue;
             key = rtrim(strtok(trimmed_str,"="));
@@ -118,6 +150,10 @@ bool read_properties() {
                 KITCHEN_COURIER_DISPATCH_INTERVAL_MIN = atoi(value);
             } else if(strcmp(key, "kitchen.courier.dispatch.interval.max") == 0) {
                 KITCHEN_COURIER_DISPATCH_INTERVAL_MAX = atoi(value);
+            } else if(strcmp(key, "kitchen.threads") == 0) {
+                KITCHEN_THREADS = atoi(value);
+            } else if(strcmp(key, "courier.threads") == 0) {
+                COURIER_THREADS = atoi(value);
             } 
             
               else if(strcmp(key, "shelf.monitor.interval") == 0) {
@@ -126,24 +162,52 @@ bool read_properties() {
                 SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF = atoi(value);
             } else if(strcmp(key, "shelflife.modifier.overflow.temp.shelf") == 0) {
                 SHELF_LIFE_MODIFIER_OVERFLOW_SHELF = atoi(value);
+            } else if(strcmp(key, "shelf.overflow.eviction") == 0) {
+                SHELF_OVERFLOW_EVICTION = (strcmp(value,"drop_new")==0) ? 
+                                            OVERFLOW_EVICT_DROP_NEW : OVERFLOW_EVICT_NEAREST_EXPIRY;
+            } else if(strcmp(key, "shelf.layout") == 0) {
+                SHELF_LAYOUT_TYPE = (strcmp(value,"soa")==0) ? SHELF_LAYOUT_SOA : SHELF_LAYOUT_AOS;
+            } else if(strcmp(key, "shelf.concurrency") == 0) {
+                SHELF_CONCURRENCY_TYPE = (strcmp(value,"lockfree")==0) ? 
+                                            SHELF_CONCURRENCY_LOCKFREE : SHELF_CONCURRENCY_LOCKED;
+            } else if(strcmp(key, "shelf.placement") == 0) {
+                SHELF_PLACEMENT_POLICY = (strcmp(value,"lowest_value")==0) ? PLACEMENT_LOWEST_VALUE : 
+                                            ((strcmp(value,"lookahead")==0) ? PLACEMENT_LOOKAHEAD : PLACEMENT_GREEDY);
             } else if (strcmp(key, "system.debug.level") == 0) {                
-                SYSTEM_DEBUG_LEVEL = (strcmp(value,"NONE")==0) ? NONE : 
-                                        ((strcmp(value,"L4")==0) ? L4 :
-                                            ((strcmp(value,"L3")==0) ? (L4 | L3) :
-                                                ((strcmp(value,"L2")==0) ? (L4 | L3 | L2) :
-                                                    ((strcmp(value,"L1")==0) ? (L4 | L3 | L2 | L1) : NONE))));
+                debug_levels = debug_levels_from_str(value);
+            } else if (strncmp(key, "system.debug.level.", 19) == 0 && 
+                        (sub = trace_subsystem_from_str(key + 19)) != MAX_TRACE_SUBSYSTEM) {
+                subsystem_levels[sub] = debug_levels_from_str(value);
             } else if (strcmp(key, "system.orders.file.name") == 0) {
                 SYSTEM_ORDERS_INPUT_FILE = malloc(strlen(value)+1);
                 strcpy(SYSTEM_ORDERS_INPUT_FILE, value);
+            } else if (strcmp(key, "system.orders.file.reader") == 0) {
+                SYSTEM_ORDERS_READER = (strcmp(value,"stdio")==0) ? ORDER_READER_STDIO : 
+                                        ((strcmp(value,"packed")==0) ? ORDER_READER_PACKED : ORDER_READER_MMAP);
             } else if(strcmp(key, "system.print.shelf.contents") == 0) {
                 SYSTEM_PRINT_SHELF_CONTENTS = (strcmp(value,"true")==0) ? true : false;
+            } else if(strcmp(key, "system.print.ring.size") == 0) {
+                SYSTEM_PRINT_RING_SIZE = atoi(value);
+            } else if(strcmp(key, "system.print.mode") == 0) {
+                SYSTEM_PRINT_MODE = (strcmp(value,"delta")==0) ? PRINT_MODE_DELTA : PRINT_MODE_FULL;
+            } else if(strcmp(key, "system.print.snapshot.interval") == 0) {
+                SYSTEM_PRINT_SNAPSHOT_INTERVAL = atoi(value);
+            } else if(strcmp(key, "system.stats.interval") == 0) {
+                SYSTEM_STATS_INTERVAL = atoi(value);
             } else {
                 //unknown property
-                printf("%s: input :L1: unknown property key %s value %s\n", time_str_buf, key, value);
+                printf("%s: input :L1: unknown property key %s value %s\n", clock_log_time(time_str_buf), key, value);
             }
         }
         fclose(f);
         
+        //"system.debug.level.<subsystem>" wins over "system.debug.level"
+        SYSTEM_DEBUG_LEVEL = NONE;
+        for(sub = TRACE_KITCHEN; sub < MAX_TRACE_SUBSYSTEM; sub++) {
+            SYSTEM_DEBUG_LEVEL |= ((subsystem_levels[sub] >= 0) ? subsystem_levels[sub] : debug_levels) 
+                                        << (TRACE_LEVEL_BITS * sub);
+        }
+        
         //TODO: Add validation for values set via properties file; also to set default values
         //for properties that were NOT set via the properties file.
         //Set the return value based on the validation
@@ -152,39 +216,55 @@ bool read_properties() {
     return success;
 }
 
-/**PROC+**********************************************************************/
-/* Name:      file_read_orders                                               */
-/*                                                                           */
-/* Purpose:   To read "orders.json" file and ingest orders                   */
-/*                                                                           */
-/* Params:    IN     f               - Pointer to orders input file          */
-/*            IN     ingestion_rate  - Count of orders to be ingested in     */
-/*                                                                           */
-/* Returns:   bool - for EOF (true) or otherwise (false).                    */
-/*                                                                           */
-/*                                                                           */
-/* Operation: The function works strictly uses the schema of sample file     */
-/* "oders.json"; once read, it creates an ORDER instance in heap memory      */
-/* and stores in a LL (linked list) to be consumed by the "kitchen" thread   */
-/* "kitchen" is the caller.                                                  */
-/* In theory                                                                 */
-/*                                                                           */
-/**PROC-**********************************************************************/
-bool file_read_orders(FILE *f, int ingestion_rate) {
-    bool is_eof = false;
-    int read_count = 0, i;
+//Not a 'public' function; only internal to this file.
+//Appends a freshly read order at the end of the global orders LL
+void input_append_order(ORDER *order) {
+    
+    ORDER_LL_NODE *node = pool_alloc(&g_order_node_pool);
+    TRACE(KITCHEN, L1, "ORDER_LL_NODE ptr %p\n", node);
+    node->data = order;
+    node->next = NULL;
+    //the order is "taken" when the kitchen gets it, however early it was parsed
+    order->created = clock_now_msec();
+
+    //O(1); the tail is always the last node of the LL
+    if(g_data->g_order_ll_tail == NULL) {
+        g_data->g_order_ll_head = node;
+    } else {
+        g_data->g_order_ll_tail->next = node;
+    }
+    g_data->g_order_ll_tail = node;
+}
+
+//Frees the LL nodes of the orders ingested this tick (the orders themselves
+//are owned by the shelves by now, or were discarded) and empties the LL, so
+//it never holds more than one ingestion's worth of nodes
+void input_release_orders() {
+    ORDER_LL_NODE *node = g_data->g_order_ll_head, *next;
+    
+    while(node) {
+        next = node->next;
+        pool_free(&g_order_node_pool, node);
+        node = next;
+    }
+    g_data->g_order_ll_head = NULL;
+    g_data->g_order_ll_tail = NULL;
+}
+
+//Not a 'public' function; only internal to this file.
+//Reads the next order of the stdio reader; false on EOF. Strictly the
+//layout of the sample file (see file_read_orders)
+static bool stdio_next_order(FILE *f, ORDER **pOrder) {
+    int i;
     char str[64]; //TODO: Assuming 64 as the max length of char in orders file; revisit
     char *trimmed_str;
-    ORDER *order;
-    char time_str_buf[64];  
+    ORDER *order = NULL;
     
-    current_time_msec(time_str_buf);
-    while(read_count < ingestion_rate)
+    while(1)
     {
         char *s = fgets(str, 64, f);
         if(!s) {
-            is_eof = true;
-            break;
+            return false;
         }
         
         trimmed_str = rtrim(ltrim(str));
@@ -192,15 +272,13 @@ bool file_read_orders(FILE *f, int ingestion_rate) {
         if(strcmp(trimmed_str, "[") == 0) {
             continue;
         } else if (strcmp(trimmed_str, "]") == 0) {
-            is_eof = true;
-            break; //EOF
+            return false; //EOF
         } else if(strcmp(trimmed_str, "{") == 0) {
             //start of a record
             char *token, *token2, *token3;
 
-            order = malloc(sizeof(ORDER));
-            ftime(&order->creationTime);
-            if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: input   : L1: MALLOC order ptr %p\n", time_str_buf, order);
+            order = order_alloc();
+            TRACE(KITCHEN, L1, "MALLOC order ptr %p\n", order);
             for(i = 0; i < 5; i++) {
                 fgets(str, 64, f);
                 trimmed_str = rtrim(ltrim(str));
@@ -209,13 +287,15 @@ bool file_read_orders(FILE *f, int ingestion_rate) {
                 token3 = strtok(NULL, "\"");
                 
                 if(strcmp(token, "id") == 0) {
-                    order->id = malloc(sizeof(char) * (strlen(token3)+1));
-                    if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: input   : L1: MALLOC order id ptr %p\n", time_str_buf, order->id);            
-                    strcpy(order->id, token3);
+                    order->id = arena_strdup(&g_string_arena, token3);
+                    order->id_copied = true;
+                    order->id_len = strlen(token3);
+                    TRACE(KITCHEN, L1, "MALLOC order id ptr %p\n", order->id);
                 } else if(strcmp(token, "name") == 0) {
-                    order->name = malloc(sizeof(char) * (strlen(token3)+1));
-                    if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: input   : L1: MALLOC order name ptr %p\n", time_str_buf, order->name);            
-                    strcpy(order->name, token3);
+                    order->name = arena_strdup(&g_string_arena, token3);
+                    order->name_copied = true;
+                    order->name_len = strlen(token3);
+                    TRACE(KITCHEN, L1, "MALLOC order name ptr %p\n", order->name);
                 } else if (strcmp(token, "temp") == 0) {
                     if(strcmp(token3, "hot") == 0) {
                         order->temp = HOT;
@@ -234,39 +314,759 @@ bool file_read_orders(FILE *f, int ingestion_rate) {
         } else if(trimmed_str[0] == '}') {
             //end of record
             //printf("End of record\n");
-            read_count ++;
-            ORDER_LL_NODE *node = malloc(sizeof(ORDER_LL_NODE));
-            if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: input   : L1: ORDER_LL_NODE ptr %p\n", time_str_buf, node);
-            node->data = order;
-            node->next = NULL;
-
-            if(g_data->g_order_ll_head == NULL) {
-                g_data->g_order_ll_head = node;
-                g_data->g_order_ll_tail = node;
-            } else {
-                ORDER_LL_NODE *ll_iter = g_data->g_order_ll_head, *prev = NULL;
-                while(ll_iter) {
-                    prev = ll_iter;
-                    ll_iter = ll_iter->next;
-                }
-                prev->next = node;
-                g_data->g_order_ll_tail = node;
-            }
+            if(order->id) order_key_from_id(order->id, order->id_len, &order->key);
+            *pOrder = order;
+            return true;
         }       
     }
+}
+
+/**PROC+**********************************************************************/
+/* Name:      file_read_orders                                               */
+/*                                                                           */
+/* Purpose:   To read "orders.json" file and ingest orders                   */
+/*                                                                           */
+/* Params:    IN     f               - Pointer to orders input file          */
+/*            IN     ingestion_rate  - Count of orders to be ingested in     */
+/*                                                                           */
+/* Returns:   bool - for EOF (true) or otherwise (false).                    */
+/*                                                                           */
+/*                                                                           */
+/* Operation: The function works strictly uses the schema of sample file     */
+/* "oders.json"; once read, it creates an ORDER instance in heap memory      */
+/* and stores in a LL (linked list) to be consumed by the "kitchen" thread   */
+/* "kitchen" is the caller.                                                  */
+/* In theory                                                                 */
+/*                                                                           */
+/**PROC-**********************************************************************/
+bool file_read_orders(FILE *f, int ingestion_rate) {
+    int read_count = 0;
+    ORDER *order;
+    
+    while(read_count < ingestion_rate)
+    {
+        if(!stdio_next_order(f, &order)) {
+            return true;
+        }
+        read_count ++;
+        input_append_order(order);
+    }
             
-    return is_eof;
+    return false;
+}
+
+//Allocates a zeroed ORDER out of the per-run order pool; its strings are
+//either copied into the string arena (stdio, escaped JSON strings) or
+//point into a mapping
+ORDER *order_alloc() {
+    return pool_alloc(&g_order_pool);
+}
+
+//The one place an order's memory is given back: its copied strings to the
+//arena and the ORDER to its pool. Whoever held the order on a shelf unlinks
+//it first (see shelf_release_order)
+void order_release(ORDER *order) {
+    if(order == NULL) return;
+    
+    if(order->id_copied) arena_free(order->id);
+    if(order->name_copied) arena_free(order->name);
+    pool_free(&g_order_pool, order);
+}
+
+//A JSON string as it is in the mapping: its body (between the quotes),
+//escapes not yet decoded
+typedef struct json_token_t {
+    const char *p;
+    size_t len;
+    bool escaped;       //holds a backslash escape
+} JSON_TOKEN;
+
+//Longest escaped key or enum value json_token_is() decodes to compare
+#define JSON_TOKEN_CMP_MAX  64
+
+//Not a 'public' function; only internal to this file.
+static const char *json_skip_ws(const char *p, const char *end) {
+    while(p < end && isspace((unsigned char)*p)) p++;
+    return p;
+}
+
+//Not a 'public' function; only internal to this file.
+static int json_hex_digit(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      json_unescape_string                                           */
+/*                                                                           */
+/* Purpose:   Decodes the escapes of a JSON string body                      */
+/*                                                                           */
+/* Params:    IN/OUT str     - Copy of the body (between the quotes); NUL    */
+/*                             terminated on return                          */
+/*            IN     len     - Its length                                    */
+/*                                                                           */
+/* Returns:   bool - false if an escape is malformed.                        */
+/*                                                                           */
+/* Operation: Escapes are decoded over the copy itself (the result is never  */
+/*            longer than its source); the mapping is never written.         */
+/*                                                                           */
+/**PROC-**********************************************************************/
+static bool json_unescape_string(char *str, size_t len) {
+    char *p = str, *end = str + len, *w = str;
+    unsigned int cp;
+    int i, h;
+
+    while(p < end) {
+        if(*p != '\\') {
+            *w++ = *p++;
+            continue;
+        }
+        if(++p >= end) return false;
+        switch(*p) {
+            case '"': case '\\': case '/': *w++ = *p; break;
+            case 'b': *w++ = '\b'; break;
+            case 'f': *w++ = '\f'; break;
+            case 'n': *w++ = '\n'; break;
+            case 'r': *w++ = '\r'; break;
+            case 't': *w++ = '\t'; break;
+            case 'u':
+                if(end - p < 5) return false;
+                for(cp = 0, i = 1; i <= 4; i++) {
+                    if((h = json_hex_digit(p[i])) < 0) return false;
+                    cp = (cp << 4) | h;
+                }
+                p += 4;
+                //UTF-8 encode; surrogate pairs are kept as two 3 byte units
+                if(cp < 0x80) {
+                    *w++ = (char)cp;
+                } else if(cp < 0x800) {
+                    *w++ = (char)(0xC0 | (cp >> 6));
+                    *w++ = (char)(0x80 | (cp & 0x3F));
+                } else {
+                    *w++ = (char)(0xE0 | (cp >> 12));
+                    *w++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    *w++ = (char)(0x80 | (cp & 0x3F));
+                }
+                break;
+            default:
+                return false;
+        }
+        p++;
+    }
+    *w = '\0';
+    return true;
 }
 
-//TODO: unify all order free logic here
-void free_order(ORDER **pOrder) {
-    ORDER *order = (pOrder != NULL) ? *pOrder : NULL;
-    if(order) {
-        free(order->id);
-        free(order->name);
+//Not a 'public' function; only internal to this file.
+//Returns the first structural character at or after "p" (end of the mapping
+//if there is none). The index is built a block at a time as the cursor
+//moves forward; the tokenizer never moves backwards.
+static const char *json_next_structural(ORDER_READER *reader, const char *p) {
+    const char *end = reader->limit;
+    size_t len;
+    
+    while(p < end) {
+        if(p < reader->index_base || p >= reader->index_limit) {
+            len = end - p;
+            if(len > JSON_INDEX_BLOCK) len = JSON_INDEX_BLOCK;
+            reader->index_base = p;
+            reader->index_limit = p + len;
+            reader->index_count = json_index_block(p, len, reader->index);
+            reader->index_next = 0;
+        }
+        while(reader->index_next < reader->index_count &&
+                reader->index_base + reader->index[reader->index_next] < p) {
+            reader->index_next++;
+        }
+        if(reader->index_next < reader->index_count) {
+            return reader->index_base + reader->index[reader->index_next];
+        }
+        p = reader->index_limit;
+    }
+    return end;
+}
+
+//Not a 'public' function; only internal to this file.
+//Delimits a JSON string: hops to the closing quote through the structural
+//index (a backslash skips the character it escapes). Nothing is copied or
+//written; see json_token_string() and json_token_is().
+static const char *json_parse_string(ORDER_READER *reader, const char *p, JSON_TOKEN *tok) {
+    const char *end = reader->limit, *q;
+    
+    if(p >= end || *p != '"') return NULL;
+    tok->p = p + 1;
+    tok->escaped = false;
+    for(q = json_next_structural(reader, p + 1); q < end; q = json_next_structural(reader, q + 1)) {
+        if(*q == '"') {
+            tok->len = q - tok->p;
+            return q + 1;
+        }
+        if(*q == '\\') {
+            tok->escaped = true;
+            if(++q >= end) return NULL;
+        }
+    }
+    return NULL;
+}
+
+//Not a 'public' function; only internal to this file.
+//Whether a string token is "str" (escapes decoded, for tokens short enough
+//to be a key or an enum value)
+static bool json_token_is(const JSON_TOKEN *tok, const char *str) {
+    char buf[JSON_TOKEN_CMP_MAX];
+    
+    if(!tok->escaped) return tok->len == strlen(str) && memcmp(tok->p, str, tok->len) == 0;
+    if(tok->len >= sizeof(buf)) return false;
+    memcpy(buf, tok->p, tok->len);
+    return json_unescape_string(buf, tok->len) && strcmp(buf, str) == 0;
+}
+
+//Not a 'public' function; only internal to this file.
+//Sets an order string (id or name) from a string token, dropping what it
+//held before: a token with no escapes is used where it is in the mapping
+//(not NUL terminated; *len says how long), one with escapes is decoded into
+//a copy in the string arena (freed by order_release). False if out of
+//memory or an escape is malformed.
+static bool json_token_string(const JSON_TOKEN *tok, char **str, uint32_t *len, bool *copied) {
+    char *copy = NULL;
+    
+    if(tok->escaped) {
+        if((copy = arena_strndup(&g_string_arena, tok->p, tok->len)) == NULL) return false;
+        if(!json_unescape_string(copy, tok->len)) {
+            arena_free(copy);
+            return false;
+        }
+    }
+    if(*copied) arena_free(*str);
+    *copied = (copy != NULL);
+    *str = copy ? copy : (char *)tok->p;
+    *len = copy ? strlen(copy) : tok->len;
+    return true;
+}
+
+//Not a 'public' function; only internal to this file.
+//Parses a JSON number without reading past "end" (the mapping is not NUL
+//terminated, so strtod() cannot be used on it)
+static const char *json_parse_number(const char *p, const char *end, double *out) {
+    double value = 0.0, scale = 1.0;
+    int exp = 0, exp_sign = 1;
+    bool negative = false, digits = false;
+
+    if(p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+    while(p < end && isdigit((unsigned char)*p)) {
+        value = value * 10 + (*p++ - '0');
+        digits = true;
+    }
+    if(p < end && *p == '.') {
+        p++;
+        while(p < end && isdigit((unsigned char)*p)) {
+            scale /= 10;
+            value += (*p++ - '0') * scale;
+            digits = true;
+        }
+    }
+    if(!digits) return NULL;
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if(p < end && (*p == '-' || *p == '+')) exp_sign = (*p++ == '-') ? -1 : 1;
+        while(p < end && isdigit((unsigned char)*p)) exp = exp * 10 + (*p++ - '0');
+        while(exp-- > 0) value = (exp_sign > 0) ? value * 10 : value / 10;
+    }
+    *out = negative ? -value : value;
+    return p;
+}
+
+//Not a 'public' function; only internal to this file.
+//Skips any JSON value (used for keys an order does not know about)
+static const char *json_skip_value(ORDER_READER *reader, const char *p) {
+    const char *end = reader->limit;
+    JSON_TOKEN str;
+    double num;
+    int depth = 0;
+
+    p = json_skip_ws(p, end);
+    if(p >= end) return NULL;
+    if(*p == '"') return json_parse_string(reader, p, &str);
+    if(*p != '{' && *p != '[') {
+        if(*p == '-' || isdigit((unsigned char)*p)) return json_parse_number(p, end, &num);
+        //true/false/null
+        while(p < end && isalpha((unsigned char)*p)) p++;
+        return p;
+    }
+    //only brackets and strings matter inside a nested value
+    do {
+        if(*p == '"') {
+            if((p = json_parse_string(reader, p, &str)) == NULL) return NULL;
+        } else {
+            if(*p == '{' || *p == '[') depth++;
+            else if(*p == '}' || *p == ']') depth--;
+            p++;
+        }
+        if(depth > 0) p = json_next_structural(reader, p);
+    } while(depth > 0 && p < end);
+    return (depth == 0) ? p : NULL;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      json_parse_order                                               */
+/*                                                                           */
+/* Purpose:   Builds an ORDER out of one JSON object of the orders file      */
+/*                                                                           */
+/* Params:    IN     reader  - Reader over the mapping                       */
+/*            IN     p       - Points at the opening brace                   */
+/*            OUT    pOrder  - The order (id/name views into the mapping)    */
+/*                                                                           */
+/* Returns:   Position right after the closing brace; NULL if malformed.     */
+/*                                                                           */
+/* Operation: Keys may come in any order and with any formatting; unknown    */
+/*            keys are skipped. Strings are delimited through the reader's   */
+/*            structural index rather than scanned a byte at a time. id and  */
+/*            name stay where they are in the (read only) mapping; only a    */
+/*            string with escapes is decoded into a copy.                    */
+/*                                                                           */
+/**PROC-**********************************************************************/
+static const char *json_parse_order(ORDER_READER *reader, const char *p, ORDER **pOrder) {
+    const char *end = reader->limit;
+    ORDER *order;
+    JSON_TOKEN key, str;
+    double num;
+
+    order = order_alloc();
+    if(order == NULL) return NULL;
+    
+    p = json_skip_ws(p + 1, end);
+    while(p && p < end && *p != '}') {
+        if((p = json_parse_string(reader, p, &key)) == NULL) break;
+        p = json_skip_ws(p, end);
+        if(p >= end || *p != ':') { p = NULL; break; }
+        p = json_skip_ws(p + 1, end);
+        
+        if(json_token_is(&key, "id")) {
+            if((p = json_parse_string(reader, p, &str)) != NULL &&
+                            !json_token_string(&str, &order->id, &order->id_len, &order->id_copied)) {
+                p = NULL;
+            }
+        } else if(json_token_is(&key, "name")) {
+            if((p = json_parse_string(reader, p, &str)) != NULL &&
+                            !json_token_string(&str, &order->name, &order->name_len, &order->name_copied)) {
+                p = NULL;
+            }
+        } else if(json_token_is(&key, "temp")) {
+            if((p = json_parse_string(reader, p, &str)) != NULL) {
+                order->temp = json_token_is(&str, "hot") ? HOT : 
+                                (json_token_is(&str, "cold") ? COLD : 
+                                    (json_token_is(&str, "frozen") ? FROZEN : MAX_TEMP));
+            }
+        } else if(json_token_is(&key, "shelfLife")) {
+            if((p = json_parse_number(p, end, &num)) != NULL) order->shelfLife = (int)num;
+        } else if(json_token_is(&key, "decayRate")) {
+            if((p = json_parse_number(p, end, &num)) != NULL) order->decayRate = (float)num;
+        } else {
+            p = json_skip_value(reader, p);
+        }
+        if(p == NULL) break;
         
-        free(order);
-        *pOrder = NULL;
-    }   
+        p = json_skip_ws(p, end);
+        if(p < end && *p == ',') p = json_skip_ws(p + 1, end);
+    }
+    
+    if(p == NULL || p >= end || order->id == NULL || order->name == NULL) {
+        order_release(order);
+        return NULL;
+    }
+    order_key_from_id(order->id, order->id_len, &order->key);
+    *pOrder = order;
+    return p + 1;
+}
+
+//Not a 'public' function; only internal to this file.
+//Parses the next order object of a JSON reader; false at the end of its
+//range, or on a malformed order (reader->malformed is then set)
+static bool mmap_next_order(ORDER_READER *reader, ORDER **pOrder) {
+    const char *p = reader->cursor, *end = reader->limit;
+    
+    p = json_skip_ws(p, end);
+    if(p < end && *p == ',') p = json_skip_ws(p + 1, end);
+    if(p >= end || *p == ']') {
+        reader->cursor = end;
+        return false;
+    }
+    if(*p != '{' || (p = json_parse_order(reader, p, pOrder)) == NULL) {
+        TRACE(KITCHEN, L4, "malformed order at offset %ld; stopping ingestion\n",
+                    (long)(reader->cursor - reader->map));
+        reader->malformed = true;
+        reader->cursor = end;
+        return false;
+    }
+    reader->cursor = p;
+    return true;
+}
+
+//Not a 'public' function; only internal to this file.
+//Builds the next order of a packed reader from its row of the column
+//arrays: no parsing; the name points into the dictionary of the mapping and
+//only the binary id is formatted (into the order itself)
+static bool packed_next_order(ORDER_READER *reader, ORDER **pOrder) {
+    const PACK_HEADER *pack = reader->pack;
+    const uint8_t *ids = (const uint8_t *)reader->map + pack->ids_offset;
+    const uint32_t *name_index = (const uint32_t *)(reader->map + pack->name_index_offset);
+    const uint8_t *temp = (const uint8_t *)reader->map + pack->temp_offset;
+    const int32_t *shelf_life = (const int32_t *)(reader->map + pack->shelf_life_offset);
+    const float *decay_rate = (const float *)(reader->map + pack->decay_rate_offset);
+    const uint32_t *name_offsets = (const uint32_t *)(reader->map + pack->name_offsets_offset);
+    const char *names = reader->map + pack->names_offset;
+    uint32_t row;
+    ORDER *order;
+    
+    if(reader->pack_next >= reader->pack_end) return false;
+    if((order = order_alloc()) == NULL) return false;
+    row = reader->pack_next++;
+    
+    pack_uuid_format(ids + (size_t)row * PACK_UUID_LEN, order->id_buf);
+    order->id = order->id_buf;
+    order->id_len = PACK_UUID_STR_LEN;
+    order_key_from_uuid(ids + (size_t)row * PACK_UUID_LEN, &order->key);
+    order->name = (char *)names + name_offsets[name_index[row]];
+    order->name_len = strlen(order->name); //NUL terminated in the blob (pack_validate)
+    order->temp = (temp[row] < MAX_TEMP) ? (TEMP)temp[row] : MAX_TEMP;
+    order->shelfLife = shelf_life[row];
+    order->decayRate = decay_rate[row];
+    *pOrder = order;
+    return true;
 }
 
+//Next order of a reader, or of one of its partitions (see
+//order_reader_split); false once its range is exhausted. Safe to call
+//concurrently on different partitions.
+bool order_reader_next(ORDER_READER *reader, ORDER **pOrder) {
+    switch(reader->type) {
+    case ORDER_READER_STDIO:
+        return stdio_next_order(reader->f, pOrder);
+    case ORDER_READER_MMAP:
+        return mmap_next_order(reader, pOrder);
+    case ORDER_READER_PACKED:
+        return packed_next_order(reader, pOrder);
+    default:
+        return false;
+    }
+}
+
+/**PROC+**********************************************************************/
+/* Name:      mapped_read_orders                                             */
+/*                                                                           */
+/* Purpose:   To ingest orders from the mmap'd (JSON or packed) orders file  */
+/*                                                                           */
+/* Params:    IN     reader          - Reader positioned after the last      */
+/*                                     ingested order                        */
+/*            IN     ingestion_rate  - Count of orders to be ingested        */
+/*                                                                           */
+/* Returns:   bool - for EOF (true) or otherwise (false).                    */
+/*                                                                           */
+/*                                                                           */
+/* Operation: Single pass over the orders; any JSON formatting is accepted.  */
+/* The orders are appended to the global LL like file_read_orders() does.    */
+/* A malformed file is treated as EOF.                                       */
+/*                                                                           */
+/**PROC-**********************************************************************/
+static bool mapped_read_orders(ORDER_READER *reader, int ingestion_rate) {
+    int read_count = 0;
+    ORDER *order;
+    
+    while(read_count < ingestion_rate) {
+        if(!order_reader_next(reader, &order)) return true;
+        read_count++;
+        input_append_order(order);
+    }
+    
+    return false;
+}
+
+//Not a 'public' function; only internal to this file.
+//Maps the whole orders file read only; false on failure (or an empty file)
+static bool order_reader_map(ORDER_READER *reader, const char *file_name) {
+    struct stat st;
+    int fd;
+    
+    fd = open(file_name, O_RDONLY);
+    if(fd == -1 || fstat(fd, &st) == -1) {
+        if(fd != -1) close(fd);
+        return false;
+    }
+    reader->map_len = st.st_size;
+    if(reader->map_len > 0) {
+        reader->map = mmap(NULL, reader->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if(reader->map == MAP_FAILED || reader->map == NULL) {
+        reader->map = NULL;
+        return false;
+    }
+    madvise((void *)reader->map, reader->map_len, MADV_SEQUENTIAL);
+    return true;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      order_reader_open                                              */
+/*                                                                           */
+/* Purpose:   Opens the orders input file with the requested backend         */
+/*                                                                           */
+/* Params:    IN     file_name  - Orders input file                          */
+/*            IN     type       - Backend (see ORDER_READER_TYPE)            */
+/*                                                                           */
+/* Returns:   The reader; NULL on failure.                                   */
+/*                                                                           */
+/* Operation: Both mapped backends map the file read only, so its pages stay */
+/*            shared with the page cache; the JSON tokenizer never writes to */
+/*            them. ORDER_READER_PACKED also validates the header.           */
+/*                                                                           */
+/**PROC-**********************************************************************/
+ORDER_READER *order_reader_open(const char *file_name, ORDER_READER_TYPE type) {
+    ORDER_READER *reader = calloc(1, sizeof(ORDER_READER));
+    const char *p, *end;
+    
+    if(reader == NULL) return NULL;
+    reader->type = type;
+    
+    if(type == ORDER_READER_STDIO) {
+        reader->f = fopen(file_name, "r");
+        if(reader->f == NULL) {
+            free(reader);
+            return NULL;
+        }
+        return reader;
+    }
+    
+    if(type == ORDER_READER_PACKED) {
+        if(!order_reader_map(reader, file_name) || !pack_validate(reader->map, reader->map_len)) {
+            order_reader_close(reader);
+            return NULL;
+        }
+        reader->pack = (const PACK_HEADER *)reader->map;
+        reader->pack_end = reader->pack->order_count;
+        return reader;
+    }
+    
+    reader->index = malloc(JSON_INDEX_BLOCK * sizeof(uint32_t));
+    if(reader->index == NULL || !order_reader_map(reader, file_name)) {
+        order_reader_close(reader);
+        return NULL;
+    }
+    
+    //orders are an array; position on its first element
+    p = reader->map;
+    end = reader->limit = reader->map + reader->map_len;
+    p = json_skip_ws(p, end);
+    reader->cursor = (p < end && *p == '[') ? p + 1 : end;
+    
+    return reader;
+}
+
+//Not a 'public' function; only internal to this file.
+//A reader over part of another one's mapping (see order_reader_split)
+static ORDER_READER *order_reader_share(ORDER_READER *reader) {
+    ORDER_READER *part = calloc(1, sizeof(ORDER_READER));
+    
+    if(part == NULL) return NULL;
+    part->type = reader->type;
+    part->shared = true;
+    part->map = reader->map;
+    part->map_len = reader->map_len;
+    part->pack = reader->pack;
+    if(reader->type == ORDER_READER_MMAP) {
+        part->index = malloc(JSON_INDEX_BLOCK * sizeof(uint32_t));
+        if(part->index == NULL) {
+            free(part);
+            return NULL;
+        }
+    }
+    return part;
+}
+
+//Not a 'public' function; only internal to this file.
+//A quote is escaped if an odd run of backslashes precedes it
+static bool json_quote_escaped(const char *map, const char *q) {
+    const char *b = q;
+    
+    while(b > map && b[-1] == '\\') b--;
+    return ((q - b) & 1) != 0;
+}
+
+//Split pre-pass result for one chunk of the array, for the chunk being
+//entered outside (0) or inside (1) a string
+typedef struct json_chunk_scan_t {
+    ORDER_READER *reader;   //partition reader; its limit is the chunk end
+    const char *start;
+    int end_in_string[2];
+    int depth_delta[2];     //bracket depth change outside strings
+} JSON_CHUNK_SCAN;
+
+//Not a 'public' function; only internal to this file.
+//Thread body of the split pre-pass: walks the structural characters of a
+//chunk once, tracking both possible string states at the chunk start
+static void *json_scan_chunk(void *arg) {
+    JSON_CHUNK_SCAN *scan = (JSON_CHUNK_SCAN *)arg;
+    ORDER_READER *reader = scan->reader;
+    const char *q;
+    int s;
+    
+    scan->end_in_string[0] = 0;
+    scan->end_in_string[1] = 1;
+    scan->depth_delta[0] = scan->depth_delta[1] = 0;
+    for(q = json_next_structural(reader, scan->start); q < reader->limit; 
+            q = json_next_structural(reader, q + 1)) {
+        for(s = 0; s < 2; s++) {
+            if(*q == '"') {
+                if(!json_quote_escaped(reader->map, q)) scan->end_in_string[s] ^= 1;
+            } else if(!scan->end_in_string[s]) {
+                if(*q == '{' || *q == '[') scan->depth_delta[s]++;
+                else if(*q == '}' || *q == ']') scan->depth_delta[s]--;
+            }
+        }
+    }
+    return NULL;
+}
+
+//Not a 'public' function; only internal to this file.
+//First order object (a '{' directly inside the top level array) at or
+//after "p", given the string state and bracket depth at "p"
+static const char *json_find_order(ORDER_READER *reader, const char *p, int in_string, int depth) {
+    const char *q;
+    
+    for(q = json_next_structural(reader, p); q < reader->limit; q = json_next_structural(reader, q + 1)) {
+        if(*q == '"') {
+            if(!json_quote_escaped(reader->map, q)) in_string ^= 1;
+        } else if(!in_string) {
+            if(*q == '{' && depth == 1) return q;
+            if(*q == '{' || *q == '[') depth++;
+            else if(*q == '}' || *q == ']') depth--;
+        }
+    }
+    return reader->limit;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      order_reader_split                                             */
+/*                                                                           */
+/* Purpose:   Splits the unread part of a mapped reader into partitions that */
+/*            can be parsed concurrently                                     */
+/*                                                                           */
+/* Params:    IN     reader  - mmap or packed reader; consumed by the split  */
+/*            IN     parts   - Count of partitions                           */
+/*                                                                           */
+/* Returns:   Array of "parts" readers, in file order (close each one, then  */
+/*            free the array); NULL on failure or for ORDER_READER_STDIO.    */
+/*                                                                           */
+/* Operation: Packed files are split by rows. JSON is cut into equal byte    */
+/*            chunks and every cut moved to the next order object: a pre-    */
+/*            pass (one thread per chunk) works out, for either string state */
+/*            at its start, each chunk's string state and bracket depth at   */
+/*            its end; chaining those from the array start gives the exact   */
+/*            state at every cut, so a brace inside a name is never taken    */
+/*            for a record. Partitions share the parent's mapping, which     */
+/*            must stay open while they are in use.                          */
+/*                                                                           */
+/**PROC-**********************************************************************/
+ORDER_READER **order_reader_split(ORDER_READER *reader, int parts) {
+    ORDER_READER **part = calloc(parts, sizeof(ORDER_READER *));
+    JSON_CHUNK_SCAN *scan = NULL;
+    pthread_t *scan_thread = NULL;
+    const char *body, *cut;
+    size_t body_len;
+    uint32_t rows;
+    int k, in_string, depth;
+    
+    if(part == NULL || reader->type == ORDER_READER_STDIO || parts < 1) {
+        free(part);
+        return NULL;
+    }
+    for(k = 0; k < parts; k++) {
+        if((part[k] = order_reader_share(reader)) == NULL) goto fail;
+    }
+    
+    if(reader->type == ORDER_READER_PACKED) {
+        rows = reader->pack_end - reader->pack_next;
+        for(k = 0; k < parts; k++) {
+            part[k]->pack_next = reader->pack_next + (uint32_t)((uint64_t)rows * k / parts);
+            part[k]->pack_end = reader->pack_next + (uint32_t)((uint64_t)rows * (k + 1) / parts);
+        }
+        reader->pack_next = reader->pack_end;
+        return part;
+    }
+    
+    body = reader->cursor;
+    body_len = reader->limit - body;
+    scan = calloc(parts, sizeof(JSON_CHUNK_SCAN));
+    scan_thread = calloc(parts, sizeof(pthread_t));
+    if(scan == NULL || scan_thread == NULL) goto fail;
+    
+    //pre-pass; the last chunk's result is not needed
+    for(k = 0; k < parts - 1; k++) {
+        scan[k].reader = part[k];
+        scan[k].start = body + body_len * k / parts;
+        part[k]->limit = body + body_len * (k + 1) / parts;
+        if(pthread_create(&scan_thread[k], NULL, json_scan_chunk, &scan[k]) != 0) {
+            json_scan_chunk(&scan[k]);
+            scan_thread[k] = 0;
+        }
+    }
+    for(k = 0; k < parts - 1; k++) {
+        if(scan_thread[k]) pthread_join(scan_thread[k], NULL);
+    }
+    
+    //chain the states (depth 1 is inside the array) and move the cuts
+    part[0]->cursor = body;
+    in_string = 0;
+    depth = 1;
+    for(k = 1; k < parts; k++) {
+        depth += scan[k - 1].depth_delta[in_string];
+        in_string = scan[k - 1].end_in_string[in_string];
+        cut = body + body_len * k / parts;
+        part[k]->limit = reader->limit;
+        part[k]->index_base = part[k]->index_limit = NULL; //scan moved past "cut"
+        part[k]->cursor = json_find_order(part[k], cut, in_string, depth);
+        if(part[k]->cursor < part[k - 1]->cursor) part[k]->cursor = part[k - 1]->cursor;
+    }
+    for(k = 0; k < parts; k++) {
+        part[k]->limit = (k + 1 < parts) ? part[k + 1]->cursor : reader->limit;
+        part[k]->index_base = part[k]->index_limit = NULL; //index rebuilt from the cursor
+    }
+    reader->cursor = reader->limit;
+    
+    free(scan);
+    free(scan_thread);
+    return part;
+
+fail:
+    for(k = 0; k < parts; k++) order_reader_close(part[k]);
+    free(part);
+    free(scan);
+    free(scan_thread);
+    return NULL;
+}
+
+//Ingests up to "ingestion_rate" orders; returns true on EOF
+bool order_reader_read(ORDER_READER *reader, int ingestion_rate) {
+    switch(reader->type) {
+    case ORDER_READER_STDIO:
+        return file_read_orders(reader->f, ingestion_rate);
+    case ORDER_READER_MMAP:
+    case ORDER_READER_PACKED:
+        return mapped_read_orders(reader, ingestion_rate);
+    default:
+        return true;
+    }
+}
+
+//Closes the input; for the mmap and packed backends this must only happen
+//once no order (whose id or name may live in the mapping) is left in the
+//system
+void order_reader_close(ORDER_READER *reader) {
+    if(reader == NULL) return;
+    
+    if(reader->f) fclose(reader->f);
+    if(reader->map && !reader->shared) munmap((void *)reader->map, reader->map_len);
+    free(reader->index);
+    free(reader);
+}
@@ -0,0 +1,50 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "pack.h"
+
+//Cursor over the orders input file; which members are used depends on the
+//backend (see ORDER_READER_TYPE)
+typedef struct order_reader_t {
+    ORDER_READER_TYPE type;
+    
+    //ORDER_READER_STDIO
+    FILE *f;
+    
+    //ORDER_READER_MMAP and ORDER_READER_PACKED
+    const char *map;    //read only mapping; never written, orders point into it
+    size_t map_len;
+    const char *cursor; //next unparsed byte
+    const char *limit;  //end of the range this reader parses
+    bool malformed;     //parsing stopped on a malformed order
+    
+    //structural index (see json_index.h) of [index_base, index_limit)
+    uint32_t *index;
+    size_t index_count;
+    size_t index_next;  //first entry not yet passed by the tokenizer
+    const char *index_base;
+    const char *index_limit;
+    
+    //ORDER_READER_PACKED
+    const PACK_HEADER *pack;
+    uint32_t pack_next; //next order (row) to ingest
+    uint32_t pack_end;  //end of the rows this reader ingests
+    
+    bool shared;        //partition of another reader; does not own the map
+} ORDER_READER;
+
+bool read_properties();
+
+ORDER_READER *order_reader_open(const char *file_name, ORDER_READER_TYPE type);
+bool order_reader_read(ORDER_READER *reader, int ingestion_rate);
+void order_reader_close(ORDER_READER *reader);
+bool order_reader_next(ORDER_READER *reader, ORDER **pOrder);
+ORDER_READER **order_reader_split(ORDER_READER *reader, int parts);
+
+bool file_read_orders(FILE *f, int ingestion_rate);
+ORDER *order_alloc();
+void order_release(ORDER *order);
+void input_append_order(ORDER *order);
+void input_release_orders();
+
+#endif //INPUT_H
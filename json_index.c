@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSON_INDEX_X86 1
+#endif
+
+#include "json_index.h"
+
+//The structural index lists the offsets of every '"', '\', '{', '}', '[',
+//']', ':' and ',' of a block. The order tokenizer (input.c) hops from one
+//structural character to the next instead of looking at every byte; it
+//tells string contents apart from structure itself by matching quotes.
+
+typedef size_t (*json_index_fn)(const char *buf, size_t len, uint32_t *positions);
+
+//Not a 'public' function; only internal to this file.
+static bool json_is_structural(unsigned char c) {
+    switch(c) {
+    case '"': case '\\': case '{': case '}': case '[': case ']': case ':': case ',':
+        return true;
+    default:
+        return false;
+    }
+}
+
+//Not a 'public' function; only internal to this file.
+//Indexes buf[from..len) a byte at a time; offsets are relative to buf
+static size_t json_index_tail(const char *buf, size_t from, size_t len, uint32_t *positions) {
+    size_t i, count = 0;
+    
+    for(i = from; i < len; i++) {
+        if(json_is_structural((unsigned char)buf[i])) positions[count++] = (uint32_t)i;
+    }
+    return count;
+}
+
+//Not a 'public' function; only internal to this file.
+static size_t json_index_scalar(const char *buf, size_t len, uint32_t *positions) {
+    return json_index_tail(buf, 0, len, positions);
+}
+
+#ifdef JSON_INDEX_X86
+//Not a 'public' function; only internal to this file.
+//16 bytes per step: one compare per structural character, OR'ed into a
+//bitmask whose set bits are the structural offsets
+static size_t json_index_sse2(const char *buf, size_t len, uint32_t *positions) {
+    const __m128i quote = _mm_set1_epi8('"'), bslash = _mm_set1_epi8('\\');
+    const __m128i lbrace = _mm_set1_epi8('{'), rbrace = _mm_set1_epi8('}');
+    const __m128i lbracket = _mm_set1_epi8('['), rbracket = _mm_set1_epi8(']');
+    const __m128i colon = _mm_set1_epi8(':'), comma = _mm_set1_epi8(',');
+    size_t i = 0, count = 0;
+    unsigned int mask;
+    __m128i chunk, hit;
+    
+    for(; i + 16 <= len; i += 16) {
+        chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+        hit = _mm_or_si128(
+                _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, bslash)),
+                             _mm_or_si128(_mm_cmpeq_epi8(chunk, lbrace), _mm_cmpeq_epi8(chunk, rbrace))),
+                _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, lbracket), _mm_cmpeq_epi8(chunk, rbracket)),
+                             _mm_or_si128(_mm_cmpeq_epi8(chunk, colon), _mm_cmpeq_epi8(chunk, comma))));
+        mask = (unsigned int)_mm_movemask_epi8(hit);
+        while(mask) {
+            positions[count++] = (uint32_t)(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    return count + json_index_tail(buf, i, len, positions + count);
+}
+
+//Not a 'public' function; only internal to this file.
+//Same as the SSE2 version, 32 bytes per step
+__attribute__((target("avx2")))
+static size_t json_index_avx2(const char *buf, size_t len, uint32_t *positions) {
+    const __m256i quote = _mm256_set1_epi8('"'), bslash = _mm256_set1_epi8('\\');
+    const __m256i lbrace = _mm256_set1_epi8('{'), rbrace = _mm256_set1_epi8('}');
+    const __m256i lbracket = _mm256_set1_epi8('['), rbracket = _mm256_set1_epi8(']');
+    const __m256i colon = _mm256_set1_epi8(':'), comma = _mm256_set1_epi8(',');
+    size_t i = 0, count = 0;
+    unsigned int mask;
+    __m256i chunk, hit;
+    
+    for(; i + 32 <= len; i += 32) {
+        chunk = _mm256_loadu_si256((const __m256i *)(buf + i));
+        hit = _mm256_or_si256(
+                _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, bslash)),
+                                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, lbrace), _mm256_cmpeq_epi8(chunk, rbrace))),
+                _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, lbracket), _mm256_cmpeq_epi8(chunk, rbracket)),
+                                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, colon), _mm256_cmpeq_epi8(chunk, comma))));
+        mask = (unsigned int)_mm256_movemask_epi8(hit);
+        while(mask) {
+            positions[count++] = (uint32_t)(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    return count + json_index_tail(buf, i, len, positions + count);
+}
+#endif
+
+static json_index_fn g_json_index_fn = NULL;
+
+//Best implementation this CPU can run
+JSON_INDEX_IMPL json_index_best_impl() {
+#ifdef JSON_INDEX_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return JSON_INDEX_AVX2;
+    if(__builtin_cpu_supports("sse2")) return JSON_INDEX_SSE2;
+#endif
+    return JSON_INDEX_SCALAR;
+}
+
+//Forces an implementation (e.g. for benchmarking); false if the CPU
+//cannot run it
+bool json_index_set_impl(JSON_INDEX_IMPL impl) {
+    if(impl > json_index_best_impl()) return false;
+    
+    switch(impl) {
+#ifdef JSON_INDEX_X86
+    case JSON_INDEX_AVX2:
+        g_json_index_fn = json_index_avx2;
+        break;
+    case JSON_INDEX_SSE2:
+        g_json_index_fn = json_index_sse2;
+        break;
+#endif
+    case JSON_INDEX_SCALAR:
+        g_json_index_fn = json_index_scalar;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      json_index_block                                               */
+/*                                                                           */
+/* Purpose:   Builds the structural index of one block of JSON text          */
+/*                                                                           */
+/* Params:    IN     buf        - Start of the block                         */
+/*            IN     len        - Block length (at most JSON_INDEX_BLOCK)    */
+/*            OUT    positions  - Offsets (into buf) of the structural       */
+/*                                characters, ascending; room for len        */
+/*                                                                           */
+/* Returns:   Number of positions written.                                   */
+/*                                                                           */
+/* Operation: Dispatches to the best SIMD implementation the CPU supports    */
+/*            (chosen on first use) or to the scalar fallback.               */
+/*                                                                           */
+/**PROC-**********************************************************************/
+size_t json_index_block(const char *buf, size_t len, uint32_t *positions) {
+    if(g_json_index_fn == NULL) json_index_set_impl(json_index_best_impl());
+    
+    return g_json_index_fn(buf, len, positions);
+}
+
+//Self explanatory util method...returns string for display
+const char *json_index_impl_to_str(JSON_INDEX_IMPL impl) {
+    switch(impl) {
+        case JSON_INDEX_SCALAR:
+            return "scalar";
+        case JSON_INDEX_SSE2:
+            return "sse2";
+        case JSON_INDEX_AVX2:
+            return "avx2";
+        default:
+            return "Undefined";
+    }
+}
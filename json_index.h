@@ -0,0 +1,25 @@
+#ifndef JSON_INDEX_H
+#define JSON_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+//Bytes indexed per call; positions are 32 bit offsets into the block
+#define JSON_INDEX_BLOCK (64 * 1024)
+
+//Structural indexer implementations; the best one the CPU supports is
+//picked at runtime
+typedef enum json_index_impl_t {
+    JSON_INDEX_SCALAR = 0,
+    JSON_INDEX_SSE2 = 1,
+    JSON_INDEX_AVX2 = 2,
+    MAX_JSON_INDEX_IMPL = 3
+} JSON_INDEX_IMPL;
+
+size_t json_index_block(const char *buf, size_t len, uint32_t *positions);
+JSON_INDEX_IMPL json_index_best_impl();
+bool json_index_set_impl(JSON_INDEX_IMPL impl);
+const char *json_index_impl_to_str(JSON_INDEX_IMPL impl);
+
+#endif //JSON_INDEX_H
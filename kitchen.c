@@ -7,19 +7,22 @@
 #include <pthread.h>
 #include <string.h>
 #include <time.h>
-#include <glib.h>
-#include <sys/timeb.h>
 
 #include "common.h"
 #include "constants.h"
+#include "trace.h"
 #include "kitchen.h"
 #include "courier.h"
+#include "input.h"
+#include "ingest.h"
+#include "pool.h"
+#include "stats.h"
 
 //Local method (not public); init'ing the timer
 static int kitchen_init_ingestion_timer(int ingestion_interval) {
     struct itimerspec new_value;
     
-    int fd = timerfd_create(CLOCK_REALTIME, 0);
+    int fd = timerfd_create(CLOCK_MONOTONIC, 0);
     if(fd != -1) {
         new_value.it_value.tv_sec = ingestion_interval / 1000;
         new_value.it_value.tv_nsec = (ingestion_interval % 1000)* 1000000;
@@ -42,16 +45,21 @@ static int kitchen_init_ingestion_timer(int ingestion_interval) {
 /* Upon ingesting the orders, it immediately shelves them and schedules      */
 /* pickup for those orders in a random interval. If all orders have been     */
 /* ingested it will wait for all deliveries to be completed before quitting  */
+/* The orders are parsed ahead by the reader stage (ingest.c); the shelving  */
+/* takes the shelf locks it needs itself (see the lock order in common.h).   */
 /*                                                                           */
 /**PROC-**********************************************************************/
 void *kitchen_thread_cb()
 {
     int ingestion_interval, ingestion_rate;
     int fd, courier_arrive_delay, temp = 0;
-    bool is_eof = false;
+    int threads, pickups, kept, i;
+    char **pickup_ids;
+    int *pickup_delays;
+    int64_t now;
+    bool is_eof = false, prefetching = false;
     time_t t;
     uint64_t ret, missed;
-    char time_str_buf[64];  
     
     ////init courier thread
     size_t timer;
@@ -68,90 +76,111 @@ void *kitchen_thread_cb()
 
     fd = kitchen_init_ingestion_timer(ingestion_interval);
     if(fd == -1) {      
-        current_time_msec(time_str_buf);        
-        if(SYSTEM_DEBUG_LEVEL & L4) printf("%s: kitchen : L4: Cannot start kitchen thread. Quitting\n", time_str_buf);
+        TRACE(KITCHEN, L4, "Cannot start kitchen thread. Quitting\n");
         pthread_exit(NULL);
     }
     
     //input processing
-    FILE *f = fopen(SYSTEM_ORDERS_INPUT_FILE, "r");
-    if(f == NULL) {
-        current_time_msec(time_str_buf);        
-        if(SYSTEM_DEBUG_LEVEL & L4) printf("%s: kitchen : L4: Cannot open orders file. Quitting\n", time_str_buf);
+    ORDER_READER *reader = order_reader_open(SYSTEM_ORDERS_INPUT_FILE, SYSTEM_ORDERS_READER);
+    if(reader == NULL) {
+        TRACE(KITCHEN, L4, "Cannot open orders file. Quitting\n");
         pthread_exit(NULL);
     }
     
+    //reader stage: the next batches are parsed ahead, outside the lock; by
+    //kitchen.threads partitions of the file, which still come out in file order
+    threads = (SYSTEM_ORDERS_READER == ORDER_READER_STDIO || KITCHEN_THREADS < 1) ? 1 : KITCHEN_THREADS;
+    prefetching = ingest_start(reader, threads, ingestion_rate);
+    if(!prefetching && threads > 1) prefetching = ingest_start(reader, 1, ingestion_rate);
+    if(!prefetching) {
+        TRACE(KITCHEN, L4, "cannot start the reader stage; reading on each tick\n");
+    }
+    pickup_ids = malloc(ingestion_rate * sizeof(char *));
+    pickup_delays = malloc(ingestion_rate * sizeof(int));
+    
     while(1) {
-        current_time_msec(time_str_buf);
-        if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: kitchen : L1: ingestion tick\n", time_str_buf);
+        TRACE(KITCHEN, L1, "ingestion tick\n");
         
-        pthread_mutex_lock(&data_access_mutex);
-
-        //Always the LL head and tail point to valid orders (orders that 
-        //have been just read OR orders that were shelved successfully).
-        //On initialization (i.e. before first file read happens) they
-        //shall be NULL.
-        ORDER_LL_NODE *this_cycle_order = g_data->g_order_ll_tail;
-        is_eof = file_read_orders(f, ingestion_rate); // g_data->g_order_ll_head & tail set 
+        //The LL only holds the orders read in this tick and only this thread
+        //uses it, so it is filled (and emptied) outside the lock. The reader
+        //stage has normally parsed this batch already.
+        is_eof = prefetching ? ingest_read_orders(ingestion_rate) : 
+                                order_reader_read(reader, ingestion_rate); // g_data->g_order_ll_head & tail set 
         
-        //for the first tick, take from head; else take from previous tick's tail
-        this_cycle_order = (this_cycle_order == NULL ) ? 
-                            g_data->g_order_ll_head : this_cycle_order;
+        //copy the ids first; once shelved an order may go stale and be
+        //discarded at any time (couriers look orders up by id). The courier
+        //delay is drawn now too, so that placement knows when the order is
+        //to be picked up (shelf.placement = lookahead).
+        now = shelf_now_msec();
+        ORDER_LL_NODE *this_cycle_order = g_data->g_order_ll_head;
+        for(pickups = 0; this_cycle_order; this_cycle_order = this_cycle_order->next) {
+            char *id_to_courier = arena_strndup(&g_string_arena, this_cycle_order->data->id,
+                                                    this_cycle_order->data->id_len);
+            TRACE(KITCHEN, L1, "id_to_courier ptr %p\n", id_to_courier);
+            courier_arrive_delay = (rand() % courier_interval_range) 
+                                        + KITCHEN_COURIER_DISPATCH_INTERVAL_MIN;
+            this_cycle_order->data->pickup = now + courier_arrive_delay;
+            pickup_delays[pickups] = courier_arrive_delay;
+            pickup_ids[pickups++] = id_to_courier;
+        }
         
-        shelf_store_orders(&this_cycle_order);  //store in all hashmaps
+        //placement; the only step that needs the shared data
+        shelf_store_orders();  //store on the shelves; discarded ones have NULL data
         
-        this_cycle_order = (this_cycle_order == g_data->g_order_ll_head ) ? 
-                            this_cycle_order : this_cycle_order->next;
+        //no pickup for the discarded ones (shelf full)
+        this_cycle_order = g_data->g_order_ll_head;
+        for(i = 0, kept = 0; this_cycle_order; this_cycle_order = this_cycle_order->next, i++) {
+            if(this_cycle_order->data == NULL) {
+                arena_free(pickup_ids[i]);
+            } else {
+                pickup_delays[kept] = pickup_delays[i];
+                pickup_ids[kept++] = pickup_ids[i];
+            }
+        }
+        pickups = kept;
+        
+        print_event_shelf_contents(ORDER_READ);
+        
+        input_release_orders();
         
         //process items read in this tick; courier timer creation
-        while(this_cycle_order) {
-            courier_arrive_delay = (rand() % courier_interval_range) 
-                                        + KITCHEN_COURIER_DISPATCH_INTERVAL_MIN;
+        for(i = 0; i < pickups; i++) {
+            courier_arrive_delay = pickup_delays[i];
             
-            char *id_to_courier = malloc(sizeof(char) * (strlen(this_cycle_order->data->id) + 1));
-            if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: kitchen : L1: id_to_courier ptr %p\n", 
-                        time_str_buf, id_to_courier);
-            strcpy(id_to_courier, this_cycle_order->data->id);
+            TRACE(KITCHEN, L4, "scheduling order (%s) for pickup\n", pickup_ids[i]);
+            TRACE(KITCHEN, L2, "courier_arrive_delay %.3f secs\n", courier_arrive_delay/1000.0);
+            //the courier owns the id from here on
             timer = courier_start_timer(courier_arrive_delay, 
-                                courier_timer_handler, id_to_courier);
-            
-            current_time_msec(time_str_buf);
-            if(timer) {
-                if(SYSTEM_DEBUG_LEVEL & L4) printf("%s: kitchen : L4: scheduled order (%s) for pickup\n", 
-                            time_str_buf, this_cycle_order->data->id);
-                if(SYSTEM_DEBUG_LEVEL & L2) printf("%s: kitchen : L2: started timer (%d); courier_arrive_delay %.3f secs\n", 
-                            time_str_buf, timer, courier_arrive_delay/1000.0);              
-            } else {
-                if(SYSTEM_DEBUG_LEVEL & L4) printf("%s: kitchen : L4: failed to schedule order (%s) for pickup\n", 
-                            time_str_buf, this_cycle_order->data->id);
+                                courier_timer_handler, pickup_ids[i]);
+            if(!timer) {
+                TRACE(KITCHEN, L4, "failed to schedule order (%s) for pickup\n", pickup_ids[i]);
+                stats_count_timer_failure();
                 //TODO: if we cannot start the courier timer, delete the order
+                arena_free(pickup_ids[i]);
             }
-            this_cycle_order = this_cycle_order->next;
         }
         
-        print_event_shelf_contents(ORDER_READ);
-        
-        pthread_mutex_unlock(&data_access_mutex);
-        
-        //items from this tick all processed; this_cycle_order should be NULL now
+        //items from this tick all processed; the LL is empty now
         if(is_eof) {
             break;
         } else {
             ret = read (fd, &missed, sizeof (missed));
         }
     }
+    free(pickup_ids);
+    free(pickup_delays);
     
-    pthread_mutex_lock(&data_access_mutex);
-    while(g_hash_table_size(g_data->g_order_id_shelf_hash) != 0) {              
-        pthread_cond_wait(&orders_empty_cond, &data_access_mutex);              
+    pthread_mutex_lock(&orders_empty_mutex);
+    while(__sync_fetch_and_add(&g_data->g_order_index.count, 0) != 0) {              
+        pthread_cond_wait(&orders_empty_cond, &orders_empty_mutex);              
     }
-    pthread_mutex_unlock(&data_access_mutex);
+    pthread_mutex_unlock(&orders_empty_mutex);
     
-    current_time_msec(time_str_buf);
-    if(SYSTEM_DEBUG_LEVEL & L4) printf("%s: kitchen : L4: exiting\n", time_str_buf);
+    TRACE(KITCHEN, L4, "exiting\n");
     
-    //File close, threads exited/terminated
-    fclose(f);
+    //File close (no order refers to it any more), threads exited/terminated
+    if(prefetching) ingest_finalize();
+    order_reader_close(reader);
     courier_finalize();
     pthread_cancel(monitor_thread_id);
     pthread_join(monitor_thread_id, NULL);
@@ -1,10 +1,16 @@
 #ifndef KITCHEN_H
 #define KITCHEN_H
 
+bool init();
+void finalize();
+
 void *kitchen_thread_cb();
 
 int ordershelf_to_max_size(SHELF shelf);
 
 char *ordertemp_to_str(TEMP temp);
+char *ordershelf_to_str(SHELF shelf);
+char *order_event_to_str(ORDER_EVENT evt);
+char *overflow_eviction_to_str(OVERFLOW_EVICTION policy);
 
 #endif //KITCHEN_H
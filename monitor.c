@@ -5,25 +5,94 @@
 #include <string.h>
 #include <time.h>
 #include <pthread.h>
-#include <glib.h>
-#include <sys/timeb.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 
 #include "common.h"
 #include "constants.h"
+#include "clock.h"
+#include "trace.h"
+#include "input.h"
+#include "shelf_soa.h"
+#include "shelf_lockfree.h"
+#include "stats.h"
 
-//Not a public method; initing the monitor thread timer
-static int monitor_init_ingestion_timer(int shelf_monitor_interval) {
+//timerfd the monitor thread sleeps on, armed (absolute, CLOCK_MONOTONIC) for
+//the nearest expiry; INT64_MAX while it is not armed. g_monitor_armed is
+//guarded by g_monitor_mutex (a leaf lock; shelving arms the timer with a
+//shelf lock held).
+static int g_monitor_fd = -1;
+static int64_t g_monitor_armed = INT64_MAX;
+static pthread_mutex_t g_monitor_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//The overflow shelf is swept first: a slot freed on a temperature shelf
+//is given to an overflow order right away (shelf_rebalance), which must
+//not be one that is already stale
+static const SHELF g_monitor_sweep_order[MAX_SHELF] = { 
+    OVERFLOW_SHELF, HOT_SHELF, COLD_SHELF, FROZEN_SHELF 
+};
+
+/**PROC+**********************************************************************/
+/* Name:      monitor_init                                                   */
+/*                                                                           */
+/* Purpose:   Creates the monitor's timer                                    */
+/*                                                                           */
+/* Returns:   bool - for success/failure.                                    */
+/*                                                                           */
+/* Operation: The timer is created disarmed; the kitchen arms it once the    */
+/*            first orders are shelved.                                      */
+/*                                                                           */
+/**PROC-**********************************************************************/
+bool monitor_init() {
+    g_monitor_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    g_monitor_armed = INT64_MAX;
+    
+    return g_monitor_fd != -1;
+}
+
+void monitor_finalize() {
+    if(g_monitor_fd != -1) close(g_monitor_fd);
+    g_monitor_fd = -1;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      monitor_arm                                                    */
+/*                                                                           */
+/* Purpose:   Has the monitor wake up by the given deadline                  */
+/*                                                                           */
+/* Params:    IN     deadline        - msecs (clock_now_msec); INT64_MAX for */
+/*                                     none                                  */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/* Operation: Only moves the timer earlier: the monitor re-arms it for the   */
+/*            nearest expiry every time it wakes up, so a later deadline is  */
+/*            picked up then. A deadline already passed fires at once.       */
+/*            Any thread may call it, with or without shelf locks held.      */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void monitor_arm(int64_t deadline) {
     struct itimerspec new_value;
     
-    int fd = timerfd_create(CLOCK_REALTIME, 0);
-    if(fd != -1) {
-        new_value.it_value.tv_sec = shelf_monitor_interval / 1000;
-        new_value.it_value.tv_nsec = (shelf_monitor_interval % 1000)* 1000000;
-        new_value.it_interval.tv_sec = shelf_monitor_interval / 1000;
-        new_value.it_interval.tv_nsec = (shelf_monitor_interval %1000) * 1000000;
-        timerfd_settime(fd, 0, &new_value, NULL);
+    //no lock for the common case, a deadline later than the armed one
+    if(deadline >= __atomic_load_n(&g_monitor_armed, __ATOMIC_RELAXED)) return;
+    
+    pthread_mutex_lock(&g_monitor_mutex);
+    if(deadline >= g_monitor_armed || g_monitor_fd == -1) {
+        pthread_mutex_unlock(&g_monitor_mutex);
+        return;
+    }
+    
+    memset(&new_value, 0, sizeof(new_value));
+    new_value.it_value.tv_sec = deadline / 1000;
+    new_value.it_value.tv_nsec = (deadline % 1000) * 1000000;
+    if(new_value.it_value.tv_sec == 0 && new_value.it_value.tv_nsec == 0) {
+        new_value.it_value.tv_nsec = 1; //zero would disarm it
     }
-    return fd;
+    if(timerfd_settime(g_monitor_fd, TFD_TIMER_ABSTIME, &new_value, NULL) == 0) {
+        __atomic_store_n(&g_monitor_armed, deadline, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&g_monitor_mutex);
 }
 
 /**PROC+**********************************************************************/
@@ -41,53 +110,26 @@ static int monitor_init_ingestion_timer(int shelf_monitor_interval) {
 /*                                                                           */
 /*                                                                           */
 /* Operation: Check if order is stale (based on age and "value" logic per    */
-/* problem statement). If stale discard.                                     */
+/* problem statement). If stale discard. Caller holds the shelf's lock and   */
+/* prints the ORDER_DISCARDED_STALE event once it has let go of it.          */
 /*                                                                           */
 /**PROC-**********************************************************************/
 bool monitor_check_remove_stale_order(SHELF shelf, ORDER *order, int elapsed_time) {
-    char time_str_buf[64];
     bool is_removed = false;
     double value;
     
     int shelfDecayModifier = (shelf == OVERFLOW_SHELF) ? 
                                 SHELF_LIFE_MODIFIER_OVERFLOW_SHELF : SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF;
     
-    current_time_msec(time_str_buf);
     value = order->shelfLife - (order->decayRate * (elapsed_time/1000) * shelfDecayModifier);
-    if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: monitor : L1: order id %s order value %f...\n", time_str_buf, order->id, value);
+    TRACE(MONITOR, L1, "order id %.*s order value %f...\n", (int)order->id_len, order->id, value);
     if(value < 0) {
         //remove order
-        if(SYSTEM_DEBUG_LEVEL & L4) printf("%s: monitor : L4: order id %s is STALE; removing\n", time_str_buf, order->id);
+        TRACE(MONITOR, L4, "order id %.*s is STALE; removing\n", (int)order->id_len, order->id);
         
-        //TODO: remove all references to order
-        //Remove from all hashes, free heap memory of members and finally free order's heap memory
-        int *ptr_shelf = g_hash_table_lookup(g_data->g_order_id_shelf_hash, order->id);
-        free(ptr_shelf);
-        g_hash_table_remove(g_data->g_order_id_shelf_hash, order->id);
-        
-        if(shelf == OVERFLOW_SHELF) {
-            ORDER** overflow_by_temp = g_data->g_overflow_by_temp_array[order->temp];
-            
-            int i = OVERFLOW_SHELF_MAX_SIZE-1, order_idx = -1;
-            ORDER *swap = NULL;
-            for(i = 0; i < OVERFLOW_SHELF_MAX_SIZE ; i++) {
-                if(swap == order) {
-                    overflow_by_temp[i] = NULL;
-                    g_data->g_overflow_by_temp_array_sz[order->temp]--;
-                    break;
-                }
-            }
-        }
-        
-        //Caller will do using the iterator
-        //GHashTable *shelf_hash = shelf_to_hash(shelf);
-        //g_hash_table_remove(shelf_hash, order->id);       
-        
-        if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: monitor : L1: FREE order->id %p order->name %p order %p\n", 
-                        time_str_buf, order->id, order->name, order);
-        free(order->id);
-        free(order->name);
-        free(order);
+        print_order_delta(ORDER_DELTA_DISCARDED_STALE, order, shelf);
+        stats_count(ORDER_DISCARDED_STALE, shelf, order->temp);
+        shelf_release_order(shelf, order);
         
         is_removed = true;
     }
@@ -95,70 +137,131 @@ bool monitor_check_remove_stale_order(SHELF shelf, ORDER *order, int elapsed_tim
     return is_removed;
 }
 
+//Not a 'public' function; only internal to this file.
+//shelf.layout = soa: values the whole shelf at once with the SIMD kernel
+//and discards every order it flags stale. Caller holds the shelf's lock;
+//returns how many were discarded.
+static int monitor_sweep_stale_orders(SHELF shelf, int64_t now) {
+    SHELF_ARRAY *shelf_array = &g_data->g_shelves[shelf];
+    ORDER *order;
+    uint64_t stale;
+    int word, bit, discarded = 0;
+    
+    if(shelf_soa_evaluate(shelf_array, now) == 0) return 0;
+    
+    //backwards, as a removal fills the gap with the (already checked)
+    //last order of the shelf; the slots below are left as they are, so
+    //their bits stay good
+    for(word = (shelf_array->count + 63) / 64 - 1; word >= 0; word--) {
+        stale = shelf_array->stale[word];
+        while(stale) {
+            bit = 63 - __builtin_clzll(stale);
+            stale &= ~(1ULL << bit);
+            order = shelf_array->orders[word * 64 + bit];
+            
+            TRACE(MONITOR, L4, "order id %.*s is STALE; removing\n", (int)order->id_len, order->id);
+            print_order_delta(ORDER_DELTA_DISCARDED_STALE, order, shelf);
+            stats_count(ORDER_DISCARDED_STALE, shelf, order->temp);
+            shelf_release_order(shelf, order);
+            discarded++;
+        }
+    }
+    return discarded;
+}
+
+//Not a 'public' function; only internal to this file.
+//Pops the orders due off one shelf's deadline heap; caller holds the
+//shelf's lock. Returns how many were discarded.
+static int monitor_pop_stale_orders(SHELF shelf, int64_t now) {
+    ORDER_HEAP *deadlines = &g_data->g_deadlines[shelf];
+    ORDER *order;
+    int discarded = 0;
+    
+    while(deadlines->count > 0 && (order = deadlines->orders[0])->expiry <= now) {
+        if(!monitor_check_remove_stale_order(shelf, order, (int)(now - order->created))) break;
+        discarded++;
+    }
+    return discarded;
+}
+
 /**PROC+**********************************************************************/
 /* Name:      monitor_thread_cb                                              */
 /*                                                                           */
-/* Purpose:   Callback for the monitor thread; invoked at configured         */
-/*            periodicity                                                    */
-/*            problem statement.                                             */
+/* Purpose:   Callback for the monitor thread; wakes up when the next        */
+/*            shelved order goes stale                                       */
 /*                                                                           */
 /* Returns:   void* - Not used for now.                                      */
 /*                                                                           */
 /*                                                                           */
-/* Operation: SEe "Purpose" above                                            */
+/* Operation: Every shelved order sits in its shelf's deadline heap by the   */
+/*            time it goes stale there (g_data->g_deadlines). The timer is   */
+/*            armed for the nearest top only; on expiry each shelf in turn   */
+/*            is locked, the orders due are popped and discarded,            */
+/*            O(expired * log n), and the timer is re-armed for the new      */
+/*            nearest top. With shelf.layout = soa the shelves are swept     */
+/*            with the SIMD value kernel instead, and with shelf.concurrency */
+/*            = lockfree by their deadline columns (shelf_lf_discard_stale), */
+/*            no locks taken. The events are printed once the shelf is       */
+/*            unlocked. Slots freed on a temperature shelf go to overflow    */
+/*            orders of its temperature (shelf_rebalance); the overflow      */
+/*            shelf is swept first, so none of them is stale by then.        */
 /*                                                                           */
 /**PROC-**********************************************************************/
 void *monitor_thread_cb() {
-    int shelf_monitor_interval = SHELF_MONITOR_INTERVAL;
-    int fd = monitor_init_ingestion_timer(shelf_monitor_interval);
     uint64_t ret, missed;
-    char time_str_buf[64];
+    int64_t now, deadline, next;
     SHELF shelf_iter;
-    GHashTable *shelf_hash;
-    GHashTableIter shelf_hash_iter;
-    gpointer key_order_id, value_order;
-    char *order_id;
-    ORDER *order;
-    struct timeb monitor_time;
-    int diff; //msecs
+    int i, discarded;
     
-    if(fd == -1) {      
-        current_time_msec(time_str_buf);        
-        if(SYSTEM_DEBUG_LEVEL & L4) printf("%s: monitor : L4: Cannot start shelf monitor thread. Quitting\n", time_str_buf);
+    if(g_monitor_fd == -1) {      
+        TRACE(MONITOR, L4, "Cannot start shelf monitor thread. Quitting\n");
         pthread_exit(NULL);
     }
         
     while(1) {
-        current_time_msec(time_str_buf);
-        if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: monitor : L1: shelf monitor tick\n", time_str_buf);
-        ftime(&monitor_time);
+        ret = read (g_monitor_fd, &missed, sizeof (missed));
+        
+        TRACE(MONITOR, L1, "shelf monitor tick\n");
+        now = clock_now_msec();
         
-        pthread_mutex_lock(&data_access_mutex);
-        for(shelf_iter = HOT_SHELF; (shelf_iter < MAX_SHELF); shelf_iter++) {
-            shelf_hash = shelf_to_hash(shelf_iter);
+        //from here on a new order arms the timer again; whatever was shelved
+        //before is seen below
+        pthread_mutex_lock(&g_monitor_mutex);
+        __atomic_store_n(&g_monitor_armed, INT64_MAX, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&g_monitor_mutex);
+        
+        next = INT64_MAX;
+        for(i = 0; i < MAX_SHELF; i++) {
+            shelf_iter = g_monitor_sweep_order[i];
+            if(SHELF_CONCURRENCY_TYPE == SHELF_CONCURRENCY_LOCKFREE) {
+                discarded = shelf_lf_discard_stale(shelf_iter, now, &next);
+                while(discarded-- > 0) print_event_shelf_contents(ORDER_DISCARDED_STALE);
+                continue;
+            }
             
-            if(shelf_hash) {
-                g_hash_table_iter_init(&shelf_hash_iter, shelf_hash);
-                while (g_hash_table_iter_next(&shelf_hash_iter, &key_order_id, &value_order)) {
-                    order_id = (char*)key_order_id;
-                    order = (ORDER*)value_order;
-                    diff = (1000.0 * (monitor_time.time - order->creationTime.time) + 
-                                            (monitor_time.millitm - order->creationTime.millitm));
-                                        
-                    //printf("%s: monitor : L1: order_id  %s order %p name %s diff %u\n", time_str_buf, 
-                    //                          order_id, order, order->name, diff);
-                    if(monitor_check_remove_stale_order(shelf_iter, order, diff)) {
-                        //Item removed since stale, remove from shelf hash too
-                        g_hash_table_iter_remove(&shelf_hash_iter);
-                        print_event_shelf_contents(ORDER_DISCARDED_STALE);
-                    }
-                }
+            shelf_lock(shelf_iter);
+            if(SHELF_LAYOUT_TYPE == SHELF_LAYOUT_SOA) {
+                discarded = monitor_sweep_stale_orders(shelf_iter, now);
+            } else {
+                discarded = monitor_pop_stale_orders(shelf_iter, now);
+            }
+            if(discarded > 0) shelf_rebalance(shelf_iter);
+            if(g_data->g_deadlines[shelf_iter].count > 0 && 
+                        g_data->g_deadlines[shelf_iter].orders[0]->expiry < next) {
+                next = g_data->g_deadlines[shelf_iter].orders[0]->expiry;
             }
+            shelf_unlock(shelf_iter);
+            
+            while(discarded-- > 0) print_event_shelf_contents(ORDER_DISCARDED_STALE);
         }
-        pthread_mutex_unlock(&data_access_mutex);
         
-        ret = read (fd, &missed, sizeof (missed));
+        if(next != INT64_MAX) {
+            deadline = next;
+            //due but busy (a lock-free slot whose order was borrowed just
+            //then) or not stale after all; look again shortly
+            monitor_arm((deadline <= now) ? now + 1000 : deadline);
+        }
     }
     
     return 0;
-}
\ No newline at end of file
+}
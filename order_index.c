@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "constants.h"
+#include "pack.h"
+#include "order_index.h"
+
+#define ORDER_INDEX_MIN_CAPACITY    16
+#define ORDER_INDEX_STRIPE_BITS     4   //log2(ORDER_INDEX_STRIPES)
+
+//Not a 'public' function; only internal to this file.
+//Fibonacci hashing of the folded 128 bits; the top bits of the product
+//pick the stripe, the bits below them the home bucket in it
+static inline uint64_t order_index_hash(const ORDER_KEY *key) {
+    return (key->hi ^ key->lo) * 0x9E3779B97F4A7C15ULL;
+}
+
+//Not a 'public' function; only internal to this file.
+static inline ORDER_INDEX_STRIPE *order_index_stripe(ORDER_INDEX *index, const ORDER_KEY *key) {
+    return &index->stripes[order_index_hash(key) >> (64 - ORDER_INDEX_STRIPE_BITS)];
+}
+
+//Not a 'public' function; only internal to this file.
+static inline uint64_t order_index_home(const ORDER_INDEX_STRIPE *stripe, const ORDER_KEY *key) {
+    return (order_index_hash(key) << ORDER_INDEX_STRIPE_BITS) >> stripe->shift;
+}
+
+//Not a 'public' function; only internal to this file.
+static inline bool order_key_equal(const ORDER_KEY *a, const ORDER_KEY *b) {
+    return a->hi == b->hi && a->lo == b->lo;
+}
+
+//Key of a binary (16 byte) UUID
+void order_key_from_uuid(const uint8_t *uuid, ORDER_KEY *key) {
+    memcpy(&key->hi, uuid, sizeof(uint64_t));
+    memcpy(&key->lo, uuid + sizeof(uint64_t), sizeof(uint64_t));
+}
+
+//Key of an order id ("len" chars, not necessarily NUL terminated): the
+//binary form of a UUID id; any other id is hashed (two 64-bit FNV-1a) into
+//128 bits instead
+void order_key_from_id(const char *id, size_t len, ORDER_KEY *key) {
+    uint8_t uuid[PACK_UUID_LEN];
+    const unsigned char *c, *end = (const unsigned char *)id + len;
+
+    if(pack_uuid_parse(id, len, uuid)) {
+        order_key_from_uuid(uuid, key);
+        return;
+    }
+
+    key->hi = 0xcbf29ce484222325ULL;
+    key->lo = 0x84222325cbf29ce4ULL;
+    for(c = (const unsigned char *)id; c < end; c++) {
+        key->hi = (key->hi ^ *c) * 0x100000001b3ULL;
+        key->lo = (key->lo ^ *c) * 0x9E3779B97F4A7C15ULL;
+    }
+}
+
+//Not a 'public' function; only internal to this file.
+//Gives a stripe an empty table of 2^bits entries
+static bool order_index_stripe_alloc(ORDER_INDEX_STRIPE *stripe, int bits) {
+    uint64_t capacity = 1ULL << bits;
+    
+    stripe->entries = calloc(capacity, sizeof(ORDER_INDEX_ENTRY));
+    stripe->mask = capacity - 1;
+    stripe->shift = 64 - bits;
+    stripe->count = 0;
+    
+    return stripe->entries != NULL;
+}
+
+//Not a 'public' function; only internal to this file.
+//Doubles a stripe's table once it is half full, rehashing its entries;
+//caller holds the stripe's lock
+static bool order_index_stripe_grow(ORDER_INDEX_STRIPE *stripe) {
+    ORDER_INDEX_ENTRY *old = stripe->entries;
+    uint64_t old_capacity = stripe->mask + 1, i, j;
+    int count = stripe->count;
+    
+    if(!order_index_stripe_alloc(stripe, 64 - stripe->shift + 1)) {
+        stripe->entries = old;
+        stripe->mask = old_capacity - 1;
+        stripe->shift++;
+        stripe->count = count;
+        return false;
+    }
+    for(i = 0; i < old_capacity; i++) {
+        if(old[i].order == NULL) continue;
+        for(j = order_index_home(stripe, &old[i].key); stripe->entries[j].order; j = (j + 1) & stripe->mask)
+            ;
+        stripe->entries[j] = old[i];
+    }
+    stripe->count = count;
+    free(old);
+    return true;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      order_index_init                                               */
+/*                                                                           */
+/* Purpose:   Allocates the order index for the given number of orders       */
+/*                                                                           */
+/* Params:    IN     index           - Index to initialize                   */
+/*            IN     max_orders      - Most orders it will ever hold (i.e.   */
+/*                                     total capacity of the shelves)        */
+/*                                                                           */
+/* Returns:   bool - for success/failure.                                    */
+/*                                                                           */
+/* Operation: Every stripe starts with the smallest power of 2 capacity that */
+/*            keeps it at most half full with its share of max_orders; one   */
+/*            that gets more than its share grows (order_index_insert).      */
+/*                                                                           */
+/**PROC-**********************************************************************/
+bool order_index_init(ORDER_INDEX *index, int max_orders) {
+    int share = (max_orders + ORDER_INDEX_STRIPES - 1) / ORDER_INDEX_STRIPES;
+    int bits = 4, i;
+    bool ok = true;
+    
+    while((ORDER_INDEX_MIN_CAPACITY << (bits - 4)) < 2 * share) bits++;
+    
+    for(i = 0; i < ORDER_INDEX_STRIPES; i++) {
+        pthread_mutex_init(&index->stripes[i].mutex, NULL);
+        if(!order_index_stripe_alloc(&index->stripes[i], bits)) ok = false;
+    }
+    index->count = 0;
+    
+    return ok;
+}
+
+void order_index_destroy(ORDER_INDEX *index) {
+    int i;
+    
+    for(i = 0; i < ORDER_INDEX_STRIPES; i++) {
+        free(index->stripes[i].entries);
+        index->stripes[i].entries = NULL;
+        index->stripes[i].count = 0;
+        pthread_mutex_destroy(&index->stripes[i].mutex);
+    }
+    index->count = 0;
+}
+
+//Locks the stripe of a key; lookup, insert and remove of that key (and of
+//any other key of the stripe) need it held
+void order_index_lock(ORDER_INDEX *index, const ORDER_KEY *key) {
+    pthread_mutex_lock(&order_index_stripe(index, key)->mutex);
+}
+
+void order_index_unlock(ORDER_INDEX *index, const ORDER_KEY *key) {
+    pthread_mutex_unlock(&order_index_stripe(index, key)->mutex);
+}
+
+/**PROC+**********************************************************************/
+/* Name:      order_index_lookup                                             */
+/*                                                                           */
+/* Purpose:   Finds the entry of an order by its key                         */
+/*                                                                           */
+/* Params:    IN     index           - Order index                           */
+/*            IN     key             - Key of the order                      */
+/*                                                                           */
+/* Returns:   ORDER_INDEX_ENTRY* - the entry, NULL if the order is not in    */
+/*            the index. Only valid while the caller holds the key's stripe  */
+/*            lock and until the stripe is next modified.                    */
+/*                                                                           */
+/**PROC-**********************************************************************/
+ORDER_INDEX_ENTRY *order_index_lookup(ORDER_INDEX *index, const ORDER_KEY *key) {
+    ORDER_INDEX_STRIPE *stripe = order_index_stripe(index, key);
+    uint64_t i = order_index_home(stripe, key);
+
+    while(stripe->entries[i].order) {
+        if(order_key_equal(&stripe->entries[i].key, key)) {
+            return &stripe->entries[i];
+        }
+        i = (i + 1) & stripe->mask;
+    }
+    return NULL;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      order_index_insert                                             */
+/*                                                                           */
+/* Purpose:   Adds an order to the index                                     */
+/*                                                                           */
+/* Params:    IN     index           - Order index                           */
+/*            IN     order           - Order to add (keyed by order->key)    */
+/*                                                                           */
+/* Returns:   ORDER_INDEX_ENTRY* - the order's entry, for the caller to set  */
+/*            its shelf and slot; NULL if the stripe is full and cannot      */
+/*            grow. An order with the key of one already in the index        */
+/*            replaces it. Caller holds the key's stripe lock.               */
+/*                                                                           */
+/**PROC-**********************************************************************/
+ORDER_INDEX_ENTRY *order_index_insert(ORDER_INDEX *index, ORDER *order) {
+    ORDER_INDEX_STRIPE *stripe = order_index_stripe(index, &order->key);
+    uint64_t i;
+    
+    //kept at most half full, so probe sequences stay short (and end)
+    if(2 * ((uint64_t)stripe->count + 1) > stripe->mask + 1 && !order_index_stripe_grow(stripe)) {
+        if((uint64_t)stripe->count + 1 >= stripe->mask) return NULL;
+    }
+    
+    i = order_index_home(stripe, &order->key);
+    while(stripe->entries[i].order) {
+        if(order_key_equal(&stripe->entries[i].key, &order->key)) {
+            stripe->entries[i].order = order;
+            return &stripe->entries[i];
+        }
+        i = (i + 1) & stripe->mask;
+    }
+
+    stripe->entries[i].key = order->key;
+    stripe->entries[i].order = order;
+    stripe->count++;
+    __sync_add_and_fetch(&index->count, 1);
+    return &stripe->entries[i];
+}
+
+/**PROC+**********************************************************************/
+/* Name:      order_index_remove                                             */
+/*                                                                           */
+/* Purpose:   Removes an entry from the index                                */
+/*                                                                           */
+/* Params:    IN     index           - Order index                           */
+/*            IN     entry           - Entry to remove (from lookup/insert)  */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/* Operation: Backward shift deletion: entries after the gap that may live   */
+/*            there (their home bucket is not between the gap and them) are  */
+/*            moved back, so no tombstones are needed. Other entry pointers  */
+/*            of the stripe are invalidated. Caller holds the entry's stripe */
+/*            lock.                                                          */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void order_index_remove(ORDER_INDEX *index, ORDER_INDEX_ENTRY *entry) {
+    ORDER_INDEX_STRIPE *stripe = order_index_stripe(index, &entry->key);
+    uint64_t gap = entry - stripe->entries;
+    uint64_t i = gap, home;
+
+    while(1) {
+        i = (i + 1) & stripe->mask;
+        if(stripe->entries[i].order == NULL) break;
+
+        home = order_index_home(stripe, &stripe->entries[i].key);
+        //distance from home to i vs from gap to i, both going forwards
+        if(((i - home) & stripe->mask) >= ((i - gap) & stripe->mask)) {
+            stripe->entries[gap] = stripe->entries[i];
+            gap = i;
+        }
+    }
+
+    memset(&stripe->entries[gap], 0, sizeof(ORDER_INDEX_ENTRY));
+    stripe->count--;
+    __sync_sub_and_fetch(&index->count, 1);
+}
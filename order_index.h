@@ -0,0 +1,22 @@
+#ifndef ORDER_INDEX_H
+#define ORDER_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+//ORDER_INDEX, ORDER_INDEX_ENTRY and ORDER_KEY live in common.h along with
+//the rest of DATA
+
+void order_key_from_id(const char *id, size_t len, ORDER_KEY *key);
+void order_key_from_uuid(const uint8_t *uuid, ORDER_KEY *key);
+
+bool order_index_init(ORDER_INDEX *index, int max_orders);
+void order_index_destroy(ORDER_INDEX *index);
+void order_index_lock(ORDER_INDEX *index, const ORDER_KEY *key);
+void order_index_unlock(ORDER_INDEX *index, const ORDER_KEY *key);
+ORDER_INDEX_ENTRY *order_index_lookup(ORDER_INDEX *index, const ORDER_KEY *key);
+ORDER_INDEX_ENTRY *order_index_insert(ORDER_INDEX *index, ORDER *order);
+void order_index_remove(ORDER_INDEX *index, ORDER_INDEX_ENTRY *entry);
+
+#endif //ORDER_INDEX_H
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pack.h"
+
+//Not a 'public' function; only internal to this file.
+static uint64_t pack_align(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      pack_layout                                                    */
+/*                                                                           */
+/* Purpose:   Computes where each section of a packed orders file goes       */
+/*                                                                           */
+/* Params:    OUT    header       - Header to fill (magic, counts, offsets)  */
+/*            IN     order_count  - Count of orders                          */
+/*            IN     name_count   - Count of distinct names                  */
+/*            IN     names_len    - Bytes of the name blob (with the NULs)   */
+/*                                                                           */
+/* Returns:   Size of the whole file.                                        */
+/*                                                                           */
+/* Operation: Sections follow each other in the order of the PACK_HEADER     */
+/*            members, each one 8 byte aligned. Writer and reader both use   */
+/*            this, so the layout lives in one place.                        */
+/*                                                                           */
+/**PROC-**********************************************************************/
+size_t pack_layout(PACK_HEADER *header, uint32_t order_count, uint32_t name_count, uint64_t names_len) {
+    uint64_t offset = pack_align(sizeof(PACK_HEADER));
+    
+    memset(header, 0, sizeof(PACK_HEADER));
+    memcpy(header->magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+    header->version = PACK_VERSION;
+    header->byte_order = PACK_BYTE_ORDER;
+    header->order_count = order_count;
+    header->name_count = name_count;
+    header->names_len = names_len;
+    
+    header->ids_offset = offset;
+    offset = pack_align(offset + (uint64_t)order_count * PACK_UUID_LEN);
+    header->name_index_offset = offset;
+    offset = pack_align(offset + (uint64_t)order_count * sizeof(uint32_t));
+    header->temp_offset = offset;
+    offset = pack_align(offset + (uint64_t)order_count * sizeof(uint8_t));
+    header->shelf_life_offset = offset;
+    offset = pack_align(offset + (uint64_t)order_count * sizeof(int32_t));
+    header->decay_rate_offset = offset;
+    offset = pack_align(offset + (uint64_t)order_count * sizeof(float));
+    header->name_offsets_offset = offset;
+    offset = pack_align(offset + (uint64_t)name_count * sizeof(uint32_t));
+    header->names_offset = offset;
+    
+    return offset + names_len;
+}
+
+//Checks that a mapping holds a well formed packed orders file, so the
+//reader can index its columns without further bounds checks
+bool pack_validate(const void *map, size_t map_len) {
+    const PACK_HEADER *header = (const PACK_HEADER *)map;
+    const uint32_t *name_offsets;
+    const uint32_t *name_index;
+    const char *names;
+    PACK_HEADER expected;
+    uint32_t i;
+    
+    if(map_len < sizeof(PACK_HEADER) || memcmp(header->magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0 ||
+            header->version != PACK_VERSION || header->byte_order != PACK_BYTE_ORDER) {
+        return false;
+    }
+    if(pack_layout(&expected, header->order_count, header->name_count, header->names_len) > map_len ||
+            memcmp(&expected, header, sizeof(PACK_HEADER)) != 0) {
+        return false;
+    }
+    
+    names = (const char *)map + header->names_offset;
+    if(header->names_len > 0 && names[header->names_len - 1] != '\0') return false;
+    name_offsets = (const uint32_t *)((const char *)map + header->name_offsets_offset);
+    for(i = 0; i < header->name_count; i++) {
+        if(name_offsets[i] >= header->names_len) return false;
+    }
+    name_index = (const uint32_t *)((const char *)map + header->name_index_offset);
+    for(i = 0; i < header->order_count; i++) {
+        if(name_index[i] >= header->name_count) return false;
+    }
+    return true;
+}
+
+//Not a 'public' function; only internal to this file.
+static int pack_hex_digit(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+//Parses the canonical 8-4-4-4-12 text form; false if the "len" chars at
+//"str" (not necessarily NUL terminated) are not a UUID
+bool pack_uuid_parse(const char *str, size_t len, uint8_t *uuid) {
+    int i, hi, lo;
+    
+    if(len != PACK_UUID_STR_LEN) return false;
+    for(i = 0; i < PACK_UUID_LEN; i++) {
+        if(i == 4 || i == 6 || i == 8 || i == 10) {
+            if(*str++ != '-') return false;
+        }
+        if((hi = pack_hex_digit(str[0])) < 0 || (lo = pack_hex_digit(str[1])) < 0) return false;
+        uuid[i] = (uint8_t)((hi << 4) | lo);
+        str += 2;
+    }
+    return true;
+}
+
+//Formats a binary UUID as lower case canonical text; "str" holds
+//PACK_UUID_STR_LEN + 1 chars
+void pack_uuid_format(const uint8_t *uuid, char *str) {
+    static const char hex[] = "0123456789abcdef";
+    int i;
+    
+    for(i = 0; i < PACK_UUID_LEN; i++) {
+        if(i == 4 || i == 6 || i == 8 || i == 10) *str++ = '-';
+        *str++ = hex[uuid[i] >> 4];
+        *str++ = hex[uuid[i] & 0x0F];
+    }
+    *str = '\0';
+}
@@ -0,0 +1,52 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+//Packed (binary, columnar) orders file written by css-pack and mmap'd by
+//the ORDER_READER_PACKED backend. All integers are in host byte order
+//(PACK_BYTE_ORDER tells a foreign file apart); every section starts on an
+//8 byte boundary. Layout:
+//  PACK_HEADER
+//  ids          [order_count][16]   - binary UUIDs
+//  name_index   [order_count]       - uint32, into the name dictionary
+//  temp         [order_count]       - uint8 (TEMP)
+//  shelf_life   [order_count]       - int32
+//  decay_rate   [order_count]       - float
+//  name_offsets [name_count]        - uint32, into the name blob
+//  names        [names_len]         - NUL terminated, deduplicated names
+#define PACK_MAGIC          "CSSPACK"
+#define PACK_VERSION        1
+#define PACK_BYTE_ORDER     0x01020304
+#define PACK_UUID_LEN       16
+#define PACK_UUID_STR_LEN   36
+
+typedef struct pack_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t order_count;
+    uint32_t name_count;
+    uint64_t names_len;
+    
+    //section offsets from the start of the file
+    uint64_t ids_offset;
+    uint64_t name_index_offset;
+    uint64_t temp_offset;
+    uint64_t shelf_life_offset;
+    uint64_t decay_rate_offset;
+    uint64_t name_offsets_offset;
+    uint64_t names_offset;
+} PACK_HEADER;
+
+//Section offsets of a file holding "order_count" orders and "name_count"
+//names; fills the header and returns the total file size
+size_t pack_layout(PACK_HEADER *header, uint32_t order_count, uint32_t name_count, uint64_t names_len);
+bool pack_validate(const void *map, size_t map_len);
+
+bool pack_uuid_parse(const char *str, size_t len, uint8_t *uuid);
+void pack_uuid_format(const uint8_t *uuid, char *str);
+
+#endif //PACK_H
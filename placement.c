@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "constants.h"
+#include "placement.h"
+
+//Placement policies (shelf.placement): what to do with a new order once
+//both its temperature shelf and the overflow shelf are full. The choices
+//are always the same three - move an overflow order back to its own
+//temperature shelf (which has room) and put the new order in its overflow
+//slot, discard an overflow order for the new one, or drop the new order -
+//and the policies only differ in which they take. They are called with the
+//shelves held still (every shelf lock, or on the lock-free shelves every
+//overflow order borrowed), so they may look at the orders as they like.
+//The locked shelves also pass the overflow-by-temperature expiry heaps, so
+//greedy takes heap tops instead of scanning the overflow shelf; the
+//lock-free shelves keep no heaps and greedy scans there.
+//
+//A new policy is a function here, an entry in g_placement_policies and a
+//PLACEMENT_POLICY_TYPE (common.h) for css.properties to name.
+
+typedef struct placement_policy_t {
+    const char *name;       //its shelf.placement value
+    placement_fn choose;
+} PLACEMENT_POLICY;
+
+//Not a 'public' function; only internal to this file.
+//The overflow order to move back to its temperature shelf, if any has
+//room: of the first such temperature (HOT, COLD, FROZEN), the order that
+//goes stale first, as it gains the most from the slower decay there (the
+//top of its heap, if there are heaps)
+static ORDER *placement_move_back(ORDER **overflow, int count, const ORDER_HEAP *by_temp,
+                                    const bool room[MAX_TEMP]) {
+    ORDER *nearest;
+    TEMP t;
+    int i;
+
+    for(t = HOT; t < MAX_TEMP; t++) {
+        if(!room[t]) continue;
+        if(by_temp) {
+            if(by_temp[t].count > 0) return by_temp[t].orders[0];
+            continue;
+        }
+        nearest = NULL;
+        for(i = 0; i < count; i++) {
+            if(overflow[i]->temp == t && (nearest == NULL || overflow[i]->expiry < nearest->expiry)) {
+                nearest = overflow[i];
+            }
+        }
+        if(nearest) return nearest;
+    }
+    return NULL;
+}
+
+//Not a 'public' function; only internal to this file.
+//Value an order is delivered with if it stays on the given shelf until its
+//courier comes (order->pickup; now if not known); 0 if it goes stale first
+static double placement_delivered_value(ORDER *order, SHELF shelf, int64_t now) {
+    int64_t pickup = (order->pickup > now) ? order->pickup : now;
+
+    if(pickup >= shelf_expiry(order, shelf)) return 0;
+    return shelf_value_at(order, shelf, pickup);
+}
+
+//Not a 'public' function; only internal to this file.
+//shelf.placement = greedy: moves an order back if it can, else discards
+//the overflow order that goes stale first unless the new order does
+//(shelf.overflow.eviction = nearest_expiry) or drops the new order
+//(drop_new). With heaps the order that goes stale first is the nearest of
+//the three tops, so the choice is O(1) rather than a scan.
+static void placement_greedy(ORDER *order, ORDER **overflow, int count, const ORDER_HEAP *by_temp,
+                                const bool room[MAX_TEMP], int64_t now, PLACEMENT_CHOICE *choice) {
+    ORDER *nearest = NULL;
+    TEMP t;
+    int i;
+
+    (void)now;      //expiry alone decides
+    choice->move = placement_move_back(overflow, count, by_temp, room);
+    if(choice->move || SHELF_OVERFLOW_EVICTION != OVERFLOW_EVICT_NEAREST_EXPIRY) return;
+
+    if(by_temp) {
+        for(t = HOT; t < MAX_TEMP; t++) {
+            if(by_temp[t].count > 0 && (nearest == NULL || by_temp[t].orders[0]->expiry < nearest->expiry)) {
+                nearest = by_temp[t].orders[0];
+            }
+        }
+    } else {
+        for(i = 0; i < count; i++) {
+            if(nearest == NULL || overflow[i]->expiry < nearest->expiry) nearest = overflow[i];
+        }
+    }
+    if(nearest && nearest->expiry < shelf_expiry(order, OVERFLOW_SHELF)) choice->evict = nearest;
+}
+
+//Not a 'public' function; only internal to this file.
+//shelf.placement = lowest_value: moves an order back if it can, else
+//discards the overflow order worth the least right now, unless the new
+//order is worth no more than it
+static void placement_lowest_value(ORDER *order, ORDER **overflow, int count, const ORDER_HEAP *by_temp,
+                                const bool room[MAX_TEMP], int64_t now, PLACEMENT_CHOICE *choice) {
+    ORDER *lowest = NULL;
+    double value, lowest_value = 0;
+    int i;
+
+    choice->move = placement_move_back(overflow, count, by_temp, room);
+    if(choice->move) return;
+
+    for(i = 0; i < count; i++) {
+        value = shelf_value_at(overflow[i], OVERFLOW_SHELF, now);
+        if(lowest == NULL || value < lowest_value) {
+            lowest = overflow[i];
+            lowest_value = value;
+        }
+    }
+    if(lowest && lowest_value < shelf_value_at(order, OVERFLOW_SHELF, now)) choice->evict = lowest;
+}
+
+//Not a 'public' function; only internal to this file.
+//Delivered value per msec of the slot an order holds until its pickup
+static double placement_value_rate(ORDER *order, double delivered, int64_t now) {
+    int64_t wait = order->pickup - now;
+    
+    return delivered / ((wait > 1) ? wait : 1);
+}
+
+//Not a 'public' function; only internal to this file.
+//shelf.placement = lookahead: each order's courier is due at a known time
+//(order->pickup), so what it will be delivered with can be told now: its
+//value at pickup if it does not go stale on its shelf before then, nothing
+//otherwise.
+//A move costs no overflow space, so one is made whenever some order can
+//move: the one that gains the most delivered value on its temperature
+//shelf (of equals, the one nearest expiry). Otherwise overflow slots are
+//what is short, and an order holds its slot until its pickup, so orders
+//are compared on delivered value per msec of slot held: the overflow order
+//lowest on that is discarded if the new order is higher. An order that
+//would go stale before its courier comes is worth nothing, so it is the
+//first to go and is never shelved in place of another.
+static void placement_lookahead(ORDER *order, ORDER **overflow, int count, const ORDER_HEAP *by_temp,
+                                const bool room[MAX_TEMP], int64_t now, PLACEMENT_CHOICE *choice) {
+    double incoming = placement_delivered_value(order, OVERFLOW_SHELF, now);
+    double kept, gain, best_gain = 0, rate, lowest_rate = 0;
+    ORDER *lowest = NULL;
+    int i;
+    
+    (void)by_temp;  //pickup times decide, which no heap keeps
+    for(i = 0; i < count; i++) {
+        kept = placement_delivered_value(overflow[i], OVERFLOW_SHELF, now);
+        if(room[overflow[i]->temp]) {
+            gain = placement_delivered_value(overflow[i], (SHELF)overflow[i]->temp, now) - kept;
+            if(choice->move == NULL || gain > best_gain || 
+                        (gain == best_gain && overflow[i]->expiry < choice->move->expiry)) {
+                choice->move = overflow[i];
+                best_gain = gain;
+            }
+        }
+        rate = placement_value_rate(overflow[i], kept, now);
+        if(lowest == NULL || rate < lowest_rate) {
+            lowest = overflow[i];
+            lowest_rate = rate;
+        }
+    }
+    
+    if(choice->move) {
+        if(best_gain <= 0 && incoming <= 0) choice->move = NULL; //nothing to gain
+    } else if(lowest && placement_value_rate(order, incoming, now) > lowest_rate) {
+        choice->evict = lowest;
+    }
+}
+
+static const PLACEMENT_POLICY g_placement_policies[MAX_PLACEMENT_POLICY] = {
+    { "greedy", placement_greedy },             //PLACEMENT_GREEDY
+    { "lowest_value", placement_lowest_value }, //PLACEMENT_LOWEST_VALUE
+    { "lookahead", placement_lookahead },       //PLACEMENT_LOOKAHEAD
+};
+
+/**PROC+**********************************************************************/
+/* Name:      placement_choose                                               */
+/*                                                                           */
+/* Purpose:   Decides where an order goes when its temperature shelf and the */
+/*            overflow shelf are both full                                   */
+/*                                                                           */
+/* Params:    IN     order           - Order being shelved                   */
+/*            IN     overflow        - Orders on the overflow shelf          */
+/*            IN     count           - Number of them                        */
+/*            IN     by_temp         - Overflow orders of each temperature   */
+/*                                     in expiry heaps (MAX_TEMP of them);   */
+/*                                     NULL if the shelves keep none         */
+/*            IN     room            - Which temperature shelves have a free */
+/*                                     slot                                  */
+/*            IN     now             - msecs (clock_now_msec)                */
+/*            OUT    choice          - Order to move back or to discard;     */
+/*                                     neither to drop the new order         */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/* Operation: Hands over to the policy set by shelf.placement. Caller keeps  */
+/*            the orders from changing shelves (or being freed) until it has */
+/*            carried out the choice.                                        */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void placement_choose(ORDER *order, ORDER **overflow, int count, const ORDER_HEAP *by_temp,
+                                const bool room[MAX_TEMP], int64_t now, PLACEMENT_CHOICE *choice) {
+    PLACEMENT_POLICY_TYPE type = (SHELF_PLACEMENT_POLICY < MAX_PLACEMENT_POLICY) ?
+                                    SHELF_PLACEMENT_POLICY : PLACEMENT_GREEDY;
+
+    choice->move = NULL;
+    choice->evict = NULL;
+    g_placement_policies[type].choose(order, overflow, count, by_temp, room, now, choice);
+}
+
+//Self explanatory util method...returns string for display
+const char *placement_policy_to_str(PLACEMENT_POLICY_TYPE type) {
+    return (type < MAX_PLACEMENT_POLICY) ? g_placement_policies[type].name : "UNKNOWN";
+}
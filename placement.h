@@ -0,0 +1,27 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//What the placement policy (shelf.placement) chose for an order that fits
+//on neither its temperature shelf nor the (full) overflow shelf; with
+//neither set the new order is dropped
+typedef struct placement_choice_t {
+    ORDER *move;    //overflow order to move back to its temperature shelf
+    ORDER *evict;   //overflow order to discard in favour of the new order
+} PLACEMENT_CHOICE;
+
+//One policy: given the new order, the orders on the overflow shelf (and,
+//where the shelves keep them, the overflow orders of each temperature in
+//their expiry heaps; NULL if not), which temperature shelves have a free
+//slot and the time (msecs, clock_now_msec), it fills in the choice. It only
+//decides; the shelves carry it out.
+typedef void (*placement_fn)(ORDER *order, ORDER **overflow, int count, const ORDER_HEAP *by_temp,
+                                const bool room[MAX_TEMP], int64_t now, PLACEMENT_CHOICE *choice);
+
+void placement_choose(ORDER *order, ORDER **overflow, int count, const ORDER_HEAP *by_temp,
+                                const bool room[MAX_TEMP], int64_t now, PLACEMENT_CHOICE *choice);
+const char *placement_policy_to_str(PLACEMENT_POLICY_TYPE type);
+
+#endif //PLACEMENT_H
@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "constants.h"
+#include "courier.h"
+#include "pool.h"
+
+//objects (and the slab header in front of them) are kept on this boundary
+#define POOL_ALIGN              16
+#define POOL_ROUND_UP(n)        (((n) + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1))
+
+POOL g_order_pool      = POOL_INITIALIZER(sizeof(ORDER), POOL_OBJECTS_PER_SLAB);
+POOL g_order_node_pool = POOL_INITIALIZER(sizeof(ORDER_LL_NODE), POOL_OBJECTS_PER_SLAB);
+POOL g_timer_node_pool = POOL_INITIALIZER(sizeof(COURIER_TIMER_NODE), POOL_OBJECTS_PER_SLAB);
+ARENA g_string_arena   = ARENA_INITIALIZER(ARENA_CHUNK_SIZE);
+
+//Not a 'public' function; only internal to this file.
+//Size of one object slot; a free slot has to hold the free list link
+static size_t pool_slot_size(POOL *pool) {
+    size_t size = pool->object_size;
+
+    if(size < sizeof(void *)) size = sizeof(void *);
+    return POOL_ROUND_UP(size);
+}
+
+//Not a 'public' function; only internal to this file.
+//Adds a slab to the pool and threads all of its slots onto the free list;
+//caller holds the pool's mutex
+static bool pool_grow(POOL *pool) {
+    size_t slot = pool_slot_size(pool);
+    size_t header = POOL_ROUND_UP(sizeof(POOL_SLAB));
+    POOL_SLAB *slab = malloc(header + slot * pool->objects_per_slab);
+    char *object;
+    size_t i;
+
+    if(slab == NULL) return false;
+
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    //thread in reverse so that the free list hands out ascending addresses
+    object = (char *)slab + header + slot * pool->objects_per_slab;
+    for(i = 0; i < pool->objects_per_slab; i++) {
+        object -= slot;
+        *(void **)object = pool->free_list;
+        pool->free_list = object;
+    }
+
+    return true;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      pool_alloc                                                     */
+/*                                                                           */
+/* Purpose:   Allocates one zeroed object from a fixed size pool             */
+/*                                                                           */
+/* Params:    IN     pool            - Pool to allocate from                 */
+/*                                                                           */
+/* Returns:   void* - the object; NULL if a new slab could not be allocated  */
+/*                                                                           */
+/* Operation: Pops the pool's free list, adding a slab of                    */
+/*            objects_per_slab objects first when it is empty; the heap is   */
+/*            only touched once per slab.                                    */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void *pool_alloc(POOL *pool) {
+    void *object = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+    if(pool->free_list || pool_grow(pool)) {
+        object = pool->free_list;
+        pool->free_list = *(void **)object;
+        pool->in_use++;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if(object) memset(object, 0, pool->object_size);
+    return object;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      pool_free                                                      */
+/*                                                                           */
+/* Purpose:   Gives an object back to the pool it was allocated from         */
+/*                                                                           */
+/* Params:    IN     pool            - Pool the object came from             */
+/*            IN     object          - Object to free; NULL is ignored       */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void pool_free(POOL *pool, void *object) {
+    if(object == NULL) return;
+
+    pthread_mutex_lock(&pool->mutex);
+    *(void **)object = pool->free_list;
+    pool->free_list = object;
+    pool->in_use--;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/**PROC+**********************************************************************/
+/* Name:      pool_destroy                                                   */
+/*                                                                           */
+/* Purpose:   Returns all of a pool's slabs to the heap                      */
+/*                                                                           */
+/* Params:    IN     pool            - Pool to destroy                       */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/* Operation: Objects still in use are released along with their slabs, so  */
+/*            this is only called once nothing references them any more.     */
+/*            The pool is left empty and can be allocated from again.        */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void pool_destroy(POOL *pool) {
+    POOL_SLAB *slab;
+
+    pthread_mutex_lock(&pool->mutex);
+    while((slab = pool->slabs)) {
+        pool->slabs = slab->next;
+        free(slab);
+    }
+    pool->free_list = NULL;
+    pool->in_use = 0;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+//Not a 'public' function; only internal to this file.
+//Drops one reference to a chunk, freeing it with the last one; locked
+//tells whether the caller already holds the arena's mutex
+static void arena_chunk_put(ARENA_CHUNK *chunk, bool locked) {
+    ARENA *arena = chunk->arena;
+
+    if(__sync_sub_and_fetch(&chunk->refs, 1) == 0) {
+        if(!locked) pthread_mutex_lock(&arena->mutex);
+        if(chunk->prev) chunk->prev->next = chunk->next;
+        else arena->chunks = chunk->next;
+        if(chunk->next) chunk->next->prev = chunk->prev;
+        if(!locked) pthread_mutex_unlock(&arena->mutex);
+        free(chunk);
+    }
+}
+
+/**PROC+**********************************************************************/
+/* Name:      arena_strndup                                                  */
+/*                                                                           */
+/* Purpose:   Copies "len" bytes of a string into the arena, NUL terminated  */
+/*                                                                           */
+/* Params:    IN     arena           - Arena to allocate from                */
+/*            IN     str             - String to copy (need not be NUL       */
+/*                                     terminated)                           */
+/*            IN     len             - Count of bytes to copy                */
+/*                                                                           */
+/* Returns:   char* - the copy (freed with arena_free); NULL on failure      */
+/*                                                                           */
+/* Operation: Every copy is preceded by a pointer to its chunk, so that      */
+/*            arena_free does not need the arena. When the current chunk is  */
+/*            full it is retired (it is freed once its last string goes)     */
+/*            and a new one started; a current chunk with no live strings    */
+/*            is simply rewound. A string longer than a chunk gets a chunk   */
+/*            of its own.                                                    */
+/*                                                                           */
+/**PROC-**********************************************************************/
+char *arena_strndup(ARENA *arena, const char *str, size_t len) {
+    size_t need = sizeof(ARENA_CHUNK *) + ((len + 1 + sizeof(void *) - 1) & ~(sizeof(void *) - 1));
+    size_t header = POOL_ROUND_UP(sizeof(ARENA_CHUNK));
+    ARENA_CHUNK *chunk;
+    char *copy = NULL;
+
+    pthread_mutex_lock(&arena->mutex);
+    chunk = arena->current;
+    if(chunk && chunk->refs == 1) {
+        //only the arena's own reference is left; nobody uses the chunk
+        chunk->used = 0;
+    }
+
+    if(chunk == NULL || chunk->size - chunk->used < need) {
+        size_t size = (need > arena->chunk_size - header) ? need : arena->chunk_size - header;
+        ARENA_CHUNK *fresh = malloc(header + size);
+
+        if(fresh) {
+            fresh->arena = arena;
+            fresh->prev = NULL;
+            fresh->next = arena->chunks;
+            if(arena->chunks) arena->chunks->prev = fresh;
+            arena->chunks = fresh;
+            fresh->refs = 1;
+            fresh->used = 0;
+            fresh->size = size;
+            if(chunk) arena_chunk_put(chunk, true);
+            arena->current = chunk = fresh;
+        } else {
+            chunk = NULL;
+        }
+    }
+
+    if(chunk) {
+        char *slot = (char *)chunk + header + chunk->used;
+
+        chunk->used += need;
+        __sync_add_and_fetch(&chunk->refs, 1);
+        *(ARENA_CHUNK **)slot = chunk;
+        copy = slot + sizeof(ARENA_CHUNK *);
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+    pthread_mutex_unlock(&arena->mutex);
+
+    return copy;
+}
+
+//Copies a NUL terminated string into the arena (see arena_strndup)
+char *arena_strdup(ARENA *arena, const char *str) {
+    return arena_strndup(arena, str, strlen(str));
+}
+
+/**PROC+**********************************************************************/
+/* Name:      arena_free                                                     */
+/*                                                                           */
+/* Purpose:   Frees a string allocated by arena_strdup/arena_strndup         */
+/*                                                                           */
+/* Params:    IN     str             - String to free; NULL is ignored       */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void arena_free(char *str) {
+    if(str == NULL) return;
+
+    arena_chunk_put(*(ARENA_CHUNK **)(str - sizeof(ARENA_CHUNK *)), false);
+}
+
+/**PROC+**********************************************************************/
+/* Name:      arena_destroy                                                  */
+/*                                                                           */
+/* Purpose:   Returns all of an arena's chunks to the heap                   */
+/*                                                                           */
+/* Params:    IN     arena           - Arena to destroy                      */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/* Operation: Strings still alive are released along with their chunks, so  */
+/*            this is only called once nothing references them any more.     */
+/*            The arena is left empty and can be allocated from again.       */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void arena_destroy(ARENA *arena) {
+    ARENA_CHUNK *chunk;
+
+    pthread_mutex_lock(&arena->mutex);
+    while((chunk = arena->chunks)) {
+        arena->chunks = chunk->next;
+        free(chunk);
+    }
+    arena->current = NULL;
+    pthread_mutex_unlock(&arena->mutex);
+}
+
+/**PROC+**********************************************************************/
+/* Name:      pool_destroy_all                                               */
+/*                                                                           */
+/* Purpose:   Releases the per-run order pools and the string arena          */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/* Operation: Called from finalize() once every thread is done; orders      */
+/*            still sitting on a shelf go away with their slabs.             */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void pool_destroy_all() {
+    pool_destroy(&g_order_pool);
+    pool_destroy(&g_order_node_pool);
+    pool_destroy(&g_timer_node_pool);
+    arena_destroy(&g_string_arena);
+}
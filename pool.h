@@ -0,0 +1,71 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+//Fixed size object pool; objects are carved out of slabs which are only
+//given back to the heap by pool_destroy(), so a freed object is recycled
+//by the next pool_alloc() without going to malloc. A free object's first
+//word links it into the pool's free list. Safe to use from any thread.
+typedef struct pool_slab_t {
+    struct pool_slab_t *next;
+} POOL_SLAB;
+
+typedef struct pool_t {
+    size_t object_size;
+    size_t objects_per_slab;
+    pthread_mutex_t mutex;
+    void *free_list;
+    POOL_SLAB *slabs;
+    size_t in_use;
+} POOL;
+
+#define POOL_INITIALIZER(size, per_slab) \
+    { (size), (per_slab), PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0 }
+
+//String arena; strings are bump allocated out of chunks and every chunk
+//counts the strings still alive in it. A chunk goes back to the heap when
+//its last string is freed, or is rewound in place if it is still the
+//arena's current chunk; arena_destroy() frees whatever is left. Safe to
+//use from any thread.
+typedef struct arena_chunk_t {
+    struct arena_t *arena;
+    struct arena_chunk_t *prev;
+    struct arena_chunk_t *next;
+    int refs;       //live strings + 1 while it is the arena's current chunk
+    size_t used;
+    size_t size;
+} ARENA_CHUNK;
+
+typedef struct arena_t {
+    size_t chunk_size;
+    pthread_mutex_t mutex;
+    ARENA_CHUNK *current;
+    ARENA_CHUNK *chunks;    //every chunk not yet freed
+} ARENA;
+
+#define ARENA_INITIALIZER(chunk_size) \
+    { (chunk_size), PTHREAD_MUTEX_INITIALIZER, NULL, NULL }
+
+#define POOL_OBJECTS_PER_SLAB   256
+#define ARENA_CHUNK_SIZE        (64 * 1024)
+
+//Per-run pools of the objects every order goes through
+extern POOL g_order_pool;           //ORDER
+extern POOL g_order_node_pool;      //ORDER_LL_NODE
+extern POOL g_timer_node_pool;      //COURIER_TIMER_NODE
+extern ARENA g_string_arena;        //order id/name copies
+
+void *pool_alloc(POOL *pool);
+void pool_free(POOL *pool, void *object);
+void pool_destroy(POOL *pool);
+
+char *arena_strdup(ARENA *arena, const char *str);
+char *arena_strndup(ARENA *arena, const char *str, size_t len);
+void arena_free(char *str);
+void arena_destroy(ARENA *arena);
+
+void pool_destroy_all();
+
+#endif
@@ -4,234 +4,627 @@
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
-#include <glib.h>
-#include <sys/timeb.h>
+#include <pthread.h>
 
 #include "common.h"
 #include "constants.h"
+#include "clock.h"
+#include "trace.h"
 #include "kitchen.h"
+#include "input.h"
+#include "pool.h"
+#include "order_index.h"
+#include "shelf_soa.h"
+#include "shelf_lockfree.h"
+#include "placement.h"
+#include "event_log.h"
+#include "stats.h"
 
-GHashTable *shelf_to_hash(SHELF shelf) {
-    GHashTable *shelf_hash = (shelf==HOT_SHELF) ? g_data->g_order_id_hot_shelf_hash :
-                                ((shelf==COLD_SHELF)  ? g_data->g_order_id_cold_shelf_hash :
-                                    ((shelf==FROZEN_SHELF)  ? g_data->g_order_id_frozen_shelf_hash : 
-                                        ((shelf==OVERFLOW_SHELF)  ? g_data->g_order_id_overflow_shelf_hash : NULL)));
-    return shelf_hash;
+//guards g_discarded_count/g_discarded_value; a leaf lock
+static pthread_mutex_t g_discard_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//the clock orders are valued by when placing them (shelf_set_clock)
+static int64_t (*g_shelf_clock)() = clock_now_msec;
+
+/**PROC+**********************************************************************/
+/* Name:      shelf_lock                                                     */
+/*                                                                           */
+/* Purpose:   Locks a shelf: its array, SoA columns and deadline heap (and   */
+/*            for the overflow shelf its overflow-by-temperature heaps)      */
+/*                                                                           */
+/* Params:    IN     shelf           - Shelf to lock                         */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/* Operation: A thread holding a shelf lock only takes the locks of shelves  */
+/*            after it (HOT, COLD, FROZEN, OVERFLOW); see common.h.          */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void shelf_lock(SHELF shelf) {
+    pthread_mutex_lock(&shelf_mutex[shelf]);
+}
+
+void shelf_unlock(SHELF shelf) {
+    pthread_mutex_unlock(&shelf_mutex[shelf]);
+}
+
+//Not a 'public' function; only internal to this file.
+//Locks every shelf, in the lock order; for moves between the overflow
+//shelf and the temperature shelves
+static void shelf_lock_all() {
+    SHELF s;
+    
+    for(s = HOT_SHELF; s < MAX_SHELF; s++) shelf_lock(s);
+}
+
+//Not a 'public' function; only internal to this file.
+static void shelf_unlock_all() {
+    int s;
+    
+    for(s = MAX_SHELF - 1; s >= HOT_SHELF; s--) shelf_unlock((SHELF)s);
+}
+
+//Not a 'public' function; only internal to this file.
+//Puts an order at the end of a shelf's array (and SoA columns, if any);
+//returns its slot. Caller holds the shelf's lock.
+static int shelf_array_add(SHELF shelf, ORDER *order) {
+    SHELF_ARRAY *array = &g_data->g_shelves[shelf];
+    
+    if(array->created) shelf_soa_set(array, array->count, order);
+    array->orders[array->count] = order;
+    return array->count++;
+}
+
+//Not a 'public' function; only internal to this file.
+//Takes the order in a slot off its shelf's array; the last order of the
+//array fills the gap and its index entry follows it. Caller holds the
+//shelf's lock, but no index stripe lock.
+static void shelf_array_take(SHELF shelf, int slot) {
+    SHELF_ARRAY *array = &g_data->g_shelves[shelf];
+    ORDER *last = array->orders[--array->count];
+    
+    if(slot != array->count) {
+        array->orders[slot] = last;
+        if(array->created) shelf_soa_move(array, slot, array->count);
+        order_index_lock(&g_data->g_order_index, &last->key);
+        order_index_lookup(&g_data->g_order_index, &last->key)->slot = slot;
+        order_index_unlock(&g_data->g_order_index, &last->key);
+    }
+    array->orders[array->count] = NULL;
+}
+
+//Not a 'public' function; only internal to this file.
+//"value" of an order on the given shelf once it is elapsed_secs (whole
+//seconds) old; same formula as the monitor's, so it goes below 0 when the
+//order is stale
+static double shelf_value_after(ORDER *order, SHELF shelf, int elapsed_secs) {
+    int shelfDecayModifier = (shelf == OVERFLOW_SHELF) ? 
+                                SHELF_LIFE_MODIFIER_OVERFLOW_SHELF : SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF;
+    
+    return order->shelfLife - (order->decayRate * elapsed_secs * shelfDecayModifier);
+}
+
+//"value" of an order on the given shelf at a time (msecs, clock_now_msec)
+double shelf_value_at(ORDER *order, SHELF shelf, int64_t at) {
+    return shelf_value_after(order, shelf, (int)((at - order->created) / 1000));
+}
+
+//Time (msecs) by the shelves' clock: clock_now_msec(), or
+//whatever a benchmark replaying orders set with shelf_set_clock()
+int64_t shelf_now_msec() {
+    return g_shelf_clock();
+}
+
+void shelf_set_clock(int64_t (*clock)()) {
+    g_shelf_clock = clock ? clock : clock_now_msec;
+}
+
+//Time (msecs, clock_now_msec) an order goes stale at on the given shelf:
+//the first whole second of age at which its value is below 0. The
+//shelfLife / rate estimate is settled with the value formula itself, so
+//the monitor never finds an order at its deadline still fresh. Never, for
+//no decay.
+int64_t shelf_expiry(ORDER *order, SHELF shelf) {
+    int shelfDecayModifier = (shelf == OVERFLOW_SHELF) ? 
+                                SHELF_LIFE_MODIFIER_OVERFLOW_SHELF : SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF;
+    double rate = order->decayRate * shelfDecayModifier;
+    double secs;
+    int whole_secs;
+    
+    if(rate <= 0 || (secs = order->shelfLife / rate) > INT32_MAX - 2) return INT64_MAX;
+    
+    whole_secs = (secs < 0) ? 0 : (int)secs + 1;
+    while(whole_secs > 0 && shelf_value_after(order, shelf, whole_secs - 1) < 0) whole_secs--;
+    while(shelf_value_after(order, shelf, whole_secs) >= 0) whole_secs++;
+    return order->created + (int64_t)whole_secs * 1000;
+}
+
+//Not a 'public' function; only internal to this file.
+static void order_heap_swap(ORDER_HEAP *heap, int a, int b) {
+    ORDER *tmp = heap->orders[a];
+    
+    heap->orders[a] = heap->orders[b];
+    heap->orders[b] = tmp;
+    heap->orders[a]->heapPos[heap->kind] = a;
+    heap->orders[b]->heapPos[heap->kind] = b;
+}
+
+//Not a 'public' function; only internal to this file.
+//Restores the heap order (smallest expiry first) around position i, after
+//the order there was put there or had its expiry changed
+static void order_heap_fix(ORDER_HEAP *heap, int i) {
+    ORDER **orders = heap->orders;
+    int parent, child;
+    
+    while(i > 0 && orders[(parent = (i - 1) / 2)]->expiry > orders[i]->expiry) {
+        order_heap_swap(heap, i, parent);
+        i = parent;
+    }
+    while((child = 2 * i + 1) < heap->count) {
+        if(child + 1 < heap->count && orders[child + 1]->expiry < orders[child]->expiry) child++;
+        if(orders[i]->expiry <= orders[child]->expiry) break;
+        order_heap_swap(heap, i, child);
+        i = child;
+    }
+}
+
+//Not a 'public' function; only internal to this file.
+//Adds an order to a heap; O(log n)
+static void order_heap_push(ORDER_HEAP *heap, ORDER *order) {
+    int i = heap->count++;
+    
+    heap->orders[i] = order;
+    order->heapPos[heap->kind] = i;
+    order_heap_fix(heap, i);
+}
+
+//Not a 'public' function; only internal to this file.
+//Takes an order out of a heap, wherever it is in it; O(log n)
+static void order_heap_remove(ORDER_HEAP *heap, ORDER *order) {
+    int last = --heap->count;
+    int i = order->heapPos[heap->kind];
+    
+    if(i != last) {
+        heap->orders[i] = heap->orders[last];
+        heap->orders[i]->heapPos[heap->kind] = i;
+        heap->orders[last] = NULL;
+        order_heap_fix(heap, i);
+    } else {
+        heap->orders[last] = NULL;
+    }
+}
+
+//Not a 'public' function; only internal to this file.
+//Shelves a new order: adds it to the order index, to the shelf's array and,
+//by its expiry on that shelf, to the shelf's deadline heap (and on the
+//overflow shelf to its temperature's heap). Caller holds the shelf's lock.
+static bool shelf_add_order(ORDER *order, SHELF shelf) {
+    ORDER_INDEX_ENTRY *entry;
+    
+    order_index_lock(&g_data->g_order_index, &order->key);
+    entry = order_index_insert(&g_data->g_order_index, order);
+    if(entry) {
+        entry->shelf = shelf;
+        entry->slot = g_data->g_shelves[shelf].count;
+    }
+    order_index_unlock(&g_data->g_order_index, &order->key);
+    if(entry == NULL) return false;
+    
+    shelf_array_add(shelf, order);
+    order->expiry = shelf_expiry(order, shelf);
+    order_heap_push(&g_data->g_deadlines[shelf], order);
+    if(shelf == OVERFLOW_SHELF) order_heap_push(&g_data->g_overflow_by_temp[order->temp], order);
+    monitor_arm(order->expiry);
+    print_order_delta(ORDER_DELTA_PLACED, order, shelf);
+    
+    TRACE(SHELF, L1, "order id %.*s shelf %s\n", (int)order->id_len, order->id, ordershelf_to_str(shelf));
+    return true;
+}
+
+//Not a 'public' function; only internal to this file.
+//Takes an order off its shelf: the index, the shelf's array and its heaps.
+//Caller holds the shelf's lock.
+static void shelf_remove_order(SHELF shelf, ORDER *order) {
+    ORDER_INDEX_ENTRY *entry;
+    int slot;
+    
+    order_index_lock(&g_data->g_order_index, &order->key);
+    entry = order_index_lookup(&g_data->g_order_index, &order->key);
+    slot = entry->slot;
+    order_index_remove(&g_data->g_order_index, entry);
+    order_index_unlock(&g_data->g_order_index, &order->key);
+    
+    shelf_array_take(shelf, slot);
+    order_heap_remove(&g_data->g_deadlines[shelf], order);
+    if(shelf == OVERFLOW_SHELF) order_heap_remove(&g_data->g_overflow_by_temp[order->temp], order);
+}
+
+//Not a 'public' function; only internal to this file.
+//Moves an overflow order back to its temperature shelf, where it decays
+//slower (so its deadline moves out). Caller holds both shelves' locks.
+static void shelf_move_from_overflow(ORDER *order) {
+    SHELF shelf = (SHELF)order->temp; //using temperature as shelf
+    ORDER_INDEX_ENTRY *entry;
+    int slot;
+    
+    order_index_lock(&g_data->g_order_index, &order->key);
+    entry = order_index_lookup(&g_data->g_order_index, &order->key);
+    slot = entry->slot;
+    entry->shelf = shelf;
+    entry->slot = g_data->g_shelves[shelf].count;
+    order_index_unlock(&g_data->g_order_index, &order->key);
+    
+    shelf_array_take(OVERFLOW_SHELF, slot);
+    order_heap_remove(&g_data->g_overflow_by_temp[order->temp], order);
+    order_heap_remove(&g_data->g_deadlines[OVERFLOW_SHELF], order);
+    
+    shelf_array_add(shelf, order);
+    order->expiry = shelf_expiry(order, shelf);
+    order_heap_push(&g_data->g_deadlines[shelf], order);
+    print_order_delta(ORDER_DELTA_MOVED, order, shelf);
+    stats_count_move(order->temp);
+}
+
+//Not a 'public' function; only internal to this file.
+//Accounts for (and prints) the value of an order discarded for want of
+//shelf space; a stale order is worth nothing
+static void shelf_report_discard(ORDER *order, SHELF shelf) {
+    double value = shelf_value_at(order, shelf, shelf_now_msec());
+    
+    if(value < 0) value = 0;
+    pthread_mutex_lock(&g_discard_mutex);
+    g_data->g_discarded_count++;
+    g_data->g_discarded_value += value;
+    pthread_mutex_unlock(&g_discard_mutex);
+    if(SYSTEM_PRINT_SHELF_CONTENTS && SYSTEM_PRINT_MODE == PRINT_MODE_FULL) {
+        event_log_discard(order->id, order->id_len, value, placement_policy_to_str(SHELF_PLACEMENT_POLICY));
+    }
+    print_order_delta(ORDER_DELTA_DISCARDED_SHELF_FULL, order, shelf);
+    stats_count(ORDER_DISCARDED_SHELF_FULL, shelf, order->temp);
+}
+
+//Not a 'public' function; only internal to this file.
+//Accounts for (and prints) an order of no known temperature, which no shelf
+//takes: it is discarded on arrival worth nothing and counted on its own
+//(stats_count_unknown_temp), neither by shelf nor with the shelf full ones
+static void shelf_report_unknown_temp(ORDER *order) {
+    if(SYSTEM_PRINT_SHELF_CONTENTS && SYSTEM_PRINT_MODE == PRINT_MODE_FULL) {
+        event_log_discard(order->id, order->id_len, 0, "unknown temperature");
+    }
+    print_order_delta(ORDER_DELTA_DISCARDED_SHELF_FULL, order, MAX_SHELF);
+    stats_count_unknown_temp();
 }
 
 //Internal method but key logic is here for shelving orders
 //It goes as follows
 //      - if shelf space is there for matching heat order, then it stores in the shelf
 //      - else if shelf space is there in overflow shelf, then it stores in the shelf
-//      - else if some order in overflow can be moved to its "matching heat shelf" it does that
-//      - else...
-//              problem statement calls for selecting something in overflow at random and discard
-//              logic in this function simply discards the new order.
-static bool shelf_place_order_in_shelf(ORDER *order, SHELF *shelf, int shelf_size) {
+//      - else the placement policy (shelf.placement, placement.c) chooses one of
+//              moving an overflow order back to its "matching heat shelf" (one with
+//              room) and putting the new order in its place, discarding an overflow
+//              order for the new order, or dropping the new order.
+//The first two steps lock just the one shelf they look at; the rest may move
+//orders between the overflow shelf and any temperature shelf, so it locks all
+//of them (in the lock order) and looks at the shelves again. *evicted is set
+//if an overflow order was discarded to make room; as no lock is held on
+//return, the order may already be gone again when shelved (e.g. stale).
+static bool shelf_place_order_in_shelf(ORDER *order, SHELF *shelf, int shelf_size, bool *evicted) {
     TEMP temp_iter;
-    char time_str_buf[64];
     bool order_shelved_success = true;
     
-    GHashTable *shelf_hash = shelf_to_hash(*shelf);
+    SHELF_ARRAY *overflow = &g_data->g_shelves[OVERFLOW_SHELF];
+    *evicted = false;
     
-    if(g_hash_table_size(shelf_hash) < shelf_size) {
-        g_hash_table_insert(shelf_hash, order->id, order);
-    } else if (g_hash_table_size(g_data->g_order_id_overflow_shelf_hash) < OVERFLOW_SHELF_MAX_SIZE) { 
-        current_time_msec(time_str_buf);
-        if(SYSTEM_DEBUG_LEVEL & L2) printf("%s: shelf   : L2: OVERFLOW SIZE %d\n", time_str_buf, 
-                    g_hash_table_size(g_data->g_order_id_overflow_shelf_hash));
-        
-        g_hash_table_insert(g_data->g_order_id_overflow_shelf_hash, order->id, order);
-        *shelf = OVERFLOW_SHELF;
-        if(SYSTEM_DEBUG_LEVEL & L2) printf("%s: shelf   : L2: order id %s temp %s\n", time_str_buf, order->id, "MOVE TO OVERFLOW"); 
-        
-        if(SYSTEM_DEBUG_LEVEL & L2) printf("%s: shelf   : L2: overflow-temp-arr-sz is %d temp %s; order is %p\n", 
-                    time_str_buf, g_data->g_overflow_by_temp_array_sz[order->temp], 
-                    ordertemp_to_str(order->temp), order);
-                                    
-        ORDER** overflow_by_temp = g_data->g_overflow_by_temp_array[order->temp];
-        overflow_by_temp[g_data->g_overflow_by_temp_array_sz[order->temp]] = order;
+    shelf_lock(*shelf);
+    if(g_data->g_shelves[*shelf].count < shelf_size) {
+        order_shelved_success = shelf_add_order(order, *shelf);
+        shelf_unlock(*shelf);
+        return order_shelved_success;
+    }
+    shelf_unlock(*shelf);
+    
+    shelf_lock(OVERFLOW_SHELF);
+    if (overflow->count < OVERFLOW_SHELF_MAX_SIZE) { 
+        TRACE(SHELF, L2, "OVERFLOW SIZE %d\n", overflow->count);
+        TRACE(SHELF, L2, "order id %.*s temp %s\n", (int)order->id_len, order->id, "MOVE TO OVERFLOW");
         
-        g_data->g_overflow_by_temp_array_sz[order->temp]++;
-    }else {
-        //can we move items from overflow to a free shelf ?
-        bool moved_from_overflow = false;
-        GHashTable *other_shelf_hash; //the hash/shelf to move the item from overflow to
-        int other_shelf_max_sz, overflow_by_temp_sz;
-        ORDER *moved_order;
+        order_shelved_success = shelf_add_order(order, OVERFLOW_SHELF);
+        if(order_shelved_success) *shelf = OVERFLOW_SHELF;
+        shelf_unlock(OVERFLOW_SHELF);
+        return order_shelved_success;
+    }
+    shelf_unlock(OVERFLOW_SHELF);
+    
+    shelf_lock_all();
+    if(g_data->g_shelves[*shelf].count < shelf_size) {
+        //a pickup made room meanwhile
+        order_shelved_success = shelf_add_order(order, *shelf);
+    } else if (overflow->count < OVERFLOW_SHELF_MAX_SIZE) {
+        order_shelved_success = shelf_add_order(order, OVERFLOW_SHELF);
+        if(order_shelved_success) *shelf = OVERFLOW_SHELF;
+    } else {
+        //up to the policy: move an order back, evict one, or drop the new one
+        PLACEMENT_CHOICE choice;
+        bool room[MAX_TEMP];
         
-        current_time_msec(time_str_buf);        
-        for(temp_iter = HOT; (temp_iter < MAX_TEMP && !moved_from_overflow); temp_iter++) {
-            overflow_by_temp_sz = g_data->g_overflow_by_temp_array_sz[temp_iter];
-            if(overflow_by_temp_sz > 0) {
-                other_shelf_hash = shelf_to_hash(temp_iter); //using temperature as shelf
-                other_shelf_max_sz = ordershelf_to_max_size(temp_iter);
-                if(g_hash_table_size(other_shelf_hash) < other_shelf_max_sz) {
-                    //this shelf has space
-                    
-                    //Step 1: moved item back to its single-temperature shelf
-                    moved_order = g_data->g_overflow_by_temp_array[temp_iter][overflow_by_temp_sz-1];
-                    
-                    //order removed from OVERFLOW shelf
-                    g_hash_table_remove(g_data->g_order_id_overflow_shelf_hash, moved_order->id);
-                    g_data->g_overflow_by_temp_array[temp_iter][overflow_by_temp_sz-1] = NULL;
-                    //order removed also from the overlow-sz-array
-                    g_data->g_overflow_by_temp_array_sz[temp_iter]--; 
-                    
-                    g_hash_table_insert(other_shelf_hash, moved_order->id, moved_order);
-                    int *ptr_shelf = g_hash_table_lookup(g_data->g_order_id_shelf_hash, moved_order->id);
-                    *ptr_shelf = (int)temp_iter; //using temperature as shelf
-                    
-                    if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: shelf   : L1: moved order temp array sz %d temp %s...\n", 
-                                time_str_buf, g_data->g_overflow_by_temp_array_sz[temp_iter], 
-                                ordertemp_to_str(temp_iter));
-                    
-                    //Step 2: now add new item to the overflow shelf
-                    //new order inserted into overflow
-                    g_hash_table_insert(g_data->g_order_id_overflow_shelf_hash, order->id, order);
-                    *shelf = OVERFLOW_SHELF;
-                    ORDER** overflow_by_temp = g_data->g_overflow_by_temp_array[order->temp];
-                    //new order inserted also to the overlow-sz-array
-                    overflow_by_temp[g_data->g_overflow_by_temp_array_sz[order->temp]] = order; 
-                    g_data->g_overflow_by_temp_array_sz[order->temp]++;
-                    
-                    if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: shelf   : L1: new order temp array sz %d temp %s...\n", time_str_buf, 
-                                    g_data->g_overflow_by_temp_array_sz[order->temp], 
-                                    ordertemp_to_str(order->temp));
-                    if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: shelf   : L1: moving order id %s from OVERFLOW to temp %s...\n", 
-                                    time_str_buf, moved_order->id, ordertemp_to_str(temp_iter));
-                    if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: shelf   : L1: moved hash size %d overflow hash size %d other_shelf_max_sz %d...\n", 
-                                    time_str_buf, g_hash_table_size(other_shelf_hash), 
-                                    g_hash_table_size(g_data->g_order_id_overflow_shelf_hash), 
-                                    other_shelf_max_sz);
-                    
-                    moved_from_overflow = true;
-                } else {
-                    if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: shelf   : L1: overflow_by_temp_sz %d other_shelf_hash %d...\n", 
-                                    time_str_buf, overflow_by_temp_sz, g_hash_table_size(other_shelf_hash));
-                    if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: shelf   : L1: shelf %s is FULL for order->id %s...\n", 
-                                    time_str_buf, ordertemp_to_str(temp_iter), order->id);
-                }
-            } else {
-                if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: shelf   : L1: overflow_by_temp_sz is ZERO %s...\n", 
-                                    time_str_buf, ordertemp_to_str(temp_iter));
-            }               
+        for(temp_iter = HOT; temp_iter < MAX_TEMP; temp_iter++) {
+            //using temperature as shelf
+            room[temp_iter] = g_data->g_shelves[temp_iter].count < ordershelf_to_max_size((SHELF)temp_iter);
         }
+        placement_choose(order, overflow->orders, overflow->count, g_data->g_overflow_by_temp,
+                            room, shelf_now_msec(), &choice);
         
-        if(!moved_from_overflow) {
-            //the order is dropped; 
-            if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: shelf   : L1: order->id %s order %p order->id %p could NOT be shelved; it will be dropped\n", 
-                                    time_str_buf, order->id, order, order->id);
-            if(SYSTEM_DEBUG_LEVEL & L4) printf("%s: shelf   : L4: order->id %s will be dropped\n", time_str_buf, order->id);
+        if(choice.move) {
+            //Step 1: moved item back to its single-temperature shelf
+            shelf_move_from_overflow(choice.move);
+            
+            TRACE(SHELF, L1, "moving order id %.*s from OVERFLOW to temp %s...\n",
+                            (int)choice.move->id_len, choice.move->id, ordertemp_to_str(choice.move->temp));
             
-            //TODO: instead of taking an existing order at random, why not drop the new order itself ?
-            //      Revisit this logic and confirm
+            //Step 2: now add new item to the overflow shelf
+            order_shelved_success = shelf_add_order(order, OVERFLOW_SHELF);
+            if(order_shelved_success) *shelf = OVERFLOW_SHELF;
+            
+            TRACE(SHELF, L1, "moved shelf size %d overflow shelf size %d...\n",
+                            g_data->g_shelves[choice.move->temp].count, overflow->count);
+        } else if(choice.evict) {
+            //make room by discarding the overflow order the policy picked
+            TRACE(SHELF, L4, "discarding order->id %.*s (%s) for order->id %.*s\n",
+                            (int)choice.evict->id_len, choice.evict->id, placement_policy_to_str(SHELF_PLACEMENT_POLICY),
+                            (int)order->id_len, order->id);
+            shelf_report_discard(choice.evict, OVERFLOW_SHELF);
+            shelf_release_order(OVERFLOW_SHELF, choice.evict);
+            *evicted = true;
+            
+            order_shelved_success = shelf_add_order(order, OVERFLOW_SHELF);
+            if(order_shelved_success) *shelf = OVERFLOW_SHELF;
+        } else {
+            //the order is dropped; 
+            TRACE(SHELF, L1, "order->id %.*s order %p order->id %p could NOT be shelved; it will be dropped\n",
+                                    (int)order->id_len, order->id, order, order->id);
+            TRACE(SHELF, L4, "order->id %.*s will be dropped\n", (int)order->id_len, order->id);
             
             //free(order); //done in shelf_store_orders()
             order_shelved_success = false;
-        } else {
-            *shelf = OVERFLOW_SHELF;
-            //also update the moved item's new shelf
         }
     }
+    shelf_unlock_all();
+
+    return order_shelved_success;
+}
 
+/**PROC+**********************************************************************/
+/* Name:      shelf_store_order                                              */
+/*                                                                           */
+/* Purpose:   To shelf one newly ingested order                              */
+/*                                                                           */
+/* Params:    IN     order           - Order to shelve                       */
+/*                                                                           */
+/* Returns:   bool - true if shelved; false if it was discarded (and freed). */
+/*                                                                           */
+/*                                                                           */
+/* Operation: Places the order (shelf_place_order_in_shelf, or the lock-free */
+/*            shelves with shelf.concurrency = lockfree), counts it read by  */
+/*            the shelf it went on (stats.c) and emits the                   */
+/*            ORDER_DISCARDED_SHELF_FULL events. Takes the shelf locks it    */
+/*            needs itself (caller holds none), so any number of threads     */
+/*            may shelve at once; once shelved, an order belongs to the      */
+/*            shelves and is not looked at here again. Shelving arms the     */
+/*            monitor for the order's expiry if that is the nearest one.     */
+/*            An order of no known temperature goes on no shelf: it is       */
+/*            discarded worth nothing and counted apart from the shelves.    */
+/*                                                                           */
+/**PROC-**********************************************************************/
+bool shelf_store_order(ORDER *order) {
+    bool order_shelved_success = false, evicted = false;
+    ORDER *victim = NULL;
+    SHELF s = (SHELF)(order->temp);
+    TEMP temp = order->temp; //the order is not ours to look at once shelved
+    
+    TRACE(SHELF, L2, "order id %.*s temp %s\n", (int)order->id_len, order->id, ordertemp_to_str(order->temp));
+    print_order_delta(ORDER_DELTA_READ, order, (temp < MAX_TEMP) ? s : MAX_SHELF);
+    
+    switch(order->temp) {
+    case HOT:
+    case COLD:
+    case FROZEN:
+        if(SHELF_CONCURRENCY_TYPE == SHELF_CONCURRENCY_LOCKFREE) {
+            order_shelved_success = shelf_lf_place_order(order, &s, &victim);
+            if(victim) {
+                shelf_report_discard(victim, OVERFLOW_SHELF);
+                order_release(victim);
+                evicted = true;
+            }
+        } else {
+            order_shelved_success = shelf_place_order_in_shelf(order, &s, 
+                                                ordershelf_to_max_size((SHELF)order->temp), &evicted);
+        }
+        break;
+    default:
+        //unknown temperature: no shelf to count it by or value it at
+        shelf_report_unknown_temp(order);
+        order_release(order);
+        return false;
+    }
+    
+    stats_count(ORDER_READ, s, temp);
+    if(evicted) print_event_shelf_contents(ORDER_DISCARDED_SHELF_FULL);
+    if(!order_shelved_success) {
+        shelf_report_discard(order, s);
+        print_event_shelf_contents(ORDER_DISCARDED_SHELF_FULL);
+        
+        //free order memory
+        TRACE(SHELF, L1, "FREE order->id %p order->name %p order %p\n", order->id, order->name, order);
+        order_release(order);
+    }
     return order_shelved_success;
 }
 
 /**PROC+**********************************************************************/
 /* Name:      shelf_store_orders                                             */
 /*                                                                           */
-/* Purpose:   To handle order stalenss (as per "Shelf Life" section in       */
-/*            problem statement.                                             */
+/* Purpose:   To shelf the orders ingested in "this" cycle                   */
 /*                                                                           */
-/* Params:    IN/OUT   this_cycle_order  - In the global LL this is the      */
-/*                                         head of the subset to shelf in    */
-/*                                         "this" cycle                      */
+/* Params:    None                                                           */
 /*                                                                           */
 /* Returns:   None                                                           */
 /*                                                                           */
 /*                                                                           */
-/* Operation: Iterate thru the portion of LL (linked list), shelf them in    */
-/*            the order which they were read in. In the process if the LL    */
-/*            node is freed, adjust the global LL head/tail accordingly      */
+/* Operation: Iterate thru the LL (linked list), which only holds the        */
+/*            orders read in this cycle, and shelf them in the order which   */
+/*            they were read in (shelf_store_order). A discarded order is    */
+/*            freed and its node's data set to NULL; the nodes themselves    */
+/*            are released by the kitchen at the end of the cycle            */
+/*            (input_release_orders).                                        */
 /*                                                                           */
 /**PROC-**********************************************************************/
-void shelf_store_orders(ORDER_LL_NODE **this_cycle_order) {
-    ORDER_LL_NODE *iter, *prev = NULL, *ll_node_to_free;
-    bool order_shelved_success = false;
-    char time_str_buf[64];
-    
-    current_time_msec(time_str_buf);
-    if(SYSTEM_DEBUG_LEVEL & L2) printf("%s: shelf   : L2: started shelving ingested orders this_cycle_order %p\n", 
-                            time_str_buf, *this_cycle_order);  
-
-    //For the first time, start from LL HEAD; for subsequent times, from last
-    //run's TAIL's next item (which is the first items read in "this" ingestino
-    //cycle
-    iter = (g_data->g_order_ll_head==*this_cycle_order) ? 
-                        *this_cycle_order : (*this_cycle_order)->next;
-    
-    while(iter) {
-        ORDER *order = iter->data;
-        if(SYSTEM_DEBUG_LEVEL & L2) printf("%s: shelf   : L2: order id %s temp %s\n", time_str_buf, order->id, 
-                    ordertemp_to_str(order->temp));
-        SHELF s = (SHELF)(order->temp);
+void shelf_store_orders() {
+    ORDER_LL_NODE *iter;
+    
+    TRACE(SHELF, L2, "started shelving ingested orders head %p\n", g_data->g_order_ll_head);
+
+    for(iter = g_data->g_order_ll_head; iter; iter = iter->next) {
+        if(!shelf_store_order(iter->data)) iter->data = NULL;
+    }    
+}
+
+/**PROC+**********************************************************************/
+/* Name:      shelf_release_order                                            */
+/*                                                                           */
+/* Purpose:   Takes an order that is leaving its shelf (found stale by the   */
+/*            monitor, or evicted) out of the system and frees it            */
+/*                                                                           */
+/* Params:    IN     shelf           - Shelf the order is on                 */
+/*            IN     order           - Order to release                      */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/*                                                                           */
+/* Operation: Takes the order off its shelf's array, its deadline heap and,  */
+/*            for the overflow shelf, its overflow-by-temperature heap,      */
+/*            drops its index entry and then frees the order                 */
+/*            (order_release). Caller holds the shelf's lock.                */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void shelf_release_order(SHELF shelf, ORDER *order) {
+    
+    shelf_remove_order(shelf, order);
+    
+    TRACE(SHELF, L1, "FREE order->id %p order->name %p order %p\n", order->id, order->name, order);
+    order_release(order);
+}
+
+/**PROC+**********************************************************************/
+/* Name:      shelf_rebalance                                                */
+/*                                                                           */
+/* Purpose:   Promotes overflow orders to a temperature shelf that has room  */
+/*            again (after a pickup or a stale discard)                      */
+/*                                                                           */
+/* Params:    IN     shelf           - Temperature shelf a slot freed up on  */
+/*                                                                           */
+/* Returns:   Number of orders moved from the overflow shelf.                */
+/*                                                                           */
+/*                                                                           */
+/* Operation: While the shelf has room, the top of the overflow heap of its  */
+/*            temperature (the order there to go stale first, so the one     */
+/*            worth the least by then) moves back, where it decays at the    */
+/*            single temperature rate; O(log n) a move, no scan. An order    */
+/*            already stale is left for the monitor to discard. Caller holds */
+/*            the shelf's lock (the overflow one comes after it in the lock  */
+/*            order) but not the overflow shelf's. Nothing to do with        */
+/*            shelf.concurrency = lockfree, which keeps no such heaps.       */
+/*                                                                           */
+/**PROC-**********************************************************************/
+int shelf_rebalance(SHELF shelf) {
+    ORDER_HEAP *heap;
+    ORDER *order;
+    int64_t now;
+    int moved = 0;
+    
+    if(shelf == OVERFLOW_SHELF || SHELF_CONCURRENCY_TYPE == SHELF_CONCURRENCY_LOCKFREE) return 0;
+    
+    heap = &g_data->g_overflow_by_temp[shelf]; //using temperature as shelf
+    now = shelf_now_msec();
+    shelf_lock(OVERFLOW_SHELF);
+    while(heap->count > 0 && g_data->g_shelves[shelf].count < ordershelf_to_max_size(shelf)) {
+        order = heap->orders[0];
+        if(order->expiry <= now) break;
+        shelf_move_from_overflow(order);
+        moved++;
         
-        switch(order->temp) {
-        case HOT:
-        case COLD:
-        case FROZEN:
-            order_shelved_success = shelf_place_order_in_shelf(order, &s, 
-                                                ordershelf_to_max_size(order->temp));
-            break;
-        default:
-            break;
-        }
+        TRACE(SHELF, L2, "promoted order id %.*s from OVERFLOW to %s\n", (int)order->id_len, order->id, ordershelf_to_str(shelf));
+    }
+    shelf_unlock(OVERFLOW_SHELF);
+    return moved;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      shelf_take_order                                               */
+/*                                                                           */
+/* Purpose:   Takes an order off its shelf by its key (on pickup)            */
+/*                                                                           */
+/* Params:    IN     key             - Key of the order                      */
+/*                                                                           */
+/* Returns:   ORDER* - the order, now the caller's to free (order_release);  */
+/*            NULL if it is on no shelf (e.g. discarded as stale).           */
+/*                                                                           */
+/* Operation: The index tells which shelf to lock; the shelf lock comes      */
+/*            before the stripe lock, so the entry is looked up again with   */
+/*            both held. If the order moved shelves in between (overflow to  */
+/*            its temperature shelf) this is retried with the new shelf. A   */
+/*            slot freed on a temperature shelf goes to an overflow order of */
+/*            its temperature right away (shelf_rebalance). Caller holds no  */
+/*            locks. The lock-free shelves have their own                    */
+/*            (shelf_lf_take_order).                                         */
+/*                                                                           */
+/**PROC-**********************************************************************/
+ORDER *shelf_take_order(const ORDER_KEY *key) {
+    ORDER_INDEX_ENTRY *entry;
+    ORDER *order;
+    SHELF shelf;
+    
+    if(SHELF_CONCURRENCY_TYPE == SHELF_CONCURRENCY_LOCKFREE) return shelf_lf_take_order(key);
+    
+    while(1) {
+        order_index_lock(&g_data->g_order_index, key);
+        entry = order_index_lookup(&g_data->g_order_index, key);
+        if(entry) shelf = entry->shelf;
+        order_index_unlock(&g_data->g_order_index, key);
+        if(entry == NULL) return NULL;
         
-        if(!order_shelved_success) {
-            print_event_shelf_contents(ORDER_DISCARDED_SHELF_FULL);
-            ll_node_to_free = iter; //to free this LL node
-            if(prev) {
-                prev->next = iter->next;
-                iter = prev->next;
-            } else {
-                iter = iter->next;
-            }   
-
-            bool is_tail = g_data->g_order_ll_tail==ll_node_to_free;
-            if(is_tail) {
-                g_data->g_order_ll_tail = prev ? prev : *this_cycle_order;
-                if(!prev) (*this_cycle_order)->next = NULL; //no items shelved in this cycle
-            }
-            
-            bool is_head = g_data->g_order_ll_head==ll_node_to_free;
-            if(is_head) {
-                g_data->g_order_ll_head = iter;
-                *this_cycle_order = iter; //let calling point know
-            }
-            
-            if(SYSTEM_DEBUG_LEVEL & L3) printf("%s: shelf   : L3: is_tail ? %s is_head ? %s iter is NULL ? %s iter %p ll_node_to_free %p prev %p\n", 
-                        time_str_buf, is_tail? "YES": "NO", 
-                        is_head ? "YES":"NO", iter ? "NO" : "YES", iter, ll_node_to_free, prev);
-            
-            //free order memory
-            free(ll_node_to_free);
-            
-            if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: shelf   : L1: FREE order->id %p order->name %p order %p\n", 
-                        time_str_buf, order->id, order->name, order);
-            free(order->id);
-            free(order->name);
-            free(order);
-            continue;
-        } else {
-            int *ptr_shelf = (int*)(malloc(sizeof(int)));
-            *ptr_shelf = (int)s;
-            if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: shelf   : L1: order id %s shelf ptr %p\n", 
-                        time_str_buf, order->id, ptr_shelf);
-            g_hash_table_insert(g_data->g_order_id_shelf_hash, order->id, ptr_shelf);
+        shelf_lock(shelf);
+        order_index_lock(&g_data->g_order_index, key);
+        entry = order_index_lookup(&g_data->g_order_index, key);
+        order = (entry && entry->shelf == shelf) ? entry->order : NULL;
+        order_index_unlock(&g_data->g_order_index, key);
+        
+        if(order) {
+            shelf_remove_order(shelf, order);
+            print_order_delta(ORDER_DELTA_DELIVERED, order, shelf);
+            stats_count(ORDER_DELIVERED, shelf, order->temp);
+            shelf_rebalance(shelf);
         }
+        shelf_unlock(shelf);
         
-        prev = iter;
-        iter = iter->next;
-    }    
+        if(order || entry == NULL) return order;
+    }
+}
+
+/**PROC+**********************************************************************/
+/* Name:      shelf_report_discards                                          */
+/*                                                                           */
+/* Purpose:   Prints how many orders were discarded for want of shelf space  */
+/*            and the total value they had when discarded                    */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/* Operation: Lets the placement policies (shelf.placement) be compared on  */
+/*            the same orders file.                                          */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void shelf_report_discards() {
+    printf("DISCARDED (SHELF FULL): %d orders, total value %f (%s, %s)\n", 
+                g_data->g_discarded_count, g_data->g_discarded_value, 
+                placement_policy_to_str(SHELF_PLACEMENT_POLICY), 
+                overflow_eviction_to_str(SHELF_OVERFLOW_EVICTION));
 }
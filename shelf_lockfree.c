@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+
+#include "common.h"
+#include "constants.h"
+#include "trace.h"
+#include "kitchen.h"
+#include "input.h"
+#include "order_index.h"
+#include "shelf_lockfree.h"
+#include "placement.h"
+#include "stats.h"
+
+//Lock-free shelves (shelf.concurrency = lockfree). Every shelf is a fixed
+//array of slots plus a bitmap of the claimed ones: a slot is claimed by
+//CAS-ing its bit on and freed by clearing the bit atomically. An order is
+//published in its slot (orders[slot]) only once its index entry is there.
+//
+//Whoever swaps a slot from its order to NULL owns that order: a courier
+//picking it up, the monitor discarding it, the kitchen moving or evicting
+//it, or the printout looking at it. Anyone else finds the slot empty (but
+//still claimed) and tries again later or passes it by. The owner then
+//drops or moves the index entry and either frees the slot or reuses it.
+//
+//An order is only dereferenced by its owner, or by a courier that holds
+//the order's index stripe lock while the entry is still in place (the
+//entry goes before the order is freed). Scans of a shelf go by the slot's
+//deadline column instead and confirm what they found once they own the
+//order: a slot may have been reused by an order that got the same
+//(pooled) address.
+
+#define SHELF_LF_ATTEMPTS   4   //placement rounds before an order is dropped
+
+//Not a 'public' function; only internal to this file.
+//Claims a free slot of a shelf; -1 if it is full
+static int shelf_lf_claim(SHELF_ARRAY *array) {
+    int word, words = (array->capacity + 63) / 64;
+    uint64_t bits, usable, free_bits;
+
+    for(word = 0; word < words; word++) {
+        usable = (word == words - 1 && array->capacity % 64) ?
+                        (1ULL << (array->capacity % 64)) - 1 : ~0ULL;
+        bits = __atomic_load_n(&array->occupied[word], __ATOMIC_ACQUIRE);
+        while((free_bits = ~bits & usable) != 0) {
+            //on failure bits is reloaded with the word as it is now
+            if(__atomic_compare_exchange_n(&array->occupied[word], &bits,
+                        bits | (free_bits & -free_bits), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __sync_fetch_and_add(&array->count, 1);
+                return word * 64 + __builtin_ctzll(free_bits);
+            }
+        }
+    }
+    return -1;
+}
+
+//Not a 'public' function; only internal to this file.
+//Frees a claimed slot; its order (if any) is gone already
+static void shelf_lf_unclaim(SHELF_ARRAY *array, int slot) {
+    __sync_fetch_and_sub(&array->count, 1);
+    __sync_fetch_and_and(&array->occupied[slot / 64], ~(1ULL << (slot % 64)));
+}
+
+//Not a 'public' function; only internal to this file.
+//Whether a slot is claimed; it may be empty for a moment while its order
+//is borrowed, moved or still being shelved
+static bool shelf_lf_claimed(SHELF_ARRAY *array, int slot) {
+    return (__atomic_load_n(&array->occupied[slot / 64], __ATOMIC_ACQUIRE) >> (slot % 64)) & 1;
+}
+
+//Not a 'public' function; only internal to this file.
+//Takes the order in a slot for the caller; false if it is not there (any
+//more)
+static bool shelf_lf_own(SHELF_ARRAY *array, int slot, ORDER *order) {
+    return __sync_bool_compare_and_swap(&array->orders[slot], order, NULL);
+}
+
+//Not a 'public' function; only internal to this file.
+//Puts an order in a slot the caller has claimed (or owns), columns first
+static void shelf_lf_publish(SHELF_ARRAY *array, int slot, ORDER *order) {
+    __atomic_store_n(&array->deadline[slot], order->expiry, __ATOMIC_RELAXED);
+    __atomic_store_n(&array->orders[slot], order, __ATOMIC_RELEASE);
+}
+
+//Not a 'public' function; only internal to this file.
+//Drops the index entry of an order the caller owns
+static void shelf_lf_unindex(ORDER *order) {
+    ORDER_INDEX_ENTRY *entry;
+
+    order_index_lock(&g_data->g_order_index, &order->key);
+    entry = order_index_lookup(&g_data->g_order_index, &order->key);
+    if(entry && entry->order == order) order_index_remove(&g_data->g_order_index, entry);
+    order_index_unlock(&g_data->g_order_index, &order->key);
+}
+
+//Not a 'public' function; only internal to this file.
+//Shelves a new order in a slot the caller holds; the slot is freed again
+//if the order cannot be indexed
+static bool shelf_lf_shelve(ORDER *order, SHELF shelf, int slot, SHELF *placed) {
+    SHELF_ARRAY *array = &g_data->g_shelves[shelf];
+    ORDER_INDEX_ENTRY *entry;
+    int64_t expiry;
+
+    order->expiry = expiry = shelf_expiry(order, shelf);
+    order_index_lock(&g_data->g_order_index, &order->key);
+    entry = order_index_insert(&g_data->g_order_index, order);
+    if(entry) {
+        entry->shelf = shelf;
+        entry->slot = slot;
+    }
+    order_index_unlock(&g_data->g_order_index, &order->key);
+    if(entry == NULL) {
+        shelf_lf_unclaim(array, slot);
+        return false;
+    }
+
+    print_order_delta(ORDER_DELTA_PLACED, order, shelf);
+    shelf_lf_publish(array, slot, order); //not ours to look at from here on
+    monitor_arm(expiry);
+    *placed = shelf;
+    return true;
+}
+
+//Not a 'public' function; only internal to this file.
+//Moves an order the caller owns (taken out of its overflow slot) back to
+//its temperature shelf; phase 1, claiming a slot there, is the caller's.
+//The order goes into the new slot first and its index entry follows it; a
+//courier after it retries until the entry has caught up.
+static void shelf_lf_move_back(ORDER *moved, int to) {
+    SHELF shelf = (SHELF)moved->temp; //using temperature as shelf
+    ORDER_INDEX_ENTRY *entry;
+    ORDER_KEY key = moved->key;
+
+    moved->expiry = shelf_expiry(moved, shelf);
+    print_order_delta(ORDER_DELTA_MOVED, moved, shelf);
+    stats_count_move(moved->temp);
+    shelf_lf_publish(&g_data->g_shelves[shelf], to, moved); //not ours to look at from here on
+    order_index_lock(&g_data->g_order_index, &key);
+    entry = order_index_lookup(&g_data->g_order_index, &key);
+    if(entry && entry->order == moved) {
+        entry->shelf = shelf;
+        entry->slot = to;
+    }
+    order_index_unlock(&g_data->g_order_index, &key);
+}
+
+//Not a 'public' function; only internal to this file.
+//The overflow shelf is full: takes every order on it (borrows the slots;
+//an order another thread has for the moment is left out) so that the
+//placement policy (shelf.placement) can look at them, then carries out
+//its choice. A moved order's overflow slot, or an evicted one's, still
+//claimed, takes the new order; every other order goes back to its slot.
+//*victim is the evicted order, now the caller's.
+//Returns 1 if the new order was shelved, 0 if it is to be dropped and -1
+//if another thread got in the way (worth another try).
+static int shelf_lf_place_full(ORDER *order, SHELF *placed, ORDER **victim) {
+    SHELF_ARRAY *overflow = &g_data->g_shelves[OVERFLOW_SHELF];
+    PLACEMENT_CHOICE choice;
+    bool room[MAX_TEMP];
+    ORDER **borrowed;
+    int *slots;
+    int i, n = 0, slot = -1, to = -1, result = 0;
+    TEMP t;
+
+    borrowed = malloc(overflow->capacity * sizeof(ORDER *));
+    slots = malloc(overflow->capacity * sizeof(int));
+    if(borrowed == NULL || slots == NULL) {
+        free(borrowed);
+        free(slots);
+        return 0;
+    }
+    for(i = 0; i < overflow->capacity; i++) {
+        if((borrowed[n] = shelf_lf_borrow(overflow, i)) != NULL) slots[n++] = i;
+    }
+    for(t = HOT; t < MAX_TEMP; t++) {
+        //using temperature as shelf
+        room[t] = __sync_fetch_and_add(&g_data->g_shelves[t].count, 0) < g_data->g_shelves[t].capacity;
+    }
+
+    if(n == 0) {
+        result = -1; //every order is someone else's for the moment
+    } else {
+        placement_choose(order, borrowed, n, NULL, room, shelf_now_msec(), &choice);
+        for(i = 0; i < n; i++) {
+            if(borrowed[i] == choice.move || borrowed[i] == choice.evict) break;
+        }
+        if(i < n && choice.move) {
+            //phase 1: a slot on its temperature shelf; it may have filled up
+            to = shelf_lf_claim(&g_data->g_shelves[choice.move->temp]);
+            if(to < 0) {
+                result = -1;
+            } else {
+                slot = slots[i];
+                borrowed[i] = NULL;
+            }
+        } else if(i < n && choice.evict) {
+            shelf_lf_unindex(choice.evict);
+            *victim = choice.evict;
+            slot = slots[i];
+            borrowed[i] = NULL;
+        }
+    }
+
+    //the rest go back before anything new is published
+    for(i = 0; i < n; i++) {
+        if(borrowed[i]) shelf_lf_return(overflow, slots[i], borrowed[i]);
+    }
+    free(borrowed);
+    free(slots);
+
+    if(slot >= 0) {
+        if(to >= 0) shelf_lf_move_back(choice.move, to); //phase 2
+        result = shelf_lf_shelve(order, OVERFLOW_SHELF, slot, placed) ? 1 : 0;
+    }
+    return result;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      shelf_lf_init                                                  */
+/*                                                                           */
+/* Purpose:   Allocates the slot bitmap and columns of a lock-free shelf     */
+/*                                                                           */
+/* Params:    IN     array           - Shelf (capacity already set)          */
+/*                                                                           */
+/* Returns:   bool - for success/failure.                                    */
+/*                                                                           */
+/**PROC-**********************************************************************/
+bool shelf_lf_init(SHELF_ARRAY *array) {
+    int slots = array->capacity + 1;
+
+    array->occupied = calloc((slots + 63) / 64, sizeof(uint64_t));
+    array->deadline = calloc(slots, sizeof(int64_t));
+
+    return array->occupied && array->deadline;
+}
+
+void shelf_lf_destroy(SHELF_ARRAY *array) {
+    free(array->occupied);
+    free(array->deadline);
+    array->occupied = NULL;
+    array->deadline = NULL;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      shelf_lf_place_order                                           */
+/*                                                                           */
+/* Purpose:   Shelves a new order on the lock-free shelves                   */
+/*                                                                           */
+/* Params:    IN     order           - Order to shelve                       */
+/*            OUT    shelf           - Shelf it went on                      */
+/*            OUT    victim          - Overflow order discarded to make room */
+/*                                     (the caller's to account for and      */
+/*                                     free); NULL if none                   */
+/*                                                                           */
+/* Returns:   bool - true if shelved; the order is not the caller's any more.*/
+/*                                                                           */
+/* Operation: Same steps as with locks: its temperature shelf, else the     */
+/*            overflow shelf, else whatever the placement policy chooses     */
+/*            (move an overflow order back, evict one, or drop the new       */
+/*            order). A step that loses a race with another thread starts   */
+/*            the round over, up to SHELF_LF_ATTEMPTS rounds.                */
+/*                                                                           */
+/**PROC-**********************************************************************/
+bool shelf_lf_place_order(ORDER *order, SHELF *shelf, ORDER **victim) {
+    SHELF home = (SHELF)order->temp; //using temperature as shelf
+    int attempt, slot, placed;
+
+    *victim = NULL;
+    for(attempt = 0; attempt < SHELF_LF_ATTEMPTS; attempt++) {
+        if((slot = shelf_lf_claim(&g_data->g_shelves[home])) >= 0) {
+            return shelf_lf_shelve(order, home, slot, shelf);
+        }
+        if((slot = shelf_lf_claim(&g_data->g_shelves[OVERFLOW_SHELF])) >= 0) {
+            return shelf_lf_shelve(order, OVERFLOW_SHELF, slot, shelf);
+        }
+        if((placed = shelf_lf_place_full(order, shelf, victim)) >= 0) return placed == 1;
+    }
+    return false;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      shelf_lf_take_order                                            */
+/*                                                                           */
+/* Purpose:   Takes an order off the lock-free shelves by its key (pickup)   */
+/*                                                                           */
+/* Params:    IN     key             - Key of the order                      */
+/*                                                                           */
+/* Returns:   ORDER* - the order, now the caller's to free; NULL if it is on */
+/*            no shelf.                                                      */
+/*                                                                           */
+/* Operation: With the key's stripe locked (so the order is not freed under  */
+/*            it) the slot the entry points at is swapped to NULL. If that   */
+/*            fails someone else has the order for the moment (moving it,    */
+/*            printing it, or discarding it) and it is tried again.          */
+/*                                                                           */
+/**PROC-**********************************************************************/
+ORDER *shelf_lf_take_order(const ORDER_KEY *key) {
+    ORDER_INDEX_ENTRY *entry;
+    SHELF_ARRAY *array;
+    ORDER *order;
+    SHELF shelf;
+    int slot;
+
+    while(1) {
+        order_index_lock(&g_data->g_order_index, key);
+        entry = order_index_lookup(&g_data->g_order_index, key);
+        if(entry == NULL) {
+            order_index_unlock(&g_data->g_order_index, key);
+            return NULL;
+        }
+        order = entry->order;
+        shelf = entry->shelf;
+        array = &g_data->g_shelves[shelf];
+        slot = entry->slot;
+        if(shelf_lf_own(array, slot, order)) {
+            order_index_remove(&g_data->g_order_index, entry);
+            order_index_unlock(&g_data->g_order_index, key);
+            print_order_delta(ORDER_DELTA_DELIVERED, order, shelf);
+            stats_count(ORDER_DELIVERED, shelf, order->temp);
+            shelf_lf_unclaim(array, slot);
+            return order;
+        }
+        order_index_unlock(&g_data->g_order_index, key);
+        sched_yield();
+    }
+}
+
+/**PROC+**********************************************************************/
+/* Name:      shelf_lf_discard_stale                                         */
+/*                                                                           */
+/* Purpose:   Discards the stale orders of one lock-free shelf (monitor)     */
+/*                                                                           */
+/* Params:    IN     shelf           - Shelf to look at                      */
+/*            IN     now             - msecs (clock_now_msec)                */
+/*            IN/OUT next            - lowered to the nearest deadline of    */
+/*                                     the orders left on the shelf          */
+/*                                                                           */
+/* Returns:   Number of orders discarded.                                    */
+/*                                                                           */
+/* Operation: A pass over the deadline column; an order past its deadline   */
+/*            is owned, checked again (the slot may have been reused) and    */
+/*            freed along with its slot. A claimed slot whose order cannot   */
+/*            be owned just then (borrowed by the printout or a placement)   */
+/*            still lowers "next" by its deadline, so the timer is armed for */
+/*            it again; if that is due, the monitor looks again shortly.     */
+/*                                                                           */
+/**PROC-**********************************************************************/
+int shelf_lf_discard_stale(SHELF shelf, int64_t now, int64_t *next) {
+    SHELF_ARRAY *array = &g_data->g_shelves[shelf];
+    ORDER *order;
+    int64_t deadline;
+    int slot, discarded = 0;
+
+    for(slot = 0; slot < array->capacity; slot++) {
+        order = __atomic_load_n(&array->orders[slot], __ATOMIC_ACQUIRE);
+        deadline = __atomic_load_n(&array->deadline[slot], __ATOMIC_RELAXED);
+        if(order == NULL || deadline > now || !shelf_lf_own(array, slot, order)) {
+            //not due, or busy (borrowed, picked up or moved meanwhile)
+            if(shelf_lf_claimed(array, slot) && deadline < *next) *next = deadline;
+            continue;
+        }
+        if(order->expiry > now) {
+            if(order->expiry < *next) *next = order->expiry;
+            shelf_lf_publish(array, slot, order);
+            continue;
+        }
+
+        TRACE(MONITOR, L4, "order id %.*s is STALE; removing\n", (int)order->id_len, order->id);
+        print_order_delta(ORDER_DELTA_DISCARDED_STALE, order, shelf);
+        stats_count(ORDER_DISCARDED_STALE, shelf, order->temp);
+        shelf_lf_unindex(order);
+        shelf_lf_unclaim(array, slot);
+        TRACE(SHELF, L1, "FREE order->id %p order->name %p order %p\n", order->id, order->name, order);
+        order_release(order);
+        discarded++;
+    }
+    return discarded;
+}
+
+//Takes the order in a slot for a moment (e.g. to print it); NULL if the
+//slot is empty or someone else has its order. Give it back with
+//shelf_lf_return()
+ORDER *shelf_lf_borrow(SHELF_ARRAY *array, int slot) {
+    ORDER *order = __atomic_load_n(&array->orders[slot], __ATOMIC_ACQUIRE);
+
+    if(order == NULL || !shelf_lf_own(array, slot, order)) return NULL;
+    return order;
+}
+
+void shelf_lf_return(SHELF_ARRAY *array, int slot, ORDER *order) {
+    __atomic_store_n(&array->orders[slot], order, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,19 @@
+#ifndef SHELF_LOCKFREE_H
+#define SHELF_LOCKFREE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//The slot bitmap and columns live in SHELF_ARRAY (common.h); shelf.c
+//hands the shelves over to these functions when shelf.concurrency is
+//lockfree
+
+bool shelf_lf_init(SHELF_ARRAY *array);
+void shelf_lf_destroy(SHELF_ARRAY *array);
+bool shelf_lf_place_order(ORDER *order, SHELF *shelf, ORDER **victim);
+ORDER *shelf_lf_take_order(const ORDER_KEY *key);
+int shelf_lf_discard_stale(SHELF shelf, int64_t now, int64_t *next);
+ORDER *shelf_lf_borrow(SHELF_ARRAY *array, int slot);
+void shelf_lf_return(SHELF_ARRAY *array, int slot, ORDER *order);
+
+#endif //SHELF_LOCKFREE_H
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHELF_SOA_X86 1
+#endif
+
+#include "common.h"
+#include "shelf_soa.h"
+
+//Structure of arrays copy of a shelf: the creation time, shelfLife and
+//decayRate of the order in every slot, each in an array of its own, so a
+//whole shelf is valued with a few streaming loads instead of an ORDER*
+//dereference per order. The value is computed exactly as the monitor's
+//scalar formula does (float arithmetic, whole seconds of age), so both
+//agree on which orders are stale.
+
+typedef int (*shelf_soa_fn)(SHELF_ARRAY *array, int64_t now_ms);
+
+//Not a 'public' function; only internal to this file.
+//Values slots [from..count) one at a time; returns how many are stale
+static int shelf_soa_tail(SHELF_ARRAY *array, int from, int64_t now_ms) {
+    int i, elapsed_time, stale = 0;
+    float value;
+
+    for(i = from; i < array->count; i++) {
+        elapsed_time = (int)(now_ms - (int64_t)array->created[i]);
+        value = array->shelfLife[i] - (array->decayRate[i] * (elapsed_time/1000) * array->modifier);
+        array->values[i] = value;
+        if(value < 0) {
+            array->stale[i / 64] |= 1ULL << (i % 64);
+            stale++;
+        }
+    }
+    return stale;
+}
+
+//Not a 'public' function; only internal to this file.
+static int shelf_soa_scalar(SHELF_ARRAY *array, int64_t now_ms) {
+    return shelf_soa_tail(array, 0, now_ms);
+}
+
+#ifdef SHELF_SOA_X86
+//Not a 'public' function; only internal to this file.
+//4 slots per step: the age goes through doubles (msecs of the clock do
+//not fit a float) and is truncated to whole seconds; the value itself is
+//float, multiplied in the same order as the scalar formula. Multiplying
+//by 0.001 (a hair over 1/1000) instead of dividing truncates exactly the
+//same as the int division: the product's error is far below the 0.001 gap
+//between whole seconds.
+static int shelf_soa_sse2(SHELF_ARRAY *array, int64_t now_ms) {
+    const __m128d now = _mm_set1_pd((double)now_ms), per_msec = _mm_set1_pd(0.001);
+    const __m128 modifier = _mm_set1_ps(array->modifier), zero = _mm_setzero_ps();
+    __m128i stale = _mm_setzero_si128(), secs_lo, secs_hi;
+    __m128 secs, value, is_stale;
+    int i = 0, counts[4];
+
+    for(; i + 4 <= array->count; i += 4) {
+        secs_lo = _mm_cvttpd_epi32(_mm_mul_pd(_mm_sub_pd(now, _mm_loadu_pd(array->created + i)), per_msec));
+        secs_hi = _mm_cvttpd_epi32(_mm_mul_pd(_mm_sub_pd(now, _mm_loadu_pd(array->created + i + 2)), per_msec));
+        secs = _mm_cvtepi32_ps(_mm_unpacklo_epi64(secs_lo, secs_hi));
+        value = _mm_sub_ps(_mm_loadu_ps(array->shelfLife + i),
+                           _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(array->decayRate + i), secs), modifier));
+        _mm_storeu_ps(array->values + i, value);
+
+        //a stale lane is all ones (-1): subtracting counts it. i is a
+        //multiple of 4, so the 4 bits never straddle two words
+        is_stale = _mm_cmplt_ps(value, zero);
+        stale = _mm_sub_epi32(stale, _mm_castps_si128(is_stale));
+        array->stale[i / 64] |= (uint64_t)_mm_movemask_ps(is_stale) << (i % 64);
+    }
+    _mm_storeu_si128((__m128i *)counts, stale);
+    return counts[0] + counts[1] + counts[2] + counts[3] + shelf_soa_tail(array, i, now_ms);
+}
+#endif
+
+static shelf_soa_fn g_shelf_soa_fn = NULL;
+
+//Best implementation this CPU can run
+SHELF_SOA_IMPL shelf_soa_best_impl() {
+#ifdef SHELF_SOA_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")) return SHELF_SOA_SSE2;
+#endif
+    return SHELF_SOA_SCALAR;
+}
+
+//Forces an implementation (e.g. for benchmarking); false if the CPU
+//cannot run it
+bool shelf_soa_set_impl(SHELF_SOA_IMPL impl) {
+    if(impl > shelf_soa_best_impl()) return false;
+
+    switch(impl) {
+#ifdef SHELF_SOA_X86
+    case SHELF_SOA_SSE2:
+        g_shelf_soa_fn = shelf_soa_sse2;
+        break;
+#endif
+    case SHELF_SOA_SCALAR:
+        g_shelf_soa_fn = shelf_soa_scalar;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      shelf_soa_init                                                 */
+/*                                                                           */
+/* Purpose:   Allocates the SoA columns of a shelf                           */
+/*                                                                           */
+/* Params:    IN     array           - Shelf (capacity already set)          */
+/*            IN     modifier        - shelfDecayModifier of the shelf       */
+/*                                                                           */
+/* Returns:   bool - for success/failure.                                    */
+/*                                                                           */
+/* Operation: Columns get capacity + 1 slots, like the orders array (the     */
+/*            shelving code may briefly hold one order over capacity).       */
+/*                                                                           */
+/**PROC-**********************************************************************/
+bool shelf_soa_init(SHELF_ARRAY *array, int modifier) {
+    int slots = array->capacity + 1;
+
+    array->created = calloc(slots, sizeof(double));
+    array->shelfLife = calloc(slots, sizeof(float));
+    array->decayRate = calloc(slots, sizeof(float));
+    array->values = calloc(slots, sizeof(float));
+    array->stale = calloc((slots + 63) / 64, sizeof(uint64_t));
+    array->modifier = modifier;
+
+    return array->created && array->shelfLife && array->decayRate && array->values && array->stale;
+}
+
+void shelf_soa_destroy(SHELF_ARRAY *array) {
+    free(array->created);
+    free(array->shelfLife);
+    free(array->decayRate);
+    free(array->values);
+    free(array->stale);
+    array->created = NULL;
+    array->shelfLife = array->decayRate = array->values = NULL;
+    array->stale = NULL;
+}
+
+//Copies what the value of an order depends on into a slot's columns
+void shelf_soa_set(SHELF_ARRAY *array, int slot, ORDER *order) {
+    array->created[slot] = (double)order->created;
+    array->shelfLife[slot] = order->shelfLife;
+    array->decayRate[slot] = order->decayRate;
+}
+
+//Moves a slot's columns to another slot (the swap remove of shelf.c)
+void shelf_soa_move(SHELF_ARRAY *array, int to, int from) {
+    array->created[to] = array->created[from];
+    array->shelfLife[to] = array->shelfLife[from];
+    array->decayRate[to] = array->decayRate[from];
+}
+
+/**PROC+**********************************************************************/
+/* Name:      shelf_soa_evaluate                                             */
+/*                                                                           */
+/* Purpose:   Values every order on a shelf at once                          */
+/*                                                                           */
+/* Params:    IN     array           - Shelf with its SoA columns            */
+/*            IN     now_ms          - Time (msecs, clock_now_msec) to value */
+/*                                     the orders at                         */
+/*                                                                           */
+/* Returns:   Number of stale orders (value below 0) on the shelf.           */
+/*                                                                           */
+/* Operation: Fills array->values with the value of each slot and sets the   */
+/*            bit of every stale slot in array->stale (bit i of word i/64);  */
+/*            both stay valid until the shelf next changes. Dispatches to    */
+/*            the best SIMD implementation the CPU supports (chosen on first */
+/*            use) or to the scalar fallback.                                */
+/*                                                                           */
+/**PROC-**********************************************************************/
+int shelf_soa_evaluate(SHELF_ARRAY *array, int64_t now_ms) {
+    if(g_shelf_soa_fn == NULL) shelf_soa_set_impl(shelf_soa_best_impl());
+
+    memset(array->stale, 0, ((array->count + 63) / 64) * sizeof(uint64_t));
+    return g_shelf_soa_fn(array, now_ms);
+}
+
+//Self explanatory util method...returns string for display
+const char *shelf_soa_impl_to_str(SHELF_SOA_IMPL impl) {
+    switch(impl) {
+        case SHELF_SOA_SCALAR:
+            return "scalar";
+        case SHELF_SOA_SSE2:
+            return "sse2";
+        default:
+            return "Undefined";
+    }
+}
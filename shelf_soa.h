@@ -0,0 +1,28 @@
+#ifndef SHELF_SOA_H
+#define SHELF_SOA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//The SoA columns live in SHELF_ARRAY (common.h); shelf.c keeps them in
+//step with the orders array when shelf.layout is soa
+
+//Shelf value kernel implementations; the best one the CPU supports is
+//picked at runtime
+typedef enum shelf_soa_impl_t {
+    SHELF_SOA_SCALAR = 0,
+    SHELF_SOA_SSE2 = 1,
+    MAX_SHELF_SOA_IMPL = 2
+} SHELF_SOA_IMPL;
+
+bool shelf_soa_init(SHELF_ARRAY *array, int modifier);
+void shelf_soa_destroy(SHELF_ARRAY *array);
+void shelf_soa_set(SHELF_ARRAY *array, int slot, ORDER *order);
+void shelf_soa_move(SHELF_ARRAY *array, int to, int from);
+int shelf_soa_evaluate(SHELF_ARRAY *array, int64_t now_ms);
+
+SHELF_SOA_IMPL shelf_soa_best_impl();
+bool shelf_soa_set_impl(SHELF_SOA_IMPL impl);
+const char *shelf_soa_impl_to_str(SHELF_SOA_IMPL impl);
+
+#endif //SHELF_SOA_H
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include "common.h"
+#include "constants.h"
+#include "clock.h"
+#include "trace.h"
+#include "kitchen.h"
+#include "stats.h"
+
+//One thread's counts; only that thread writes them (plain load, add and
+//store, no lock prefix) and a report only reads them, so a block is kept
+//to cache lines of its own
+typedef struct stats_counters_t {
+    uint64_t events[MAX_EVENT][MAX_SHELF][MAX_TEMP];
+    uint64_t moves[MAX_TEMP];           //overflow order back on its temperature shelf
+    uint64_t timer_failures;            //pickups not scheduled
+    uint64_t unknown_temps;             //orders of no known temperature, discarded
+    struct stats_counters_t *next;
+} __attribute__((aligned(64))) STATS_COUNTERS;
+
+//blocks of every thread that counted, pushed on first use; freed by
+//stats_finalize() once the threads are gone
+static STATS_COUNTERS *g_stats_head;
+static unsigned int g_stats_generation;     //blocks of an earlier run are gone
+
+static pthread_t g_stats_reporter;
+static bool g_stats_running;
+static bool g_stats_stop;                   //guarded by g_stats_mutex
+static pthread_mutex_t g_stats_mutex = PTHREAD_MUTEX_INITIALIZER; //leaf lock
+static pthread_cond_t g_stats_cond = PTHREAD_COND_INITIALIZER;
+
+static __thread STATS_COUNTERS *t_stats;
+static __thread unsigned int t_stats_generation;
+
+//Not a 'public' function; only internal to this file.
+//This thread's block, pushed on the list on first use; NULL if out of
+//memory (the counts are lost)
+static STATS_COUNTERS *stats_counters() {
+    STATS_COUNTERS *counters;
+    void *mem;
+
+    if(t_stats && t_stats_generation == __atomic_load_n(&g_stats_generation, __ATOMIC_RELAXED)) {
+        return t_stats;
+    }
+    t_stats = NULL;
+    if(posix_memalign(&mem, 64, sizeof(STATS_COUNTERS)) != 0) return NULL;
+    counters = (STATS_COUNTERS *)mem;
+    memset(counters, 0, sizeof(STATS_COUNTERS));
+
+    counters->next = __atomic_load_n(&g_stats_head, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&g_stats_head, &counters->next, counters, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        ;
+    }
+    t_stats = counters;
+    t_stats_generation = __atomic_load_n(&g_stats_generation, __ATOMIC_RELAXED);
+    return t_stats;
+}
+
+//Not a 'public' function; only internal to this file.
+//One more on a counter of this thread's block; a report may read it at
+//the same time, hence the atomic (but relaxed, single writer) store
+static inline void stats_bump(uint64_t *counter) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+//Counts an ORDER_EVENT of an order of the given temperature on the given
+//shelf (ORDER_READ: the shelf it was placed on, or turned away from)
+void stats_count(ORDER_EVENT evt, SHELF shelf, TEMP temp) {
+    STATS_COUNTERS *counters;
+
+    if(evt >= MAX_EVENT || shelf >= MAX_SHELF || temp >= MAX_TEMP) return;
+    if((counters = stats_counters()) != NULL) stats_bump(&counters->events[evt][shelf][temp]);
+}
+
+//Counts an overflow order moved back to its temperature shelf
+void stats_count_move(TEMP temp) {
+    STATS_COUNTERS *counters;
+
+    if(temp >= MAX_TEMP) return;
+    if((counters = stats_counters()) != NULL) stats_bump(&counters->moves[temp]);
+}
+
+//Counts a pickup that could not be scheduled (courier_start_timer)
+void stats_count_timer_failure() {
+    STATS_COUNTERS *counters;
+
+    if((counters = stats_counters()) != NULL) stats_bump(&counters->timer_failures);
+}
+
+//Counts an order of no known temperature, discarded on arrival
+//(shelf_store_order); it is not in the events, which go by shelf
+void stats_count_unknown_temp() {
+    STATS_COUNTERS *counters;
+
+    if((counters = stats_counters()) != NULL) stats_bump(&counters->unknown_temps);
+}
+
+//Not a 'public' function; only internal to this file.
+//Adds up the blocks of all the threads; no lock, so a count being made
+//meanwhile may or may not be in it
+static void stats_sum(STATS_COUNTERS *total) {
+    STATS_COUNTERS *counters;
+    uint64_t *from, *to;
+    size_t i, n = offsetof(STATS_COUNTERS, next) / sizeof(uint64_t);
+
+    memset(total, 0, sizeof(STATS_COUNTERS));
+    to = (uint64_t *)total;
+    for(counters = __atomic_load_n(&g_stats_head, __ATOMIC_ACQUIRE); counters; counters = counters->next) {
+        from = (uint64_t *)counters;
+        for(i = 0; i < n; i++) to[i] += __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+    }
+}
+
+//Not a 'public' function; only internal to this file.
+//Prints the counts so far: per event the total, then by shelf and by
+//temperature; the overflow moves and timer failures. Put together first
+//and written in one go, so that other threads' lines do not break it up.
+static void stats_report(const char *when) {
+    STATS_COUNTERS total;
+    uint64_t sum, by_shelf[MAX_SHELF], by_temp[MAX_TEMP];
+    ORDER_EVENT evt;
+    SHELF shelf;
+    TEMP temp;
+    char time_str_buf[CLOCK_STR_SIZE];
+    char *text = NULL;
+    size_t text_sz = 0;
+    FILE *out;
+
+    stats_sum(&total);
+    if((out = open_memstream(&text, &text_sz)) == NULL) return;
+
+    fprintf(out, "STATISTICS (%s, %s):\n", clock_log_time(time_str_buf), when);
+    for(evt = ORDER_READ; evt < MAX_EVENT; evt++) {
+        memset(by_shelf, 0, sizeof(by_shelf));
+        memset(by_temp, 0, sizeof(by_temp));
+        sum = 0;
+        for(shelf = HOT_SHELF; shelf < MAX_SHELF; shelf++) {
+            for(temp = HOT; temp < MAX_TEMP; temp++) {
+                by_shelf[shelf] += total.events[evt][shelf][temp];
+                by_temp[temp] += total.events[evt][shelf][temp];
+                sum += total.events[evt][shelf][temp];
+            }
+        }
+        fprintf(out, "%-27s: %6lu |", order_event_to_str(evt), (unsigned long)sum);
+        for(shelf = HOT_SHELF; shelf < MAX_SHELF; shelf++) {
+            fprintf(out, " %s %lu", ordershelf_to_str(shelf), (unsigned long)by_shelf[shelf]);
+        }
+        fprintf(out, " |");
+        for(temp = HOT; temp < MAX_TEMP; temp++) {
+            fprintf(out, " %s %lu", ordertemp_to_str(temp), (unsigned long)by_temp[temp]);
+        }
+        fprintf(out, "\n");
+    }
+
+    sum = 0;
+    for(temp = HOT; temp < MAX_TEMP; temp++) sum += total.moves[temp];
+    fprintf(out, "%-27s: %6lu |", "OVERFLOW_MOVES", (unsigned long)sum);
+    for(temp = HOT; temp < MAX_TEMP; temp++) {
+        fprintf(out, " %s %lu", ordertemp_to_str(temp), (unsigned long)total.moves[temp]);
+    }
+    fprintf(out, "\n");
+    fprintf(out, "%-27s: %6lu\n", "TIMER_FAILURES", (unsigned long)total.timer_failures);
+    fprintf(out, "%-27s: %6lu\n", "UNKNOWN_TEMP", (unsigned long)total.unknown_temps);
+    fclose(out);
+
+    flockfile(stdout);
+    fputs(text, stdout);
+    fflush(stdout);
+    funlockfile(stdout);
+    free(text);
+}
+
+//Not a 'public' function; only internal to this file.
+//Reporter thread: a report every system.stats.interval msecs (on the
+//monotonic clock) until told to stop
+static void *stats_reporter_cb(void *arg) {
+    struct timespec until;
+    int64_t next = clock_now_nsec();
+    char when[64];
+
+    (void)arg;
+    snprintf(when, sizeof(when), "every %d msecs", SYSTEM_STATS_INTERVAL);
+    pthread_mutex_lock(&g_stats_mutex);
+    while(!g_stats_stop) {
+        next += (int64_t)SYSTEM_STATS_INTERVAL * 1000000;
+        until.tv_sec = next / 1000000000;
+        until.tv_nsec = next % 1000000000;
+        while(!g_stats_stop && pthread_cond_timedwait(&g_stats_cond, &g_stats_mutex, &until) != ETIMEDOUT) {
+            ;
+        }
+        if(g_stats_stop) break;
+        pthread_mutex_unlock(&g_stats_mutex);
+        stats_report(when);
+        pthread_mutex_lock(&g_stats_mutex);
+    }
+    pthread_mutex_unlock(&g_stats_mutex);
+    return NULL;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      stats_start                                                    */
+/*                                                                           */
+/* Purpose:   Starts the periodic statistics report                          */
+/*                                                                           */
+/* Returns:   bool - for success/failure.                                    */
+/*                                                                           */
+/* Operation: A thread that naps system.stats.interval msecs between         */
+/*            reports; nothing to start if it is 0 (end of run report only). */
+/*            The counting itself needs no setup.                            */
+/*                                                                           */
+/**PROC-**********************************************************************/
+bool stats_start() {
+    pthread_condattr_t attr;
+
+    if(SYSTEM_STATS_INTERVAL <= 0 || g_stats_running) return true;
+
+    g_stats_stop = false;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_destroy(&g_stats_cond);
+    pthread_cond_init(&g_stats_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if(pthread_create(&g_stats_reporter, NULL, stats_reporter_cb, NULL) != 0) return false;
+    g_stats_running = true;
+    TRACE(KITCHEN, L4, "statistics every %d msecs\n", SYSTEM_STATS_INTERVAL);
+    return true;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      stats_finalize                                                 */
+/*                                                                           */
+/* Purpose:   Stops the periodic report and prints the end of run one        */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/* Operation: Caller makes sure no other thread counts any more (they are    */
+/*            stopped); the blocks are freed and a thread that counts after  */
+/*            this starts a new one.                                         */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void stats_finalize() {
+    STATS_COUNTERS *counters, *next;
+
+    if(g_stats_running) {
+        pthread_mutex_lock(&g_stats_mutex);
+        g_stats_stop = true;
+        pthread_cond_signal(&g_stats_cond);
+        pthread_mutex_unlock(&g_stats_mutex);
+        pthread_join(g_stats_reporter, NULL);
+        g_stats_running = false;
+    }
+
+    stats_report("end of run");
+
+    counters = __atomic_exchange_n(&g_stats_head, NULL, __ATOMIC_ACQUIRE);
+    for(; counters; counters = next) {
+        next = counters->next;
+        free(counters);
+    }
+    __atomic_add_fetch(&g_stats_generation, 1, __ATOMIC_RELAXED);
+    t_stats = NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+
+//Counts of what happened to the orders: every ORDER_EVENT by the shelf it
+//happened on and the temperature of the order, the overflow orders moved
+//back to their temperature shelf, the pickups that could not be
+//scheduled and the orders of no known temperature (discarded on arrival,
+//on no shelf). Each thread counts into its own cache line aligned block, so
+//counting takes no lock and no atomic read-modify-write; a report adds
+//the blocks up. Reported every system.stats.interval msecs (stats_start)
+//and at the end of the run (stats_finalize).
+
+bool stats_start();
+void stats_finalize();
+void stats_count(ORDER_EVENT evt, SHELF shelf, TEMP temp);
+void stats_count_move(TEMP temp);
+void stats_count_timer_failure();
+void stats_count_unknown_temp();
+
+#endif //STATS_H
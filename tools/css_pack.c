@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "constants.h"
+#include "input.h"
+#include "pack.h"
+#include "pool.h"
+
+//css-pack: converts a JSON orders file into the packed columnar format (see
+//pack.h) that the "packed" reader (system.orders.file.reader) maps directly.
+//Ids must be canonical UUIDs; they are stored as 16 bytes and read back in
+//lower case.
+//
+//Usage: css-pack <orders.json> <orders.pack>
+
+#define PACK_BATCH 4096
+#define PACK_NAME_TABLE_MIN 1024    //slots of the name table to start with
+
+//Column arrays being built; grown by doubling
+typedef struct pack_columns_t {
+    uint32_t count;
+    uint32_t capacity;
+    uint8_t *ids;
+    uint32_t *name_index;
+    uint8_t *temp;
+    int32_t *shelf_life;
+    float *decay_rate;
+    
+    //name dictionary: the distinct names back to back, NUL terminated, as
+    //they are written out, and where each starts
+    char *names;
+    uint64_t names_len;
+    uint64_t names_capacity;
+    uint32_t *name_offsets;
+    uint32_t name_count;
+    uint32_t name_capacity;
+    
+    //open addressing (linear probing) table over the dictionary:
+    //<index + 1> of a name, 0 if the slot is empty; never over half full
+    uint32_t *name_table;
+    uint32_t name_table_mask;
+} PACK_COLUMNS;
+
+//Not a 'public' function; only internal to this file.
+static bool pack_grow(void **array, size_t elem_size, uint32_t capacity) {
+    void *grown = realloc(*array, elem_size * capacity);
+    
+    if(grown == NULL) return false;
+    *array = grown;
+    return true;
+}
+
+//Not a 'public' function; only internal to this file.
+//FNV-1a of a name
+static uint32_t pack_name_hash(const char *name, size_t len) {
+    uint32_t hash = 2166136261u;
+    size_t i;
+    
+    for(i = 0; i < len; i++) hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    return hash;
+}
+
+//Not a 'public' function; only internal to this file.
+//Slot of the name table that holds the name, or the empty one it would go in
+static uint32_t *pack_name_slot(PACK_COLUMNS *cols, const char *name, size_t len) {
+    uint32_t i = pack_name_hash(name, len) & cols->name_table_mask, *slot;
+    const char *known;
+    
+    for(;; i = (i + 1) & cols->name_table_mask) {
+        slot = &cols->name_table[i];
+        if(*slot == 0) return slot;
+        known = cols->names + cols->name_offsets[*slot - 1];
+        if(memcmp(known, name, len) == 0 && known[len] == '\0') return slot;
+    }
+}
+
+//Not a 'public' function; only internal to this file.
+//Doubles the name table and files the names again
+static bool pack_grow_name_table(PACK_COLUMNS *cols) {
+    uint32_t *old = cols->name_table, slots = (cols->name_table_mask + 1) * 2, i;
+    const char *name;
+    
+    if((cols->name_table = calloc(slots, sizeof(uint32_t))) == NULL) {
+        cols->name_table = old;
+        return false;
+    }
+    cols->name_table_mask = slots - 1;
+    for(i = 0; i < cols->name_count; i++) {
+        name = cols->names + cols->name_offsets[i];
+        *pack_name_slot(cols, name, strlen(name)) = i + 1;
+    }
+    free(old);
+    return true;
+}
+
+//Not a 'public' function; only internal to this file.
+//Index of a name in the dictionary; added (copied) if not there yet
+static bool pack_add_name(PACK_COLUMNS *cols, const char *name, size_t len, uint32_t *index) {
+    uint32_t *slot;
+    
+    if(cols->name_count >= (cols->name_table_mask + 1) / 2 && !pack_grow_name_table(cols)) return false;
+    slot = pack_name_slot(cols, name, len);
+    if(*slot != 0) {
+        *index = *slot - 1;
+        return true;
+    }
+    if(cols->name_count == cols->name_capacity) {
+        cols->name_capacity = cols->name_capacity ? cols->name_capacity * 2 : 64;
+        if(!pack_grow((void **)&cols->name_offsets, sizeof(uint32_t), cols->name_capacity)) return false;
+    }
+    while(cols->names_len + len + 1 > cols->names_capacity) {
+        cols->names_capacity = cols->names_capacity ? cols->names_capacity * 2 : 4096;
+        if(!pack_grow((void **)&cols->names, 1, cols->names_capacity)) return false;
+    }
+    if(cols->names_len + len + 1 > UINT32_MAX) return false;
+    *index = cols->name_count++;
+    cols->name_offsets[*index] = (uint32_t)cols->names_len;
+    memcpy(cols->names + cols->names_len, name, len);
+    cols->names[cols->names_len + len] = '\0';
+    cols->names_len += len + 1;
+    *slot = *index + 1;
+    return true;
+}
+
+//Not a 'public' function; only internal to this file.
+//Moves the orders of the last batch from the order LL into the columns
+static bool pack_add_orders(PACK_COLUMNS *cols) {
+    ORDER_LL_NODE *node = g_data->g_order_ll_head, *next;
+    ORDER *order;
+    bool ok = true;
+    
+    for(; node; node = next) {
+        next = node->next;
+        order = node->data;
+        if(ok && cols->count == cols->capacity) {
+            cols->capacity = cols->capacity ? cols->capacity * 2 : PACK_BATCH;
+            ok = pack_grow((void **)&cols->ids, PACK_UUID_LEN, cols->capacity) &&
+                 pack_grow((void **)&cols->name_index, sizeof(uint32_t), cols->capacity) &&
+                 pack_grow((void **)&cols->temp, sizeof(uint8_t), cols->capacity) &&
+                 pack_grow((void **)&cols->shelf_life, sizeof(int32_t), cols->capacity) &&
+                 pack_grow((void **)&cols->decay_rate, sizeof(float), cols->capacity);
+        }
+        if(ok && !pack_uuid_parse(order->id, order->id_len, cols->ids + (size_t)cols->count * PACK_UUID_LEN)) {
+            printf("css-pack: order id \"%.*s\" is not a UUID\n", (int)order->id_len, order->id);
+            ok = false;
+        }
+        if(ok && pack_add_name(cols, order->name, order->name_len, &cols->name_index[cols->count])) {
+            cols->temp[cols->count] = (uint8_t)order->temp;
+            cols->shelf_life[cols->count] = order->shelfLife;
+            cols->decay_rate[cols->count] = order->decayRate;
+            cols->count++;
+        } else {
+            ok = false;
+        }
+        order_release(node->data);
+        pool_free(&g_order_node_pool, node);
+    }
+    g_data->g_order_ll_head = g_data->g_order_ll_tail = NULL;
+    return ok;
+}
+
+//Not a 'public' function; only internal to this file.
+static bool pack_write_section(FILE *f, uint64_t offset, const void *data, size_t len) {
+    if(len == 0) return true;
+    return fseek(f, (long)offset, SEEK_SET) == 0 && fwrite(data, 1, len, f) == len;
+}
+
+//Not a 'public' function; only internal to this file.
+static bool pack_write(const char *file_name, PACK_COLUMNS *cols) {
+    PACK_HEADER header;
+    size_t file_len;
+    FILE *f;
+    bool ok;
+    
+    file_len = pack_layout(&header, cols->count, cols->name_count, cols->names_len);
+    
+    ok = (f = fopen(file_name, "wb")) != NULL;
+    ok = ok && pack_write_section(f, 0, &header, sizeof(header));
+    ok = ok && pack_write_section(f, header.ids_offset, cols->ids, (size_t)cols->count * PACK_UUID_LEN);
+    ok = ok && pack_write_section(f, header.name_index_offset, cols->name_index, cols->count * sizeof(uint32_t));
+    ok = ok && pack_write_section(f, header.temp_offset, cols->temp, cols->count * sizeof(uint8_t));
+    ok = ok && pack_write_section(f, header.shelf_life_offset, cols->shelf_life, cols->count * sizeof(int32_t));
+    ok = ok && pack_write_section(f, header.decay_rate_offset, cols->decay_rate, cols->count * sizeof(float));
+    ok = ok && pack_write_section(f, header.name_offsets_offset, cols->name_offsets, cols->name_count * sizeof(uint32_t));
+    ok = ok && pack_write_section(f, header.names_offset, cols->names, cols->names_len);
+    //last byte is either padding or the NUL of the last name; writing it
+    //sizes the file when trailing sections are empty
+    ok = ok && pack_write_section(f, file_len - 1, "", 1);
+    if(f && fclose(f) != 0) ok = false;
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    PACK_COLUMNS cols;
+    ORDER_READER *reader;
+    bool eof = false, ok = true;
+
+    if(argc != 3) {
+        printf("usage: css-pack <orders.json> <orders.pack>\n");
+        return 1;
+    }
+    SYSTEM_DEBUG_LEVEL = NONE;
+    g_data = calloc(1, sizeof(DATA));
+    memset(&cols, 0, sizeof(cols));
+    cols.name_table = calloc(PACK_NAME_TABLE_MIN, sizeof(uint32_t));
+    cols.name_table_mask = PACK_NAME_TABLE_MIN - 1;
+
+    if(cols.name_table == NULL) {
+        printf("css-pack: out of memory\n");
+        return 1;
+    }
+    if((reader = order_reader_open(argv[1], ORDER_READER_MMAP)) == NULL) {
+        printf("css-pack: cannot open %s\n", argv[1]);
+        return 1;
+    }
+    while(ok && !eof) {
+        eof = order_reader_read(reader, PACK_BATCH);
+        ok = pack_add_orders(&cols);
+    }
+    if(ok && !pack_write(argv[2], &cols)) {
+        printf("css-pack: cannot write %s\n", argv[2]);
+        ok = false;
+    }
+    if(ok) {
+        printf("css-pack: %u orders, %u distinct names -> %s\n", cols.count, cols.name_count, argv[2]);
+    }
+    order_reader_close(reader);
+
+    free(cols.name_table);
+    free(cols.names);
+    free(cols.name_offsets);
+    free(cols.ids);
+    free(cols.name_index);
+    free(cols.temp);
+    free(cols.shelf_life);
+    free(cols.decay_rate);
+    pool_destroy_all();
+    free(g_data);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "constants.h"
+#include "clock.h"
+#include "kitchen.h"
+#include "order_index.h"
+
+//css-replay: rebuilds the shelves at any time from what css prints with
+//system.print.mode = delta (one NDJSON line per change to an order, plus a
+//snapshot of each shelf now and then; see README, CAVEATS / ISSUES 4) and prints them
+//the way system.print.mode = full prints them on an event. The lines up to
+//the given time are applied in order: a snapshot replaces what is known of
+//its shelf, placed and moved put an order on a shelf, delivered and
+//discarded take it off. Lines that are not delta records (debug output,
+//the totals at the end) are passed by.
+//
+//Usage: css-replay <events file> [msecs since the epoch; default: the end]
+
+typedef struct replay_order_t {
+    char *id;
+    ORDER_KEY key;      //of the id (order_key_from_id), as css keys its index
+    char *name;
+    TEMP temp;
+    int shelfLife;
+    float decayRate;
+    int64_t created;    //msecs since the epoch
+    SHELF shelf;        //MAX_SHELF while on none
+    uint64_t since;     //order it got on its shelf in, to print in that order
+} REPLAY_ORDER;
+
+//The orders known: an open addressing (linear probing) table on their
+//key, never over half full; NULL slots are empty
+static REPLAY_ORDER **g_replay_orders;
+static uint64_t g_replay_mask;
+static uint64_t g_replay_count;
+static uint64_t g_replay_tick;
+static int g_replay_modifier[MAX_SHELF] = {
+    DEFAULT_SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF, DEFAULT_SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF,
+    DEFAULT_SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF, DEFAULT_SHELF_LIFE_MODIFIER_OVERFLOW_SHELF
+};
+
+//Not a 'public' function; only internal to this file.
+//Where the value of a key starts, looking from p on; NULL if not there
+static const char *replay_field(const char *p, const char *key) {
+    char pattern[64];
+    const char *found;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    found = strstr(p, pattern);
+    return found ? found + strlen(pattern) : NULL;
+}
+
+//Not a 'public' function; only internal to this file.
+static int replay_hex_digit(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+//Not a 'public' function; only internal to this file.
+//Copy of the string value at p with its escapes decoded (css escapes id
+//and name in the delta and snapshot lines; \uXXXX comes back as UTF-8, a
+//malformed escape as it is); *end is set past its closing quote
+static char *replay_string(const char *p, const char **end) {
+    const char *start;
+    char *copy, *w;
+    unsigned int cp;
+    int i, h;
+
+    if(p == NULL || *p != '"') return NULL;
+    start = ++p;
+    while(*p && *p != '"') {
+        if(*p == '\\' && p[1]) p++;
+        p++;
+    }
+    if(end) *end = *p ? p + 1 : p;
+    //decoded is never longer than escaped
+    copy = w = malloc(p - start + 1);
+    if(copy == NULL) return NULL;
+    for(; start < p; start++) {
+        if(*start != '\\' || start + 1 >= p) {
+            *w++ = *start;
+            continue;
+        }
+        switch(*++start) {
+            case 'b': *w++ = '\b'; break;
+            case 'f': *w++ = '\f'; break;
+            case 'n': *w++ = '\n'; break;
+            case 'r': *w++ = '\r'; break;
+            case 't': *w++ = '\t'; break;
+            case 'u':
+                for(cp = 0, i = 1; i <= 4 && start + i < p && (h = replay_hex_digit(start[i])) >= 0; i++) {
+                    cp = (cp << 4) | h;
+                }
+                if(i <= 4) {
+                    *w++ = '\\';
+                    *w++ = 'u';
+                    break;
+                }
+                start += 4;
+                if(cp < 0x80) {
+                    *w++ = (char)cp;
+                } else if(cp < 0x800) {
+                    *w++ = (char)(0xC0 | (cp >> 6));
+                    *w++ = (char)(0x80 | (cp & 0x3F));
+                } else {
+                    *w++ = (char)(0xE0 | (cp >> 12));
+                    *w++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    *w++ = (char)(0x80 | (cp & 0x3F));
+                }
+                break;
+            default:
+                *w++ = *start;  //quote, backslash, slash
+                break;
+        }
+    }
+    *w = '\0';
+    return copy;
+}
+
+//Not a 'public' function; only internal to this file.
+//Whether the string value at p is the given one
+static bool replay_string_is(const char *p, const char *value) {
+    size_t len = strlen(value);
+
+    return p && *p == '"' && strncmp(p + 1, value, len) == 0 && p[len + 1] == '"';
+}
+
+//Not a 'public' function; only internal to this file.
+static SHELF replay_shelf(const char *p) {
+    SHELF shelf;
+
+    for(shelf = HOT_SHELF; shelf < MAX_SHELF; shelf++) {
+        if(replay_string_is(p, ordershelf_to_str(shelf))) return shelf;
+    }
+    return MAX_SHELF;
+}
+
+//Not a 'public' function; only internal to this file.
+static void replay_free_order(REPLAY_ORDER *order) {
+    free(order->id);
+    free(order->name);
+    free(order);
+}
+
+//Not a 'public' function; only internal to this file.
+//Slot of the table that holds the order with the given id, or the empty
+//one it would go in
+static uint64_t replay_slot(const ORDER_KEY *key, const char *id) {
+    uint64_t i = (key->hi ^ key->lo) & g_replay_mask;
+    REPLAY_ORDER *order;
+
+    for(; (order = g_replay_orders[i]) != NULL; i = (i + 1) & g_replay_mask) {
+        if(order->key.hi == key->hi && order->key.lo == key->lo && strcmp(order->id, id) == 0) break;
+    }
+    return i;
+}
+
+//Not a 'public' function; only internal to this file.
+//Doubles the table and files the orders again; false if out of memory
+static bool replay_grow() {
+    REPLAY_ORDER **old = g_replay_orders, *order;
+    uint64_t old_size = g_replay_mask + 1, i;
+
+    if((g_replay_orders = calloc(old_size * 2, sizeof(REPLAY_ORDER *))) == NULL) {
+        g_replay_orders = old;
+        return false;
+    }
+    g_replay_mask = old_size * 2 - 1;
+    for(i = 0; i < old_size; i++) {
+        if((order = old[i]) != NULL) g_replay_orders[replay_slot(&order->key, order->id)] = order;
+    }
+    free(old);
+    return true;
+}
+
+//Not a 'public' function; only internal to this file.
+//The order with the given id, made (on no shelf) if not known yet; takes
+//the id. NULL if out of memory.
+static REPLAY_ORDER *replay_order(char *id) {
+    REPLAY_ORDER *order;
+    ORDER_KEY key;
+    uint64_t i;
+
+    if(id == NULL) return NULL;
+    order_key_from_id(id, strlen(id), &key);
+    if((order = g_replay_orders[i = replay_slot(&key, id)]) != NULL) {
+        free(id);
+        return order;
+    }
+    if(g_replay_count + 1 > (g_replay_mask + 1) / 2) {
+        if(!replay_grow()) {
+            free(id);
+            return NULL;
+        }
+        i = replay_slot(&key, id);
+    }
+    if((order = calloc(1, sizeof(REPLAY_ORDER))) == NULL) {
+        free(id);
+        return NULL;
+    }
+    order->id = id;
+    order->key = key;
+    order->shelf = MAX_SHELF;
+    g_replay_orders[i] = order;
+    g_replay_count++;
+    return order;
+}
+
+//Not a 'public' function; only internal to this file.
+//Takes an order out of the table and frees it; the orders after it in its
+//run are moved up so that no lookup stops short of them
+static void replay_remove_order(REPLAY_ORDER *order) {
+    uint64_t hole = replay_slot(&order->key, order->id), i, home;
+    REPLAY_ORDER *next;
+
+    g_replay_orders[hole] = NULL;
+    g_replay_count--;
+    for(i = (hole + 1) & g_replay_mask; (next = g_replay_orders[i]) != NULL; i = (i + 1) & g_replay_mask) {
+        home = (next->key.hi ^ next->key.lo) & g_replay_mask;
+        //stays put if its home lies (cyclically) in (hole, i]
+        if(((i - home) & g_replay_mask) < ((i - hole) & g_replay_mask)) continue;
+        g_replay_orders[hole] = next;
+        g_replay_orders[i] = NULL;
+        hole = i;
+    }
+    replay_free_order(order);
+}
+
+//Not a 'public' function; only internal to this file.
+//Takes the details of an order (read line, or an order of a snapshot)
+//starting at p; returns where they end
+static const char *replay_details(REPLAY_ORDER *order, const char *p) {
+    const char *field;
+    TEMP temp;
+
+    if((field = replay_field(p, "name")) != NULL) {
+        free(order->name);
+        order->name = replay_string(field, &p);
+    }
+    if((field = replay_field(p, "temp")) != NULL) {
+        for(temp = HOT; temp < MAX_TEMP; temp++) {
+            if(replay_string_is(field, ordertemp_to_str(temp))) order->temp = temp;
+        }
+        p = field;
+    }
+    if((field = replay_field(p, "shelfLife")) != NULL) order->shelfLife = atoi(field);
+    if((field = replay_field(p, "decayRate")) != NULL) order->decayRate = strtof(field, NULL);
+    if((field = replay_field(p, "created")) != NULL) {
+        order->created = strtoll(field, (char **)&p, 10);
+    }
+    return p;
+}
+
+//Not a 'public' function; only internal to this file.
+//Applies one snapshot line: its shelf holds exactly the orders listed
+static void replay_snapshot(const char *line) {
+    SHELF shelf = replay_shelf(replay_field(line, "shelf"));
+    const char *p, *field;
+    REPLAY_ORDER *order;
+    uint64_t i;
+
+    if(shelf == MAX_SHELF) return;
+    if((field = replay_field(line, "modifier")) != NULL) g_replay_modifier[shelf] = atoi(field);
+
+    for(i = 0; i <= g_replay_mask; i++) {
+        if((order = g_replay_orders[i]) != NULL && order->shelf == shelf) order->shelf = MAX_SHELF;
+    }
+    p = replay_field(line, "orders");
+    while(p && (field = replay_field(p, "id")) != NULL) {
+        if((order = replay_order(replay_string(field, &p))) == NULL) return;
+        p = replay_details(order, p);
+        order->shelf = shelf;
+        order->since = g_replay_tick++;
+    }
+}
+
+//Not a 'public' function; only internal to this file.
+//Applies one delta line; the ORDER_EVENT it stands for, MAX_EVENT if none
+static ORDER_EVENT replay_line(const char *line) {
+    const char *event = replay_field(line, "event"), *p;
+    REPLAY_ORDER *order;
+    char *id;
+
+    if(replay_string_is(event, "snapshot")) {
+        replay_snapshot(line);
+        return MAX_EVENT;
+    }
+    if((id = replay_string(replay_field(line, "id"), &p)) == NULL) return MAX_EVENT;
+    if((order = replay_order(id)) == NULL) return MAX_EVENT;
+
+    if(replay_string_is(event, "read")) {
+        replay_details(order, p);
+        return ORDER_READ;
+    }
+    if(replay_string_is(event, "placed") || replay_string_is(event, "moved")) {
+        order->shelf = replay_shelf(replay_field(p, "shelf"));
+        order->since = g_replay_tick++;
+        return MAX_EVENT;
+    }
+    replay_remove_order(order);
+    if(replay_string_is(event, "delivered")) return ORDER_DELIVERED;
+    return replay_string_is(replay_field(line, "reason"), "stale") ?
+                ORDER_DISCARDED_STALE : ORDER_DISCARDED_SHELF_FULL;
+}
+
+//Not a 'public' function; only internal to this file.
+static int replay_cmp_since(const void *a, const void *b) {
+    uint64_t x = (*(REPLAY_ORDER * const *)a)->since, y = (*(REPLAY_ORDER * const *)b)->since;
+    return (x > y) - (x < y);
+}
+
+//Not a 'public' function; only internal to this file.
+//Prints the shelves as the full printout does, valued at the given time
+static void replay_print(int64_t at, ORDER_EVENT last) {
+    REPLAY_ORDER **shelved, *order;
+    SHELF shelf_iter;
+    char time_str_buf[CLOCK_STR_SIZE], buffer[20];
+    int count, i, elapsed_time;
+    uint64_t slot;
+
+    if((shelved = malloc((g_replay_count + 1) * sizeof(REPLAY_ORDER *))) == NULL) return;
+    printf("-------------------------------\n");
+    printf("TIMESTAMP: %s\n", clock_format_wall(at, time_str_buf));
+    printf("EVENT: %s\n", order_event_to_str(last));
+
+    for(shelf_iter = HOT_SHELF; shelf_iter < MAX_SHELF; shelf_iter++) {
+        count = 0;
+        for(slot = 0; slot <= g_replay_mask; slot++) {
+            order = g_replay_orders[slot];
+            if(order && order->shelf == shelf_iter) shelved[count++] = order;
+        }
+        qsort(shelved, count, sizeof(REPLAY_ORDER *), replay_cmp_since);
+
+        printf("SHELF: [%s]\n", ordershelf_to_str(shelf_iter));
+        printf("CONTENTS:[");
+        for(i = 0; i < count; i++) {
+            order = shelved[i];
+            elapsed_time = (int)(at - order->created);
+            printf("%s", (i == 0) ? "\n" : ",\n");
+            printf("\t{\n");
+            printf("\t\t\"id\": \"%s\",\n", order->id);
+            printf("\t\t\"name\": \"%s\",\n", order->name ? order->name : "");
+            printf("\t\t\"temp\": \"%s\",\n", ordertemp_to_str(order->temp));
+            sprintf(buffer,"%d",order->shelfLife);
+            printf("\t\t\"shelfLife\": \"%s\",\n", buffer);
+            sprintf(buffer,"%f",order->decayRate);
+            printf("\t\t\"decayRate\": \"%s\",\n", buffer);
+            sprintf(buffer,"%f",order->shelfLife -
+                        (order->decayRate * (elapsed_time/1000) * g_replay_modifier[shelf_iter]));
+            printf("\t\t\"value\": \"%s\",\n", buffer);
+            printf("\t}");
+        }
+        printf("%s]\n", (count == 0) ? "": "\n");
+    }
+    printf("-------------------------------\n");
+    free(shelved);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *f;
+    char *line = NULL;
+    size_t line_size = 0;
+    const char *ts;
+    int64_t at, until = INT64_MAX, last_at = 0;
+    ORDER_EVENT event, last = MAX_EVENT;
+    uint64_t slot;
+    long lines = 0;
+
+    if(argc < 2 || argc > 3) {
+        printf("usage: css-replay <events file> [msecs since the epoch]\n");
+        return 1;
+    }
+    if(argc == 3) until = strtoll(argv[2], NULL, 10);
+    if((f = fopen(argv[1], "r")) == NULL) {
+        printf("css-replay: cannot open %s\n", argv[1]);
+        return 1;
+    }
+    g_replay_mask = 1023;
+    if((g_replay_orders = calloc(g_replay_mask + 1, sizeof(REPLAY_ORDER *))) == NULL) {
+        printf("css-replay: out of memory\n");
+        fclose(f);
+        return 1;
+    }
+
+    while(getline(&line, &line_size, f) > 0) {
+        if(line[0] != '{' || (ts = replay_field(line, "ts")) == NULL) continue;
+        at = strtoll(ts, NULL, 10);
+        if(at > until) break;
+        if((event = replay_line(line)) != MAX_EVENT) last = event;
+        last_at = at;
+        lines++;
+    }
+    fclose(f);
+    free(line);
+
+    if(lines == 0) {
+        printf("css-replay: no delta records (system.print.mode = delta) in %s up to then\n", argv[1]);
+    } else {
+        replay_print((until == INT64_MAX) ? last_at : until, last);
+    }
+
+    for(slot = 0; slot <= g_replay_mask; slot++) {
+        if(g_replay_orders[slot]) replay_free_order(g_replay_orders[slot]);
+    }
+    free(g_replay_orders);
+    return (lines == 0) ? 1 : 0;
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "common.h"
+#include "constants.h"
+#include "clock.h"
+#include "trace.h"
+
+static const char *g_trace_subsystem_names[MAX_TRACE_SUBSYSTEM] = {
+    "kitchen", "shelf", "courier", "monitor"
+};
+
+//The subsystem a "system.debug.level.<subsystem>" property names;
+//MAX_TRACE_SUBSYSTEM if none
+TRACE_SUBSYSTEM trace_subsystem_from_str(const char *name) {
+    TRACE_SUBSYSTEM sub;
+
+    for(sub = TRACE_KITCHEN; sub < MAX_TRACE_SUBSYSTEM; sub++) {
+        if(strcmp(name, g_trace_subsystem_names[sub]) == 0) break;
+    }
+    return sub;
+}
+
+/**PROC+**********************************************************************/
+/* Name:      trace_print                                                    */
+/*                                                                           */
+/* Purpose:   Prints one debug line (TRACE) with the time in front of it     */
+/*                                                                           */
+/* Params:    IN     fmt             - printf format, subsystem and level    */
+/*                                     already in front                      */
+/*                                                                           */
+/* Returns:   None.                                                          */
+/*                                                                           */
+/* Operation: Out of line, so that the callers only carry the check and the  */
+/*            call; stdout is held for the whole line, as a single printf    */
+/*            would.                                                         */
+/*                                                                           */
+/**PROC-**********************************************************************/
+void trace_print(const char *fmt, ...) {
+    char time_str_buf[CLOCK_STR_SIZE];
+    va_list args;
+
+    flockfile(stdout);
+    fputs(clock_log_time(time_str_buf), stdout);
+    fputs(": ", stdout);
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    funlockfile(stdout);
+}
@@ -0,0 +1,53 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "clock.h"
+
+//Debug lines. TRACE(SHELF, L2, "order id %s\n", id) prints
+//"<time>: shelf   : L2: order id ..." if L2 is on for the shelves.
+//SYSTEM_DEBUG_LEVEL holds the levels that are on for every subsystem,
+//TRACE_LEVEL_BITS (L1..L4) each ("system.debug.level", and
+//"system.debug.level.<subsystem>" for one of them), so the check is one
+//load, AND and branch, laid out as not taken. The time is only formatted
+//for a line that is printed.
+//
+//Levels below TRACE_MIN are not compiled in at all: "make TRACE_MIN=L4"
+//keeps only the L4 lines, "make TRACE_MIN=NONE" none of them (the objects
+//have to be rebuilt for it to take).
+
+typedef enum trace_subsystem_t {
+    TRACE_KITCHEN = 0,      //kitchen thread and the orders reader stage
+    TRACE_SHELF = 1,
+    TRACE_COURIER = 2,
+    TRACE_MONITOR = 3,
+    MAX_TRACE_SUBSYSTEM = 4
+} TRACE_SUBSYSTEM;
+
+#define TRACE_LEVEL_BITS 4
+
+//the given levels on for every subsystem
+#define TRACE_ALL(levels) ((levels) * 0x1111)
+
+#ifndef TRACE_MIN
+#define TRACE_MIN L1
+#endif
+
+#define TRACE_LABEL_KITCHEN "kitchen "
+#define TRACE_LABEL_SHELF   "shelf   "
+#define TRACE_LABEL_COURIER "courier "
+#define TRACE_LABEL_MONITOR "monitor "
+
+#define TRACE_ON(sub, level) \
+    (TRACE_MIN != NONE && (level) >= TRACE_MIN && \
+        __builtin_expect((SYSTEM_DEBUG_LEVEL & ((level) << (TRACE_LEVEL_BITS * TRACE_##sub))) != 0, 0))
+
+//the format has to be a string literal
+#define TRACE(sub, level, ...) \
+    do { \
+        if(TRACE_ON(sub, level)) trace_print(TRACE_LABEL_##sub ": " #level ": " __VA_ARGS__); \
+    } while(0)
+
+TRACE_SUBSYSTEM trace_subsystem_from_str(const char *name);
+void trace_print(const char *fmt, ...) __attribute__((format(printf, 1, 2), cold));
+
+#endif //TRACE_H
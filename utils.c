@@ -4,13 +4,21 @@
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
-#include <sys/time.h>
-#include <glib.h>
-#include <sys/timeb.h>
+#include <pthread.h>
 
 #include "common.h"
 #include "constants.h"
+#include "clock.h"
+#include "trace.h"
 #include "kitchen.h"
+#include "courier.h"
+#include "input.h"
+#include "pool.h"
+#include "order_index.h"
+#include "shelf_soa.h"
+#include "shelf_lockfree.h"
+#include "event_log.h"
+#include "stats.h"
 
 /**PROC+**********************************************************************/
 /* Name:      init                                                           */
@@ -20,46 +28,65 @@
 /* Returns:   bool - for success/failure.                                     */
 /*                                                                           */
 /*                                                                           */
-/* Operation: System init of all key data structures (hashtables mostly)     */
+/* Operation: System init of all key data structures (index and shelves)    */
 /*                                                                           */
 /**PROC-**********************************************************************/
 bool init() {
     bool init_success = true;
-    char time_str_buf[64];  
     
-    init_success = read_properties();
-    current_time_msec(time_str_buf);    
+    init_success = clock_init() && read_properties();
     g_data = malloc(sizeof(DATA));
-    if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: input   : L1: g_data ptr %p\n", time_str_buf, g_data);
+    TRACE(KITCHEN, L1, "g_data ptr %p\n", g_data);
     if(g_data) {
         g_data->g_order_ll_head = NULL;
         g_data->g_order_ll_tail = NULL;
+        g_data->g_discarded_count = 0;
+        g_data->g_discarded_value = 0;
         
-        g_data->g_order_id_shelf_hash = g_hash_table_new(g_str_hash, g_str_equal);
-        g_data->g_order_id_hot_shelf_hash = g_hash_table_new(g_str_hash, g_str_equal);
-        g_data->g_order_id_cold_shelf_hash = g_hash_table_new(g_str_hash, g_str_equal);
-        g_data->g_order_id_frozen_shelf_hash = g_hash_table_new(g_str_hash, g_str_equal);
-        g_data->g_order_id_overflow_shelf_hash = g_hash_table_new(g_str_hash, g_str_equal);
+        //every order on a shelf has one entry in the index
+        SHELF s;
+        int max_orders = 0;
+        bool shelves_ok = true;
+        for(s = HOT_SHELF; s < MAX_SHELF; s++) {
+            SHELF_ARRAY *array = &g_data->g_shelves[s];
+            memset(array, 0, sizeof(SHELF_ARRAY));
+            array->capacity = ordershelf_to_max_size(s);
+            array->orders = calloc(array->capacity + 1, sizeof(ORDER*));
+            if(array->orders == NULL) shelves_ok = false;
+            if(SHELF_CONCURRENCY_TYPE == SHELF_CONCURRENCY_LOCKFREE) {
+                if(!shelf_lf_init(array)) shelves_ok = false;
+            } else if(SHELF_LAYOUT_TYPE == SHELF_LAYOUT_SOA && 
+                    !shelf_soa_init(array, (s == OVERFLOW_SHELF) ? 
+                                SHELF_LIFE_MODIFIER_OVERFLOW_SHELF : SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF)) {
+                shelves_ok = false;
+            }
+            max_orders += array->capacity;
+        }
+        if(!order_index_init(&g_data->g_order_index, max_orders)) shelves_ok = false;
         
-        g_data->g_overflow_by_temp_array = (ORDER***)malloc(MAX_TEMP*sizeof(ORDER*));
-        g_data->g_overflow_by_temp_array_sz = malloc(MAX_TEMP*sizeof(int)); 
+        //the overflow heaps hold at most the overflow shelf, a shelf's
+        //deadline heap every order on it
+        TEMP t;
+        for(t = HOT; t < MAX_TEMP; t++) {
+            g_data->g_overflow_by_temp[t].orders = calloc(OVERFLOW_SHELF_MAX_SIZE + 1, sizeof(ORDER*));
+            g_data->g_overflow_by_temp[t].count = 0;
+            g_data->g_overflow_by_temp[t].kind = ORDER_HEAP_OVERFLOW;
+            if(g_data->g_overflow_by_temp[t].orders == NULL) shelves_ok = false;
+        }
+        for(s = HOT_SHELF; s < MAX_SHELF; s++) {
+            g_data->g_deadlines[s].orders = calloc(g_data->g_shelves[s].capacity + 1, sizeof(ORDER*));
+            g_data->g_deadlines[s].count = 0;
+            g_data->g_deadlines[s].kind = ORDER_HEAP_DEADLINE;
+            if(g_data->g_deadlines[s].orders == NULL) shelves_ok = false;
+            pthread_mutex_init(&shelf_mutex[s], NULL);
+        }
+        pthread_mutex_init(&orders_empty_mutex, NULL);
 
-        if( g_data->g_order_id_shelf_hash == NULL || g_data->g_order_id_hot_shelf_hash == NULL ||
-            g_data->g_order_id_cold_shelf_hash == NULL || g_data->g_order_id_frozen_shelf_hash == NULL ||
-            g_data->g_order_id_overflow_shelf_hash == NULL ||
-            g_data->g_overflow_by_temp_array == NULL || g_data->g_overflow_by_temp_array_sz == NULL
-          ) {
+        if(!shelves_ok || !monitor_init()) {
               init_success = false;
         } else { 
             //All mem alloc's fine so far...continue.
-            TEMP t;
-            for(t = HOT; t < MAX_TEMP; t++) {
-                g_data->g_overflow_by_temp_array[t] = 
-                                (ORDER**)malloc(OVERFLOW_SHELF_MAX_SIZE * sizeof(ORDER*));
-                memset(g_data->g_overflow_by_temp_array[t], 0, 
-                                OVERFLOW_SHELF_MAX_SIZE*sizeof(ORDER*));
-                g_data->g_overflow_by_temp_array_sz[t] = 0;
-            }
+            init_success = event_log_init() && courier_init();
         }
         
     } else {
@@ -81,69 +108,39 @@ bool init() {
 /*                                                                           */
 /**PROC-**********************************************************************/
 void finalize() {   
-    GHashTableIter iter;
-    gpointer key_order_id, value_shelf_enum;
-    g_hash_table_iter_init(&iter, g_data->g_order_id_shelf_hash);
-    while (g_hash_table_iter_next (&iter, &key_order_id, &value_shelf_enum)) {
-        free(value_shelf_enum);
-    }
-    g_hash_table_destroy(g_data->g_order_id_shelf_hash);
+    //whatever is still waiting to be printed goes before the totals
+    event_log_finalize();
+    shelf_report_discards();
+    stats_finalize();
+    
+    order_index_destroy(&g_data->g_order_index);
     
-    g_hash_table_destroy(g_data->g_order_id_hot_shelf_hash);
-    g_hash_table_destroy(g_data->g_order_id_cold_shelf_hash);
-    g_hash_table_destroy(g_data->g_order_id_frozen_shelf_hash);
-    g_hash_table_destroy(g_data->g_order_id_overflow_shelf_hash);
+    SHELF s;
+    for(s = HOT_SHELF; s < MAX_SHELF; s++) {
+        free(g_data->g_shelves[s].orders);
+        shelf_soa_destroy(&g_data->g_shelves[s]);
+        shelf_lf_destroy(&g_data->g_shelves[s]);
+        free(g_data->g_deadlines[s].orders);
+        pthread_mutex_destroy(&shelf_mutex[s]);
+    }
     
     TEMP t;
     for(t = HOT; t < MAX_TEMP; t++) {
-        free(g_data->g_overflow_by_temp_array[t]);      
+        free(g_data->g_overflow_by_temp[t].orders);      
     }
-    free(g_data->g_overflow_by_temp_array);
-    free(g_data->g_overflow_by_temp_array_sz);
+    pthread_mutex_destroy(&orders_empty_mutex);
+    monitor_finalize();
     
-    //TODO - g_order_ll_head, tail free must happen sooner ? Or we can keep this around 
-    //to count items processed
-    int i = 0;
-    ORDER_LL_NODE *ll_node_to_free = g_data->g_order_ll_head, *next;
-    while(ll_node_to_free) {
-        i++;
-        next = ll_node_to_free->next;
-        free(ll_node_to_free);
-        ll_node_to_free = next;
-    }
-    if(SYSTEM_DEBUG_LEVEL & L1) printf("%s: input   : L1: LL size %d\n", "finalize", i);
+    //the kitchen empties the LL every tick; this is for an interrupted one
+    input_release_orders();
+    //orders still on a shelf (and their ids and timers) are returned with
+    //the pools
+    pool_destroy_all();
     
     free(g_data);
     free(SYSTEM_ORDERS_INPUT_FILE);
 }
 
-/**PROC+**********************************************************************/
-/* Name:      current_time_msec                                              */
-/*                                                                           */
-/* Purpose:   Given a buffer this method fills it with current system date   */
-/*                                                                           */
-/* Params:    IN/OUT      buf     buffer passed by caller is filled in       */
-/*                                                                           */
-/* Returns:   None.                                                          */
-/*                                                                           */
-/*                                                                           */
-/* Operation: Buffer is filled with  formatted date/time string              */
-/*                                                                           */
-/**PROC-**********************************************************************/
-void current_time_msec(char *buf) {
-    struct timeval tv;
-    time_t nowtime;
-    struct tm *nowtm;
-    char tmbuf[64];
-
-    gettimeofday(&tv, NULL);
-
-    nowtime = tv.tv_sec;
-    nowtm = localtime(&nowtime);
-    strftime(tmbuf, sizeof tmbuf, "%Y-%m-%d %H:%M:%S", nowtm);
-    snprintf(buf, 64, "%s.%03d", tmbuf, tv.tv_usec/1000);            
-}
-
 //Self explanatory util method...returns max size of shelves
 int ordershelf_to_max_size(SHELF shelf) {
     int shelf_size = 0;
@@ -227,71 +224,43 @@ char *order_event_to_str(ORDER_EVENT evt) {
     }
 }
 
-//Print formatted detailed output as per problem statement
-//Also prints "value" of the order calculated using age of the order
-static void print_order_contents(ORDER *order, double value) {
-    char buffer[20];
-    
-    printf("\t{\n");
-    printf("\t\t\"id\": \"%s\",\n", order->id);
-    printf("\t\t\"name\": \"%s\",\n", order->name);
-    printf("\t\t\"temp\": \"%s\",\n", ordertemp_to_str(order->temp));
-    sprintf(buffer,"%d",order->shelfLife);
-    printf("\t\t\"shelfLife\": \"%s\",\n", buffer);
-    sprintf(buffer,"%f",order->decayRate);
-    printf("\t\t\"decayRate\": \"%s\",\n", buffer);
-    sprintf(buffer,"%f",value);
-    printf("\t\t\"value\": \"%s\",\n", buffer);
-    printf("\t}");
+//Self explanatory util method...returns string for display
+char *overflow_eviction_to_str(OVERFLOW_EVICTION policy) {
+    switch(policy) {
+        case OVERFLOW_EVICT_DROP_NEW:
+            return "drop_new";
+            break;
+        case OVERFLOW_EVICT_NEAREST_EXPIRY:
+            return "nearest_expiry";
+            break;
+        default:
+            return "UNKNOWN";
+            break;
+    }
 }
 
 //Print formatted detailed output as per problem statement on key events
+//Each shelf is copied under its lock only and the printout is formatted and
+//written by the writer thread (event_log.c), so neither the size of the
+//shelves nor the speed of the terminal adds to how long a shelf stays
+//locked; the caller must not hold a shelf lock.
+//With system.print.mode = delta the changes are printed as they happen
+//(print_order_delta) and an event only prints a snapshot of the shelves
+//once one is due.
 void print_event_shelf_contents(ORDER_EVENT evt) {
     if(SYSTEM_PRINT_SHELF_CONTENTS) {
-        SHELF shelf_iter;
-        int elapsed_time;//seconds
-        double value;
-        bool is_first;
-        GHashTable *shelf_hash;
-        GHashTableIter shelf_hash_iter;
-        gpointer key_order_id, value_order;
-        ORDER *order;
-        struct timeb print_time;
-        char time_str_buf[64];  
-        
-        printf("-------------------------------\n");
-        current_time_msec(time_str_buf);
-        printf("TIMESTAMP: %s\n", time_str_buf);
-        printf("EVENT: %s\n", order_event_to_str(evt));
-        
-        ftime(&print_time);
-        int shelfDecayModifier;
-                
-        for(shelf_iter = HOT_SHELF; (shelf_iter < MAX_SHELF); shelf_iter++) {
-                shelf_hash = shelf_to_hash(shelf_iter);
-                printf("SHELF: [%s]\n", ordershelf_to_str(shelf_iter));
-                printf("CONTENTS:[");
-                is_first = true;
-                
-                if(shelf_hash) {
-                    shelfDecayModifier = (shelf_iter == OVERFLOW_SHELF) ? 
-                                    SHELF_LIFE_MODIFIER_OVERFLOW_SHELF : SHELF_LIFE_MODIFIER_SINGLE_TEMP_SHELF;
-                    g_hash_table_iter_init(&shelf_hash_iter, shelf_hash);
-                    while (g_hash_table_iter_next(&shelf_hash_iter, &key_order_id, &value_order)) {
-                        printf("%s", is_first ? "\n" : ",\n");
-                        if(is_first) is_first = false;
-                        order = (ORDER*)value_order;
-                        elapsed_time = (1000.0 * (print_time.time - order->creationTime.time) + 
-                                                (print_time.millitm - order->creationTime.millitm));
-                                            
-                        //printf("%s: monitor : L1: order_id  %s order %p name %s diff %u\n", time_str_buf, 
-                        //                          order_id, order, order->name, diff);
-                        value = order->shelfLife - (order->decayRate * (elapsed_time/1000) * shelfDecayModifier);
-                        print_order_contents(order, value);
-                    }
-                }
-                printf("%s]\n", is_first ? "": "\n");
-            }
-        printf("-------------------------------\n");
-    }//if(SYSTEM_PRINT_SHELF_CONTENTS)
+        if(SYSTEM_PRINT_MODE == PRINT_MODE_DELTA) {
+            event_log_snapshot_due();
+        } else {
+            event_log_shelf_contents(evt);
+        }
+    }
+}
+
+//Prints what happened to one order (system.print.mode = delta only); the
+//caller holds the lock of every shelf it touches, or owns the order
+void print_order_delta(ORDER_DELTA delta, ORDER *order, SHELF shelf) {
+    if(SYSTEM_PRINT_SHELF_CONTENTS && SYSTEM_PRINT_MODE == PRINT_MODE_DELTA) {
+        event_log_delta(delta, order, shelf);
+    }
 }